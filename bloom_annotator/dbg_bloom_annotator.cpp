@@ -1,15 +1,22 @@
 #include "dbg_bloom_annotator.hpp"
 
 #include <fstream>
+#include <algorithm>
 #include <cmath>
 #include <map>
 #include <unordered_map>
+#include <stdexcept>
 
 #include "../serialization.hpp"
+#include "thread_pool.hpp"
 
 
 namespace hash_annotate {
 
+constexpr DeBruijnGraphWrapper::edge_index DeBruijnGraphWrapper::npos;
+constexpr uint64_t PreciseHashAnnotator::kFormatTag;
+constexpr size_t PreciseHashAnnotator::kBlockRows;
+
 std::unordered_map<size_t, size_t> PreciseHashAnnotator::compute_permutation_map() const {
     std::unordered_map<size_t, size_t> index_map;
     size_t index_size = 0;
@@ -65,16 +72,100 @@ PreciseHashAnnotator::permute_indices(const std::vector<uint64_t> &a,
     return b;
 }
 
-uint64_t PreciseHashAnnotator::serialize(std::ostream &out) const {
-    uint64_t written_bytes = 0;
+// Append |value| to |out| in groups of 7 bits, the lowest first, with the
+// upper bit of each byte set if more bytes follow
+static void append_varint(std::string *out, uint64_t value) {
+    while (value >= 0x80) {
+        out->push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out->push_back(static_cast<char>(value));
+}
 
-    written_bytes += serialization::serializeNumber(out, prefix_indices_.size());
-    for (auto i : prefix_indices_)
-        written_bytes += serialization::serializeNumber(out, i);
+// Returns NULL if the value does not end before |end|
+static const char* read_varint(const char *data, const char *end, uint64_t *value) {
+    *value = 0;
+    for (size_t shift = 0; data < end && shift < 64; shift += 7) {
+        uint8_t byte = *data++;
+        *value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return data;
+    }
+    return NULL;
+}
 
-    written_bytes += annotation_exact.serialize(out);
+PreciseRowWriter::PreciseRowWriter(std::ostream &out,
+                                   const std::set<pos_t> &prefix_indices,
+                                   size_t num_columns,
+                                   size_t num_rows)
+      : out_(out), num_rows_(num_rows) {
+    const uint64_t tag = PreciseHashAnnotator::kFormatTag;
+    out_.write(reinterpret_cast<const char*>(&tag), sizeof(tag));
+    written_bytes_ = sizeof(tag);
+
+    written_bytes_ += serialization::serializeNumber(out_, prefix_indices.size());
+    for (auto i : prefix_indices)
+        written_bytes_ += serialization::serializeNumber(out_, i);
+
+    written_bytes_ += serialization::serializeNumber(out_, num_columns);
+    written_bytes_ += serialization::serializeNumber(out_, num_rows);
+    written_bytes_ += serialization::serializeNumber(out_, PreciseHashAnnotator::kBlockRows);
+
+    // the offsets are filled in when the rows are written
+    const size_t block_rows = PreciseHashAnnotator::kBlockRows;
+    offsets_.assign((num_rows + block_rows - 1) / block_rows + 1, 0);
+    offsets_pos_ = out_.tellp();
+    written_bytes_ += serialization::serializeRawArray(out_, offsets_.data(), offsets_.size());
+}
 
-    return written_bytes;
+void PreciseRowWriter::write_row(const std::vector<pos_t> &columns) {
+    assert(row_ < num_rows_);
+    if (row_ % PreciseHashAnnotator::kBlockRows == 0)
+        flush_block();
+
+    // the number of columns, the first column and the gaps between the next ones
+    append_varint(&block_, columns.size());
+    for (size_t j = 0; j < columns.size(); ++j) {
+        append_varint(&block_, j ? columns[j] - columns[j - 1] - 1 : columns[j]);
+    }
+    row_++;
+}
+
+void PreciseRowWriter::flush_block() {
+    out_.write(block_.data(), block_.size());
+    data_size_ += block_.size();
+    block_.clear();
+    if (row_ < num_rows_)
+        offsets_[row_ / PreciseHashAnnotator::kBlockRows] = data_size_;
+}
+
+uint64_t PreciseRowWriter::finish() {
+    assert(row_ == num_rows_);
+    flush_block();
+    offsets_.back() = data_size_;
+
+    // the rows are one raw array
+    const char padding[8] = {};
+    out_.write(padding, serialization::rawArraySize(data_size_) - data_size_);
+    written_bytes_ += serialization::rawArraySize(data_size_);
+
+    auto end = out_.tellp();
+    out_.seekp(offsets_pos_);
+    serialization::serializeRawArray(out_, offsets_.data(), offsets_.size());
+    out_.seekp(end);
+    return written_bytes_;
+}
+
+uint64_t PreciseHashAnnotator::serialize(std::ostream &out) const {
+    const size_t num_rows = graph_.get_num_edges();
+
+    PreciseRowWriter writer(out, prefix_indices_, annotation_exact.size(), num_rows);
+    for (size_t r = 0; r < num_rows; ++r) {
+        writer.write_row(annotation_exact.find_indices(
+            canonical_kmer(get_kmer(graph_.first_edge() + r))
+        ));
+    }
+    return writer.finish();
 }
 
 uint64_t PreciseHashAnnotator::serialize(const std::string &filename) const {
@@ -82,20 +173,111 @@ uint64_t PreciseHashAnnotator::serialize(const std::string &filename) const {
     return serialize(fout);
 }
 
-void PreciseHashAnnotator::load(std::istream &in) {
-    size_t num_prefix_cols = serialization::loadNumber(in);
+bool PreciseHashAnnotator::load_rows(std::istream &in,
+                                     std::set<pos_t> *prefix_indices,
+                                     size_t *num_columns,
+                                     std::vector<std::vector<pos_t>> *rows,
+                                     size_t num_threads) {
+    auto begin = in.tellg();
+    uint64_t tag = 0;
+    if (!in.read(reinterpret_cast<char*>(&tag), sizeof(tag)) || tag != kFormatTag) {
+        in.clear();
+        in.seekg(begin);
+        return false;
+    }
 
-    prefix_indices_.clear();
+    size_t num_prefix_cols = serialization::loadNumber(in);
+    prefix_indices->clear();
     while (num_prefix_cols--) {
-        prefix_indices_.insert(serialization::loadNumber(in));
+        prefix_indices->insert(serialization::loadNumber(in));
     }
 
-    annotation_exact.load(in);
+    *num_columns = serialization::loadNumber(in);
+    const size_t num_rows = serialization::loadNumber(in);
+    const size_t block_rows = serialization::loadNumber(in);
+    if (!in.good() || !block_rows)
+        throw std::runtime_error("Corrupted precise annotation");
+
+    const size_t num_blocks = (num_rows + block_rows - 1) / block_rows;
+    auto offsets = serialization::loadRawArray<uint64_t>(in, num_blocks + 1);
+    if (offsets.front() || !std::is_sorted(offsets.begin(), offsets.end()))
+        throw std::runtime_error("Corrupted precise annotation");
+
+    auto data = serialization::loadRawArray<char>(in, offsets.back());
+
+    rows->assign(num_rows, std::vector<pos_t>());
+    std::vector<char> corrupted(num_blocks, false);
+
+    utils::ThreadPool thread_pool(num_threads > 1 ? num_threads : 0);
+    for (size_t b = 0; b < num_blocks; ++b) {
+        thread_pool.enqueue([&, b]() {
+            const char *pos = data.data() + offsets[b];
+            const char *end = data.data() + offsets[b + 1];
+            const size_t last_row = std::min(num_rows, (b + 1) * block_rows);
+            for (size_t r = b * block_rows; r < last_row; ++r) {
+                uint64_t size;
+                if (!(pos = read_varint(pos, end, &size)) || size > *num_columns) {
+                    corrupted[b] = true;
+                    return;
+                }
+                auto &row = (*rows)[r];
+                row.resize(size);
+                uint64_t column = 0;
+                for (size_t j = 0; j < size; ++j) {
+                    uint64_t gap;
+                    if (!(pos = read_varint(pos, end, &gap))) {
+                        corrupted[b] = true;
+                        return;
+                    }
+                    column = j ? column + gap + 1 : gap;
+                    if (column >= *num_columns) {
+                        corrupted[b] = true;
+                        return;
+                    }
+                    row[j] = column;
+                }
+            }
+            corrupted[b] = pos != end;
+        });
+    }
+    thread_pool.join();
+
+    if (std::find(corrupted.begin(), corrupted.end(), true) != corrupted.end())
+        throw std::runtime_error("Corrupted precise annotation");
+
+    return true;
+}
+
+void PreciseHashAnnotator::load(std::istream &in, size_t num_threads) {
+    std::vector<std::vector<pos_t>> rows;
+    size_t num_columns;
+    if (!load_rows(in, &prefix_indices_, &num_columns, &rows, num_threads)) {
+        size_t num_prefix_cols = serialization::loadNumber(in);
+
+        prefix_indices_.clear();
+        while (num_prefix_cols--) {
+            prefix_indices_.insert(serialization::loadNumber(in));
+        }
+
+        annotation_exact.load(in);
+        return;
+    }
+
+    if (rows.size() != graph_.get_num_edges())
+        throw std::runtime_error("The precise annotation does not match the graph");
+
+    annotation_exact.clear();
+    annotation_exact.resize(num_columns);
+    annotation_exact.kmer_map_.reserve(rows.size());
+    for (size_t r = 0; r < rows.size(); ++r) {
+        annotation_exact.insert_row(canonical_kmer(get_kmer(graph_.first_edge() + r)),
+                                    std::move(rows[r]));
+    }
 }
 
-void PreciseHashAnnotator::load(const std::string &filename) {
+void PreciseHashAnnotator::load(const std::string &filename, size_t num_threads) {
     std::ifstream fin(filename);
-    load(fin);
+    load(fin, num_threads);
     fin.close();
 }
 
@@ -138,12 +320,22 @@ void PreciseHashAnnotator::add_sequence(const std::string &sequence,
 
     for (size_t i = 0; i + graph_.get_k() < preprocessed_seq.size(); ++i) {
         annotation_exact.insert(
-            &preprocessed_seq[i],
-            &preprocessed_seq[i] + graph_.get_k() + 1, column
+            canonical_kmer(preprocessed_seq.substr(i, graph_.get_k() + 1)),
+            column
         );
     }
 }
 
+std::string PreciseHashAnnotator::canonical_kmer(const std::string &kmer) const {
+    if (!graph_.is_canonical())
+        return kmer;
+
+    std::string reverse(kmer.rbegin(), kmer.rend());
+    std::transform(reverse.begin(), reverse.end(), reverse.begin(),
+                   [](char c) { return complement(c); });
+    return std::min(kmer, reverse);
+}
+
 void PreciseHashAnnotator::add_column(const std::string &sequence, bool rooted) {
     add_sequence(sequence, annotation_exact.size(), rooted);
 }
@@ -151,7 +343,8 @@ void PreciseHashAnnotator::add_column(const std::string &sequence, bool rooted)
 std::vector<uint64_t>
 PreciseHashAnnotator::annotation_from_kmer(const std::string &kmer, bool permute) const {
     assert(kmer.length() == graph_.get_k() + 1);
-    auto annot = annotation_exact.find(kmer.data(), kmer.data() + kmer.size());
+    auto canonical = canonical_kmer(kmer);
+    auto annot = annotation_exact.find(canonical.data(), canonical.data() + canonical.size());
     if (!permute || prefix_indices_.empty())
         return annot;
 
@@ -170,17 +363,46 @@ double compute_optimal_bloom_size_factor(double bloom_fpp) {
     return -std::log2(bloom_fpp) / std::log(2);
 }
 
+std::unique_ptr<MultiHashAnnotation>
+make_annotation(BloomAnnotator::Layout layout, size_t num_hash_functions) {
+    switch (layout) {
+        case BloomAnnotator::STANDARD:
+            return std::unique_ptr<MultiHashAnnotation>(
+                new FilterAnnotation<BloomFilter>(num_hash_functions)
+            );
+        case BloomAnnotator::BLOCKED:
+            return std::unique_ptr<MultiHashAnnotation>(
+                new FilterAnnotation<BlockedBloomFilter>(num_hash_functions)
+            );
+        case BloomAnnotator::BIT_SLICED:
+            return std::unique_ptr<MultiHashAnnotation>(
+                new BitSlicedAnnotation(num_hash_functions)
+            );
+        case BloomAnnotator::FROZEN:
+            return std::unique_ptr<MultiHashAnnotation>(
+                new FilterAnnotation<RibbonFilter>(num_hash_functions)
+            );
+    }
+    assert(false);
+    return NULL;
+}
+
 // Computes optimal `bloom_size_factor` and `num_hash_functions` automatically
 BloomAnnotator::BloomAnnotator(const DeBruijnGraphWrapper &graph,
                                double bloom_fpp,
-                               bool verbose)
+                               bool verbose,
+                               Layout layout,
+                               Hashing hashing)
       : graph_(graph),
         bloom_size_factor_(compute_optimal_bloom_size_factor(bloom_fpp)),
         bloom_fpp_(bloom_fpp),
-        annotation(compute_optimal_num_hashes(bloom_fpp_, bloom_size_factor_)),
-        total_traversed_(0),
+        layout_(layout),
+        hashing_(graph.is_canonical() ? CANONICAL : hashing),
+        annotation(make_annotation(layout_,
+            compute_optimal_num_hashes(bloom_fpp_, bloom_size_factor_)
+        )),
         verbose_(verbose) {
-    if (!annotation.num_hash_functions()) {
+    if (!annotation->num_hash_functions()) {
         std::cerr << "ERROR: invalid Bloom filter parameters" << std::endl;
         exit(1);
     }
@@ -190,23 +412,28 @@ BloomAnnotator::BloomAnnotator(const DeBruijnGraphWrapper &graph,
 BloomAnnotator::BloomAnnotator(const DeBruijnGraphWrapper &graph,
                                double bloom_size_factor,
                                size_t num_hash_functions,
-                               bool verbose)
+                               bool verbose,
+                               Layout layout,
+                               Hashing hashing)
       : graph_(graph),
         bloom_size_factor_(bloom_size_factor),
         bloom_fpp_(exp(-bloom_size_factor_ * std::log(2) * std::log(2))),
-        annotation(num_hash_functions
-                      ? num_hash_functions
-                      : compute_optimal_num_hashes(bloom_fpp_, bloom_size_factor_)),
-        total_traversed_(0),
+        layout_(layout),
+        hashing_(graph.is_canonical() ? CANONICAL : hashing),
+        annotation(make_annotation(layout_,
+            num_hash_functions
+                ? num_hash_functions
+                : compute_optimal_num_hashes(bloom_fpp_, bloom_size_factor_)
+        )),
         verbose_(verbose) {
-    if (!annotation.num_hash_functions()) {
+    if (!annotation->num_hash_functions()) {
         std::cerr << "ERROR: invalid Bloom filter parameters" << std::endl;
         exit(1);
     }
 }
 
 size_t BloomAnnotator::num_hash_functions() const {
-    return annotation.num_hash_functions();
+    return annotation->num_hash_functions();
 }
 
 double BloomAnnotator::size_factor() const {
@@ -218,7 +445,35 @@ double BloomAnnotator::approx_false_positive_rate() const {
 }
 
 size_t BloomAnnotator::get_size(size_t i) const {
-    return annotation[i].size();
+    return annotation->column_size(i);
+}
+
+void BloomAnnotator::reserve(size_t num_elements) {
+    if (layout_ != BIT_SLICED)
+        return;
+
+    annotation->resize_column(0, static_cast<size_t>(
+        bloom_size_factor_ * static_cast<double>(num_elements) + 1
+    ));
+}
+
+void BloomAnnotator::reserve_column(size_t column, size_t num_elements) {
+    if (layout_ == BIT_SLICED) {
+        reserve(num_elements);
+    } else {
+        init_column(column, num_elements);
+    }
+}
+
+void BloomAnnotator::count_kmers(const std::string &sequence, HyperLogLog *counter) const {
+    std::string preprocessed_seq = graph_.encode_sequence(sequence);
+    if (preprocessed_seq.size() < graph_.get_k() + 1)
+        return;
+
+    for (auto hash_it = make_hash_iterator(preprocessed_seq, 1);
+                !hash_it->is_end(); ++*hash_it) {
+        counter->insert((**hash_it)[0]);
+    }
 }
 
 void BloomAnnotator::add_sequence(const std::string &sequence, size_t column, size_t num_elements) {
@@ -228,37 +483,192 @@ void BloomAnnotator::add_sequence(const std::string &sequence, size_t column, si
     if (preprocessed_seq.size() < graph_.get_k() + 1)
         return;
 
-    if (column >= annotation.size())
-        annotation.resize(column + 1);
+    init_column(column, num_elements ? num_elements
+                                     : preprocessed_seq.size() - graph_.get_k());
+
+    for (auto hash_it = make_hash_iterator(preprocessed_seq);
+                !hash_it->is_end(); ++*hash_it) {
+        annotation->insert(**hash_it, column);
+    }
+}
 
-    if (annotation[column].size() == 0) {
-        annotation[column].resize(static_cast<size_t>(
-            bloom_size_factor_
-            * static_cast<double>(num_elements ? num_elements
-                                               : preprocessed_seq.size() - graph_.get_k())
-            + 1
+void BloomAnnotator::init_column(size_t column, size_t num_elements) {
+    if (layout_ == FROZEN) {
+        std::cerr << "ERROR: can't add sequences to a frozen annotation" << std::endl;
+        exit(1);
+    }
+
+    if (column >= annotation->size())
+        annotation->resize(column + 1);
+
+    if (annotation->column_size(column) == 0) {
+        annotation->resize_column(column, static_cast<size_t>(
+            bloom_size_factor_ * static_cast<double>(num_elements) + 1
         ));
-        if (annotation[column].size() == 0) {
+        if (annotation->column_size(column) == 0) {
             std::cerr << "ERROR: resize failed" << std::endl;
             exit(1);
         }
     }
+}
 
-    for (auto hash_it = CyclicHashIterator(preprocessed_seq,
-                                           graph_.get_k() + 1,
-                                           annotation.num_hash_functions());
-                !hash_it.is_end(); ++hash_it) {
-        annotation.insert(*hash_it, column);
+void BloomAnnotator::add_sequences(const std::vector<std::string> &sequences,
+                                   const std::vector<std::vector<size_t>> &columns,
+                                   size_t num_threads,
+                                   const std::vector<size_t> &num_elements) {
+    assert(columns.size() == sequences.size());
+    assert(num_elements.empty() || num_elements.size() == sequences.size());
+
+    if (num_threads <= 1) {
+        for (size_t i = 0; i < sequences.size(); ++i) {
+            for (size_t column : columns[i]) {
+                add_sequence(sequences[i], column,
+                             num_elements.empty() ? 0 : num_elements[i]);
+            }
+        }
+        return;
+    }
+
+    // the filters are sized by the first sequence of each column,
+    // so the columns are initialized in order before any insertion
+    std::vector<std::string> preprocessed(sequences.size());
+    size_t total_length = 0;
+    for (size_t i = 0; i < sequences.size(); ++i) {
+        preprocessed[i] = graph_.encode_sequence(sequences[i]);
+        if (preprocessed[i].size() < graph_.get_k() + 1)
+            continue;
+
+        total_length += preprocessed[i].size();
+        for (size_t column : columns[i]) {
+            init_column(column, !num_elements.empty() && num_elements[i]
+                                    ? num_elements[i]
+                                    : preprocessed[i].size() - graph_.get_k());
+        }
+    }
+
+    // setting bits commutes, so the chunks can be inserted in any order
+    const size_t num_blocks = num_threads * 4;
+    utils::ThreadPool thread_pool(num_threads);
+    for (size_t begin = 0; begin < sequences.size(); ) {
+        size_t end = begin;
+        size_t chunk_length = 0;
+        while (end < sequences.size()
+                && (end == begin || chunk_length * num_blocks < total_length)) {
+            chunk_length += preprocessed[end++].size();
+        }
+        thread_pool.enqueue([&, begin, end]() {
+            for (size_t i = begin; i < end; ++i) {
+                if (preprocessed[i].size() < graph_.get_k() + 1 || columns[i].empty())
+                    continue;
+
+                for (auto hash_it = make_hash_iterator(preprocessed[i]);
+                            !hash_it->is_end(); ++*hash_it) {
+                    for (size_t column : columns[i]) {
+                        annotation->insert_concurrent(**hash_it, column);
+                    }
+                }
+            }
+        });
+        begin = end;
     }
+    thread_pool.join();
 }
 
 void BloomAnnotator::add_column(const std::string &sequence, size_t num_elements) {
-    add_sequence(sequence, annotation.size(), num_elements);
+    add_sequence(sequence, annotation->size(), num_elements);
+}
+
+void BloomAnnotator::freeze(const PreciseAnnotator &annotation_exact,
+                            size_t fingerprint_bits,
+                            size_t num_threads) {
+    if (layout_ == FROZEN)
+        return;
+
+    if (!fingerprint_bits) {
+        fingerprint_bits = std::min(
+            std::max(static_cast<size_t>(ceil(-std::log2(bloom_fpp_))), size_t(1)),
+            RibbonFilter::kMaxFingerprintBits
+        );
+    }
+
+    // collect the keys of the edges in each column
+    std::vector<std::vector<uint64_t>> keys(annotation->size());
+    for (auto i = graph_.first_edge(); i <= graph_.last_edge(); ++i) {
+        auto kmer = kmer_from_index(i);
+        if (graph_.is_dummy_edge(kmer))
+            continue;
+
+        auto row = annotation_exact.annotate_edge(i);
+        uint64_t key = RibbonFilter::get_key(make_hasher(kmer)->get_hash());
+        for (size_t w = 0; w < row.size(); ++w) {
+            for (uint64_t bits = row[w]; bits; bits &= bits - 1) {
+                size_t column = w * 64 + __builtin_ctzll(bits);
+                if (column < keys.size())
+                    keys[column].push_back(key);
+            }
+        }
+    }
+
+    auto frozen = new FilterAnnotation<RibbonFilter>(annotation->num_hash_functions());
+    std::unique_ptr<MultiHashAnnotation> frozen_annotation(frozen);
+    if (keys.size())
+        frozen->resize(keys.size());
+
+    utils::ThreadPool thread_pool(num_threads > 1 ? num_threads : 0);
+    for (size_t j = 0; j < keys.size(); ++j) {
+        thread_pool.enqueue([&, j]() {
+            (*frozen)[j].build(std::move(keys[j]), fingerprint_bits);
+        });
+    }
+    thread_pool.join();
+
+    annotation.swap(frozen_annotation);
+    layout_ = FROZEN;
 }
 
 std::vector<uint64_t>
 BloomAnnotator::annotation_from_kmer(const std::string &kmer) const {
-    return annotation.find(annotation.compute_hash(kmer));
+    return annotation->find(make_hasher(kmer)->get_hash());
+}
+
+size_t BloomAnnotator::annotate_sequence(const std::string &sequence,
+                                         uint64_t *annotations) const {
+    std::string preprocessed_seq = graph_.encode_sequence(sequence);
+
+    if (preprocessed_seq.size() < graph_.get_k() + 1)
+        return 0;
+
+    size_t num_kmers = preprocessed_seq.size() - graph_.get_k();
+    std::fill(annotations, annotations + num_kmers * num_words(), 0);
+
+    std::vector<DeBruijnGraphWrapper::edge_index> edges(num_kmers);
+    graph_.map_kmers(preprocessed_seq, edges.data());
+
+    size_t num_found = 0;
+    size_t i = 0;
+    for (auto hash_it = make_hash_iterator(preprocessed_seq);
+                !hash_it->is_end(); ++*hash_it, ++i) {
+        if (edges[i] == DeBruijnGraphWrapper::npos)
+            continue;
+
+        annotation->find(**hash_it, annotations + i * num_words());
+        num_found++;
+    }
+    assert(i == num_kmers);
+    return num_found;
+}
+
+size_t BloomAnnotator::count_labels(const std::string &sequence, uint64_t *counts) const {
+    if (sequence.size() < graph_.get_k() + 1)
+        return 0;
+
+    size_t num_kmers = sequence.size() - graph_.get_k();
+    std::vector<uint64_t> annotations(num_kmers * num_words());
+    size_t num_found = annotate_sequence(sequence, annotations.data());
+    for (size_t i = 0; i < num_kmers; ++i) {
+        count_bits(&annotations[i * num_words()], num_words(), counts);
+    }
+    return num_found;
 }
 
 std::vector<uint64_t>
@@ -269,14 +679,15 @@ BloomAnnotator::get_annotation(DeBruijnGraphWrapper::edge_index i) const {
 std::vector<uint64_t>
 BloomAnnotator::get_annotation_corrected(DeBruijnGraphWrapper::edge_index i,
                                          bool check_both_directions,
-                                         size_t path_cutoff) const {
+                                         size_t path_cutoff,
+                                         size_t *num_traversed) const {
     //initial raw annotation
     std::string orig_kmer = kmer_from_index(i);
     assert(orig_kmer.length() == graph_.get_k() + 1);
-    auto hasher = CyclicMultiHash(orig_kmer, annotation.num_hash_functions());
+    auto hasher = make_hasher(orig_kmer);
 
     //auto curannot = annotation_from_kmer(orig_kmer);
-    auto curannot = annotation.find(hasher.get_hash());
+    auto curannot = annotation->find(hasher->get_hash());
 
     // Dummy edges are not supposed to be annotated
     if (graph_.is_dummy_edge(orig_kmer)) {
@@ -289,30 +700,35 @@ BloomAnnotator::get_annotation_corrected(DeBruijnGraphWrapper::edge_index i,
     if (!pcount_old)
         return curannot;
 
-    char cur_edge = orig_kmer.back();
+    // only the columns left in curannot are probed, the result
+    // goes to a buffer reused for all steps
+    std::vector<uint64_t> nextannot(curannot.size());
+
+    size_t traversed = 0;
+    std::vector<DeBruijnGraphWrapper::edge_index> next_edges;
     auto j = i;
     size_t path = 0;
     while (path++ < path_cutoff) {
-        const_cast<size_t&>(total_traversed_)++;
+        traversed++;
+
+        //traverse forward, the next k-mer must have outdegree one
+        graph_.get_outgoing_edges(j, next_edges);
+        if (next_edges.size() != 1)
+            break;
 
-        //traverse forward
-        j = graph_.next_edge(j, cur_edge);
+        j = next_edges.front();
 
-        cur_edge = graph_.get_edge_label(j);
+        char cur_edge = graph_.get_edge_label(j);
 
-        //check outdegree
+        //check indegree
         if (graph_.is_dummy_label(cur_edge)
-                || !graph_.has_the_only_outgoing_edge(j)
-                || (check_both_directions && !graph_.has_the_only_incoming_edge(j)))
+                || (check_both_directions && graph_.get_indegree(j) != 1))
             break;
 
-        hasher.update(cur_edge);
+        hasher->update(cur_edge);
 
         //bitwise AND annotations
-        auto nextannot = hash_annotate::merge_and(
-            curannot,
-            annotation.find(hasher.get_hash())
-        );
+        annotation->find(hasher->get_hash(), curannot.data(), nextannot.data());
 
         //check popcounts
         size_t pcount_new = hash_annotate::popcount(nextannot);
@@ -325,7 +741,7 @@ BloomAnnotator::get_annotation_corrected(DeBruijnGraphWrapper::edge_index i,
 
         //path length stopping conditions
         if (pcount_new < pcount_old) {
-            curannot = nextannot;
+            curannot.swap(nextannot);
             path = 0;
             pcount_old = pcount_new;
         }
@@ -336,7 +752,7 @@ BloomAnnotator::get_annotation_corrected(DeBruijnGraphWrapper::edge_index i,
     assert(orig_kmer.length() == indices.size());
     indices[0] = i;
 
-    auto back_hasher = CyclicMultiHash(orig_kmer, annotation.num_hash_functions());
+    auto back_hasher = make_hasher(orig_kmer);
     j = i;
     for (size_t m = 0; m < graph_.get_k(); ++m) {
         j = graph_.prev_edge(j);
@@ -346,11 +762,11 @@ BloomAnnotator::get_annotation_corrected(DeBruijnGraphWrapper::edge_index i,
     assert(orig_kmer.front() == graph_.get_edge_label(indices[back]));
     assert(orig_kmer.back() == graph_.get_edge_label(indices[(back + 1) % indices.size()]));
     path = 0;
-    while (graph_.has_the_only_incoming_edge(indices[(back + 1) % indices.size()])
+    while (graph_.get_indegree(indices[(back + 1) % indices.size()]) == 1
             && (!check_both_directions
-                || graph_.has_the_only_outgoing_edge(indices[(back + 1) % indices.size()]))
+                || graph_.get_outdegree(indices[(back + 1) % indices.size()]) == 1)
             && path++ < path_cutoff) {
-        const_cast<size_t&>(total_traversed_)++;
+        traversed++;
 
         indices[(back + 1) % indices.size()] = graph_.prev_edge(indices[back]);
         back = (back + 1) % indices.size();
@@ -360,12 +776,9 @@ BloomAnnotator::get_annotation_corrected(DeBruijnGraphWrapper::edge_index i,
         if (graph_.is_dummy_label(cur_first))
             break;
 
-        back_hasher.reverse_update(cur_first);
+        back_hasher->reverse_update(cur_first);
 
-        auto nextannot = hash_annotate::merge_and(
-            curannot,
-            annotation.find(back_hasher.get_hash())
-        );
+        annotation->find(back_hasher->get_hash(), curannot.data(), nextannot.data());
 
         auto pcount_new = hash_annotate::popcount(nextannot);
 
@@ -375,70 +788,392 @@ BloomAnnotator::get_annotation_corrected(DeBruijnGraphWrapper::edge_index i,
             break;
 
         if (pcount_new < pcount_old) {
-            curannot = nextannot;
+            curannot.swap(nextannot);
             path = 0;
             pcount_old = pcount_new;
         }
     }
 
-	return curannot;
+    if (num_traversed)
+        *num_traversed += traversed;
+
+    return curannot;
 }
 
-void BloomAnnotator::test_fp_all(const PreciseAnnotator &annotation_exact,
-                                 size_t num,
-                                 bool check_both_directions) const {
-    double fp_per_bit = 0;
-    double fp_pre_per_bit = 0;
-    double fn_per_bit = 0;
-    uint64_t fp = 0;
-    uint64_t fp_pre = 0;
-    uint64_t fn = 0;
-    uint64_t total = 0;
-    assert(num);
-    size_t step = std::max(
-        static_cast<size_t>(1),
-        static_cast<size_t>((graph_.last_edge() - graph_.first_edge() + 1) / num)
+// For each row e, find the longest run of rows ending at e whose AND is
+// non-zero, keeping the rows of the run in a queue made of two stacks.
+// Writes the first row of the run to begin[e] (e + 1 if row e is zero)
+// and the AND of its rows to ands + e * num_words, if not NULL.
+static void longest_nonzero_runs(const uint64_t *rows, ptrdiff_t stride,
+                                 size_t num_rows, size_t num_words,
+                                 size_t *begin, uint64_t *ands) {
+    // suffix[j] is the AND of rows j..mid-1, back is the AND of rows mid..e
+    std::vector<uint64_t> suffix(num_rows * num_words);
+    std::vector<uint64_t> back(num_words, ~uint64_t(0));
+    std::vector<uint64_t> run(num_words);
+    size_t first = 0;
+    size_t mid = 0;
+    for (size_t e = 0; e < num_rows; ++e) {
+        const uint64_t *row = rows + static_cast<ptrdiff_t>(e) * stride;
+        for (size_t w = 0; w < num_words; ++w) {
+            back[w] &= row[w];
+        }
+        for (; first <= e; ++first) {
+            if (first == mid) {
+                // move the rows from the back to the front stack
+                for (size_t j = e + 1; j-- > mid; ) {
+                    const uint64_t *row_j = rows + static_cast<ptrdiff_t>(j) * stride;
+                    for (size_t w = 0; w < num_words; ++w) {
+                        suffix[j * num_words + w] = j == e
+                            ? row_j[w]
+                            : row_j[w] & suffix[(j + 1) * num_words + w];
+                    }
+                }
+                mid = e + 1;
+                back.assign(num_words, ~uint64_t(0));
+            }
+            bool nonzero = false;
+            for (size_t w = 0; w < num_words; ++w) {
+                run[w] = suffix[first * num_words + w] & back[w];
+                nonzero |= run[w] != 0;
+            }
+            if (nonzero)
+                break;
+        }
+        if (begin)
+            begin[e] = first;
+        if (ands) {
+            if (first <= e) {
+                std::copy(run.begin(), run.end(), ands + e * num_words);
+            } else {
+                std::fill(ands + e * num_words, ands + (e + 1) * num_words, 0);
+            }
+        }
+    }
+}
+
+bool BloomAnnotator::get_unitig(DeBruijnGraphWrapper::edge_index i,
+                                std::vector<DeBruijnGraphWrapper::edge_index> *unitig) const {
+    // two edges are linked if the k-mer between them has indegree and
+    // outdegree one, so the forward and backward correction pass them both
+    auto is_linked_to_prev = [&](DeBruijnGraphWrapper::edge_index j) {
+        return graph_.get_indegree(j) == 1 && graph_.get_outdegree(j) == 1;
+    };
+
+    // walk back to the first edge
+    auto first = i;
+    bool cycle = false;
+    while (is_linked_to_prev(first)) {
+        auto prev = graph_.prev_edge(first);
+        if (graph_.is_dummy_edge(graph_.get_node_kmer(prev) + graph_.get_edge_label(prev)))
+            break;
+
+        if (prev == i) {
+            cycle = true;
+            break;
+        }
+        first = prev;
+    }
+
+    unitig->assign(1, first);
+    std::vector<DeBruijnGraphWrapper::edge_index> next_edges;
+    while (true) {
+        graph_.get_outgoing_edges(unitig->back(), next_edges);
+        if (next_edges.size() != 1)
+            break;
+
+        auto next = next_edges.front();
+        if (next == first
+                || graph_.is_dummy_label(graph_.get_edge_label(next))
+                || !is_linked_to_prev(next))
+            break;
+
+        unitig->push_back(next);
+    }
+    return cycle;
+}
+
+void BloomAnnotator::get_annotations_corrected(const AnnotationCallback &callback,
+                                               size_t num_threads) const {
+    const size_t num_edges = graph_.last_edge() + 1 - graph_.first_edge();
+    const size_t words = num_words();
+
+    // set once the unitig of an edge has been claimed by a thread
+    std::vector<uint64_t> visited((num_edges + 63) / 64, 0);
+    auto visit = [&](DeBruijnGraphWrapper::edge_index j) {
+        j -= graph_.first_edge();
+        uint64_t bit = uint64_t(1) << (j % 64);
+        return !(__atomic_fetch_or(&visited[j / 64], bit, __ATOMIC_RELAXED) & bit);
+    };
+    auto is_visited = [&](DeBruijnGraphWrapper::edge_index j) {
+        j -= graph_.first_edge();
+        return (__atomic_load_n(&visited[j / 64], __ATOMIC_RELAXED) >> (j % 64)) & 1;
+    };
+
+    auto decode_range = [&](DeBruijnGraphWrapper::edge_index begin,
+                            DeBruijnGraphWrapper::edge_index end) {
+        std::vector<uint64_t> zero(words, 0);
+        std::vector<DeBruijnGraphWrapper::edge_index> unitig;
+        std::vector<uint64_t> rows, ands;
+        std::vector<size_t> run_begin;
+
+        for (auto i = begin; i < end; ++i) {
+            if (is_visited(i))
+                continue;
+
+            // dummy edges are never linked to other edges
+            if (graph_.is_dummy_edge(kmer_from_index(i))) {
+                if (visit(i))
+                    callback(i, zero.data());
+                continue;
+            }
+
+            bool cycle = get_unitig(i, &unitig);
+
+            // start from the edge with the smallest index in its own
+            // orientation, so that every thread gets the same unitig
+            auto rep = graph_.get_edge_id(unitig.front());
+            for (auto j : unitig) {
+                rep = std::min(rep, graph_.get_edge_id(j));
+            }
+            if (std::find(unitig.begin(), unitig.end(), rep) == unitig.end())
+                cycle = get_unitig(rep, &unitig);
+
+            if (cycle) {
+                std::rotate(unitig.begin(),
+                            std::find(unitig.begin(), unitig.end(), rep),
+                            unitig.end());
+            }
+
+            if (!visit(rep))
+                continue;
+
+            // hash the k-mers of the unitig in one pass
+            const size_t n = unitig.size();
+            rows.assign(n * words, 0);
+            auto hasher = make_hasher(graph_.get_node_kmer(unitig.front())
+                                        + graph_.get_edge_label(unitig.front()));
+            for (size_t t = 0; t < n; ++t) {
+                if (t)
+                    hasher->update(graph_.get_edge_label(unitig[t]));
+                annotation->find(hasher->get_hash(), &rows[t * words]);
+            }
+
+            // the forward correction of edge t ends at the last edge of
+            // the longest non-zero run starting at t, and the backward
+            // correction then extends it to the longest run ending there
+            ands.resize(n * words);
+            longest_nonzero_runs(rows.data(), words, n, words, NULL, ands.data());
+            run_begin.resize(n);
+            longest_nonzero_runs(rows.data() + (n - 1) * words,
+                                 -static_cast<ptrdiff_t>(words),
+                                 n, words, run_begin.data(), NULL);
+
+            auto report = [&](size_t t) {
+                size_t last = n - 1 - run_begin[n - 1 - t];
+                callback(graph_.get_edge_id(unitig[t]),
+                         last < t ? zero.data() : &ands[last * words]);
+            };
+
+            // unitigs of canonical graphs may pass an edge in both
+            // orientations, in which case the forward one is reported
+            for (size_t t = 0; t < n; ++t) {
+                auto id = graph_.get_edge_id(unitig[t]);
+                if (unitig[t] == id && (id == rep || visit(id)))
+                    report(t);
+            }
+            for (size_t t = 0; t < n; ++t) {
+                auto id = graph_.get_edge_id(unitig[t]);
+                if (unitig[t] != id && visit(id))
+                    report(t);
+            }
+        }
+    };
+
+    if (num_threads <= 1) {
+        decode_range(graph_.first_edge(), graph_.last_edge() + 1);
+        return;
+    }
+
+    const size_t block_size = std::max(num_edges / (num_threads * 16), size_t(1));
+    utils::ThreadPool thread_pool(num_threads);
+    for (auto begin = graph_.first_edge(); begin <= graph_.last_edge(); begin += block_size) {
+        auto end = std::min(begin + block_size, graph_.last_edge() + 1);
+        thread_pool.enqueue([&, begin, end]() { decode_range(begin, end); });
+    }
+    thread_pool.join();
+}
+
+uint64_t BloomAnnotator::export_rows(std::ostream &out, size_t num_threads) const {
+    const size_t num_edges = graph_.last_edge() + 1 - graph_.first_edge();
+    std::vector<uint64_t> rows(num_edges * num_words());
+    get_annotations_corrected(
+        [&](DeBruijnGraphWrapper::edge_index i, const uint64_t *row) {
+            std::copy(row, row + num_words(),
+                      &rows[(i - graph_.first_edge()) * num_words()]);
+        },
+        num_threads
     );
-    for (auto i = graph_.first_edge(); i <= graph_.last_edge(); i += step) {
-        if (graph_.is_dummy_edge(kmer_from_index(i)))
-            continue;
-        total++;
-        auto stats = test_fp(i, annotation_exact, check_both_directions);
-        fp_pre_per_bit += (double)stats[0];
-        fp_per_bit     += (double)stats[1];
-        fn_per_bit     += (double)stats[2];
-        fp_pre         += stats[0] > 0;
-        fp             += stats[1] > 0;
-        fn             += stats[2] > 0;
-        //if (stats[2] > 0)
-        //    step -= step - 1;
+
+    uint64_t written_bytes = serialization::serializeNumber(out, num_edges);
+    for (size_t i = 0; i < num_edges; ++i) {
+        written_bytes += serialization::serializeNumberVector(out,
+            std::vector<uint64_t>(&rows[i * num_words()], &rows[(i + 1) * num_words()])
+        );
     }
+    return written_bytes;
+}
+
+uint64_t BloomAnnotator::export_rows(const std::string &filename, size_t num_threads) const {
+    std::ofstream fout(filename);
+    return export_rows(fout, num_threads);
+}
+
+void BloomAnnotator::FPStats::merge(const FPStats &other) {
+    num_edges += other.num_edges;
+    fp_edges += other.fp_edges;
+    fp_pre_edges += other.fp_pre_edges;
+    fn_edges += other.fn_edges;
+    fp_bits += other.fp_bits;
+    fp_pre_bits += other.fp_pre_bits;
+    fn_bits += other.fn_bits;
+    num_traversed += other.num_traversed;
+
+    auto add = [](std::vector<uint64_t> &a, const std::vector<uint64_t> &b) {
+        if (a.size() < b.size())
+            a.resize(b.size(), 0);
+        for (size_t i = 0; i < b.size(); ++i) {
+            a[i] += b[i];
+        }
+    };
+    add(column_positives, other.column_positives);
+    add(column_fp, other.column_fp);
+    add(column_fp_pre, other.column_fp_pre);
+    add(column_fn, other.column_fn);
+    add(path_lengths, other.path_lengths);
+
+    messages += other.messages;
+    errors += other.errors;
+}
+
+BloomAnnotator::FPStats
+BloomAnnotator::evaluate_fp(const PreciseAnnotator &annotation_exact,
+                            size_t num,
+                            bool check_both_directions,
+                            size_t num_threads) const {
+    const size_t num_edges = graph_.last_edge() - graph_.first_edge() + 1;
+    const size_t step = num ? std::max(num_edges / num, size_t(1)) : 1;
+    const size_t num_samples = (num_edges + step - 1) / step;
+
+    // each block of edges gets its own counters, which are merged at the end
+    const size_t num_blocks = std::min(num_threads > 1 ? num_threads * 4 : 1,
+                                       std::max(num_samples, size_t(1)));
+    std::vector<FPStats> block_stats(num_blocks);
+    utils::ThreadPool thread_pool(num_threads > 1 ? num_threads : 0);
+    for (size_t b = 0; b < num_blocks; ++b) {
+        thread_pool.enqueue([&, b]() {
+            FPStats &stats = block_stats[b];
+            stats.column_positives.assign(num_columns(), 0);
+            stats.column_fp.assign(num_columns(), 0);
+            stats.column_fp_pre.assign(num_columns(), 0);
+            stats.column_fn.assign(num_columns(), 0);
+
+            for (size_t j = num_samples * b / num_blocks;
+                        j < num_samples * (b + 1) / num_blocks; ++j) {
+                auto i = graph_.first_edge() + j * step;
+                if (!graph_.is_dummy_edge(kmer_from_index(i)))
+                    test_fp(i, annotation_exact, check_both_directions, &stats);
+            }
+        });
+    }
+    thread_pool.join();
+
+    FPStats stats;
+    for (const auto &other : block_stats) {
+        stats.merge(other);
+    }
+    std::cout << stats.messages << std::flush;
+    std::cerr << stats.errors << std::flush;
+    return stats;
+}
+
+void BloomAnnotator::test_fp_all(const PreciseAnnotator &annotation_exact,
+                                 size_t num,
+                                 bool check_both_directions,
+                                 size_t num_threads) const {
+    auto stats = evaluate_fp(annotation_exact, num, check_both_directions, num_threads);
+    const double total = stats.num_edges;
+
     std::cout << "\n";
-    std::cout << "Total:\t" << total << "\n";
+    std::cout << "Total:\t" << stats.num_edges << "\n";
     std::cout << "Post:\t"
-              << "FP(edges):\t" << fp << "\t"
-              << "FP(per edge):\t" << (double)fp / (double)total << "\t"
-              << "FN(edges):\t" << fn
+              << "FP(edges):\t" << stats.fp_edges << "\t"
+              << "FP(per edge):\t" << (double)stats.fp_edges / total << "\t"
+              << "FN(edges):\t" << stats.fn_edges
               << "\n";
     std::cout << "Pre:\t"
-              << "FP(edges):\t" << fp_pre << "\t"
-              << "FP(per edge):\t" << (double)fp_pre / (double)total << "\t"
+              << "FP(edges):\t" << stats.fp_pre_edges << "\t"
+              << "FP(per edge):\t" << (double)stats.fp_pre_edges / total << "\t"
               << "\n";
     std::cout << "Per bit" << "\n";
     std::cout << "Post:\t"
-              << "FP(bits/edge):\t" << (double)fp_per_bit / (double)total << "\t"
-              << "Avg. FPP:\t" << (double)fp_per_bit / (double)total / (double)annotation.size() << "\t"
-              << "FN(bits):\t" << (double)fn_per_bit
+              << "FP(bits/edge):\t" << (double)stats.fp_bits / total << "\t"
+              << "Avg. FPP:\t" << (double)stats.fp_bits / total / (double)annotation->size() << "\t"
+              << "FN(bits):\t" << (double)stats.fn_bits
               << "\n";
     std::cout << "Pre:\t"
-              << "FP(bits/edge):\t" << (double)fp_pre_per_bit / (double)total << "\t"
-              << "Avg. FPP:\t" << (double)fp_pre_per_bit / (double)total / (double)annotation.size() << "\t"
+              << "FP(bits/edge):\t" << (double)stats.fp_pre_bits / total << "\t"
+              << "Avg. FPP:\t" << (double)stats.fp_pre_bits / total / (double)annotation->size() << "\t"
               << "\n";
-    std::cout << "Total traversed: " << total_traversed_ << "\n";
+    std::cout << "Total traversed: " << stats.num_traversed << "\n";
+
+    std::cout << "Per column" << "\n";
+    std::cout << "Column\tPositives\tFP(pre)\tFPP(pre)\tFP(post)\tFPP(post)\tFN" << "\n";
+    for (size_t c = 0; c < stats.column_positives.size(); ++c) {
+        // a column set on all evaluated edges has no false positives
+        const uint64_t negatives = stats.num_edges - stats.column_positives[c];
+        auto fpp = [&](uint64_t fp) { return negatives ? (double)fp / negatives : 0.; };
+        std::cout << c << "\t"
+                  << stats.column_positives[c] << "\t"
+                  << stats.column_fp_pre[c] << "\t"
+                  << fpp(stats.column_fp_pre[c]) << "\t"
+                  << stats.column_fp[c] << "\t"
+                  << fpp(stats.column_fp[c]) << "\t"
+                  << stats.column_fn[c]
+                  << "\n";
+    }
+
+    std::cout << "Correction path lengths" << "\n";
+    std::cout << "Traversed\tEdges" << "\n";
+    for (size_t i = 0; i < stats.path_lengths.size(); ++i) {
+        if (!stats.path_lengths[i])
+            continue;
+
+        if (i < 2) {
+            std::cout << i;
+        } else {
+            std::cout << (1llu << (i - 1)) << "-" << (1llu << i) - 1;
+        }
+        std::cout << "\t" << stats.path_lengths[i] << "\n";
+    }
 }
 
 uint64_t BloomAnnotator::serialize(std::ostream &out) const {
-    return annotation.serialize(out);
+    uint64_t written_bytes = 0;
+    if (hashing_ != CYCLIC) {
+        const uint64_t tag = hashing_ == DOUBLE ? DoubleMultiHash::kFormatTag
+                                                : CanonicalMultiHash::kFormatTag;
+        out.write(reinterpret_cast<const char*>(&tag), sizeof(tag));
+        written_bytes += sizeof(tag);
+    }
+    if (layout_ != STANDARD) {
+        const uint64_t tag = layout_ == BLOCKED ? BlockedBloomFilter::kFormatTag
+                           : (layout_ == BIT_SLICED ? BitSlicedAnnotation::kFormatTag
+                                                    : RibbonFilter::kFormatTag);
+        out.write(reinterpret_cast<const char*>(&tag), sizeof(tag));
+        written_bytes += sizeof(tag);
+    }
+    return written_bytes + annotation->serialize(out);
 }
 
 uint64_t BloomAnnotator::serialize(const std::string &filename) const {
@@ -448,7 +1183,29 @@ uint64_t BloomAnnotator::serialize(const std::string &filename) const {
 
 bool BloomAnnotator::load(std::istream &in) {
     try {
-        annotation.load(in);
+        // the annotations with the standard layout and the cyclic
+        // hashing have no format tags
+        auto begin = in.tellg();
+        uint64_t tag = 0;
+        in.read(reinterpret_cast<char*>(&tag), sizeof(tag));
+        hashing_ = CYCLIC;
+        if (tag == DoubleMultiHash::kFormatTag || tag == CanonicalMultiHash::kFormatTag) {
+            hashing_ = tag == DoubleMultiHash::kFormatTag ? DOUBLE : CANONICAL;
+            begin = in.tellg();
+            in.read(reinterpret_cast<char*>(&tag), sizeof(tag));
+        }
+        if (tag == BlockedBloomFilter::kFormatTag) {
+            layout_ = BLOCKED;
+        } else if (tag == BitSlicedAnnotation::kFormatTag) {
+            layout_ = BIT_SLICED;
+        } else if (tag == RibbonFilter::kFormatTag) {
+            layout_ = FROZEN;
+        } else {
+            layout_ = STANDARD;
+            in.seekg(begin);
+        }
+        annotation = make_annotation(layout_, annotation->num_hash_functions());
+        annotation->load(in);
     } catch (...) {
         return false;
     }
@@ -473,6 +1230,43 @@ BloomAnnotator::unpack(const std::vector<uint64_t> &packed) {
     return labels;
 }
 
+std::unique_ptr<RollingMultiHash>
+BloomAnnotator::make_hasher(const std::string &kmer) const {
+    if (hashing_ == DOUBLE)
+        return std::unique_ptr<RollingMultiHash>(
+            new DoubleMultiHash(kmer, annotation->num_hash_functions())
+        );
+
+    if (hashing_ == CANONICAL)
+        return std::unique_ptr<RollingMultiHash>(
+            new CanonicalMultiHash(kmer, annotation->num_hash_functions())
+        );
+
+    return std::unique_ptr<RollingMultiHash>(
+        new CyclicMultiHash(kmer, annotation->num_hash_functions())
+    );
+}
+
+std::unique_ptr<HashIterator>
+BloomAnnotator::make_hash_iterator(const std::string &sequence, size_t num_hash) const {
+    if (!num_hash)
+        num_hash = annotation->num_hash_functions();
+
+    if (hashing_ == DOUBLE)
+        return std::unique_ptr<HashIterator>(new DoubleHashIterator(
+            sequence, graph_.get_k() + 1, num_hash
+        ));
+
+    if (hashing_ == CANONICAL)
+        return std::unique_ptr<HashIterator>(new CanonicalHashIterator(
+            sequence, graph_.get_k() + 1, num_hash
+        ));
+
+    return std::unique_ptr<HashIterator>(new CyclicHashIterator(
+        sequence, graph_.get_k() + 1, num_hash
+    ));
+}
+
 std::string
 BloomAnnotator::kmer_from_index(DeBruijnGraphWrapper::edge_index index) const {
     assert(index <= graph_.last_edge());
@@ -492,18 +1286,16 @@ PreciseHashAnnotator::annotate_edge(DeBruijnGraphWrapper::edge_index i, bool per
 
 std::set<pos_t>
 PreciseHashAnnotator::annotate_edge_indices(DeBruijnGraphWrapper::edge_index i, bool permute) const {
-    auto find = annotation_exact.kmer_map_.find(get_kmer(i));
-    if (find == annotation_exact.kmer_map_.end())
-        return {};
+    const auto &indices = annotation_exact.find_indices(canonical_kmer(get_kmer(i)));
     if (!permute)
-        return find->second;
+        return std::set<pos_t>(indices.begin(), indices.end());
     auto index_map = compute_permutation_map();
     if (index_map.empty())
-        return find->second;
+        return std::set<pos_t>(indices.begin(), indices.end());
     std::vector<pos_t> find_mapped_v;
-    find_mapped_v.reserve(find->second.size());
-    std::transform(find->second.begin(),
-                   find->second.end(),
+    find_mapped_v.reserve(indices.size());
+    std::transform(indices.begin(),
+                   indices.end(),
                    std::back_inserter(find_mapped_v),
                    [&](pos_t i) {
                        return index_map[i];
@@ -521,87 +1313,109 @@ PreciseHashAnnotator::annotate_edge_indices(DeBruijnGraphWrapper::edge_index i,
     */
 }
 
-std::vector<uint64_t>
-BloomAnnotator::test_fp(DeBruijnGraphWrapper::edge_index i,
-                        const PreciseAnnotator &annotation_exact,
-                        bool check_both_directions) const {
+void BloomAnnotator::test_fp(DeBruijnGraphWrapper::edge_index i,
+                             const PreciseAnnotator &annotation_exact,
+                             bool check_both_directions,
+                             FPStats *stats) const {
 
     auto int_kmer = kmer_from_index(i);
 
     auto test = annotation_from_kmer(int_kmer);
 
     auto test_exact = annotation_exact.annotate_edge(i);
+    test_exact.resize(test.size(), 0);
 
-    auto curannot = get_annotation_corrected(i, check_both_directions);
+    size_t num_traversed = 0;
+    auto curannot = get_annotation_corrected(i, check_both_directions, 50, &num_traversed);
+
+    // the diagnostics are printed by evaluate_fp after all threads finish
+    auto append_labels = [&](const char *name, const std::vector<uint64_t> &annotation) {
+        stats->messages += name;
+        for (size_t value : unpack(annotation)) {
+            stats->messages += std::to_string(value) + " ";
+        }
+        stats->messages += "\n";
+    };
 
     auto jt = test.begin();
     auto kt = test_exact.begin();
     auto lt = curannot.begin();
 
-    std::vector<uint64_t> stats(3, 0);
+    // false positives before and after correction, false negatives after it
+    uint64_t num_bits[3] = { 0, 0, 0 };
+
+    // add the set bits of |bits| in the word |w| to the column counters
+    auto count_columns = [&](uint64_t bits, size_t w, std::vector<uint64_t> &counts) {
+        for (; bits; bits &= bits - 1) {
+            size_t column = w * 64 + __builtin_ctzll(bits);
+            if (column < counts.size())
+                counts[column]++;
+        }
+    };
+
+    for (size_t w = 0; jt != test.end(); ++jt, ++kt, ++lt, ++w) {
+        count_columns(*kt, w, stats->column_positives);
+        count_columns(*jt & ~*kt, w, stats->column_fp_pre);
+        count_columns(*lt & ~*kt, w, stats->column_fp);
+        count_columns(*kt & ~*lt, w, stats->column_fn);
 
-    for (; jt != test.end(); ++jt, ++kt, ++lt) {
         //check for false negatives
         if ((*jt | *kt) != *jt) {
-            std::cerr << "Encoding " << i << " failed" << std::endl;
-            std::cout << "FN: " << int_kmer << std::endl;
-            auto unpacked_labels = unpack(test_exact);
-            std::cout << "True annotation:\t";
-            for (size_t value : unpacked_labels) {
-                std::cout << value << " ";
-            }
-            std::cout << std::endl;
-            unpacked_labels = unpack(test);
-            std::cout << "Uncorrected annotation:\t";
-            for (size_t value : unpacked_labels) {
-                std::cout << value << " ";
-            }
-            std::cout << std::endl;
+            stats->errors += "Encoding " + std::to_string(i) + " failed\n";
+            stats->messages += "FN: " + int_kmer + "\n";
+            append_labels("True annotation:\t", test_exact);
+            append_labels("Uncorrected annotation:\t", test);
 
             //exit(1);
         }
         //correction introduced extra bits
         if ((*lt | *jt) != *jt) {
-            std::cerr << "False bits added" << std::endl;
+            stats->errors += "False bits added\n";
             //exit(1);
         }
         //false positives before correction
         if ((*jt | *kt) != *kt) {
             //stats[0] += __builtin_popcountll(*jt) - __builtin_popcountll(*kt);
-            stats[0] += static_cast<uint64_t>(__builtin_popcountll(*jt & (~(*kt))));
+            num_bits[0] += static_cast<uint64_t>(__builtin_popcountll(*jt & (~(*kt))));
         }
         //false positives after correction
         if ((*lt | *kt) != *kt) {
             //stats[1] += __builtin_popcountll(*lt) - __builtin_popcountll(*kt);
-            stats[1] += static_cast<uint64_t>(__builtin_popcountll(*lt & (~(*kt))));
+            num_bits[1] += static_cast<uint64_t>(__builtin_popcountll(*lt & (~(*kt))));
             if (verbose_)
-                std::cout << "FP: " << int_kmer << std::endl;
+                stats->messages += "FP: " + int_kmer + "\n";
         }
         //false negatives after correction
         if ((*lt | *kt) != *lt) {
             //stats[2] += __builtin_popcountll(*lt | *kt) - __builtin_popcountll(*lt);
-            stats[2] += static_cast<uint64_t>(__builtin_popcountll(*kt & (~(*lt))));
+            num_bits[2] += static_cast<uint64_t>(__builtin_popcountll(*kt & (~(*lt))));
             if (verbose_) {
-                std::cout << "FN: " << int_kmer << std::endl;
-                auto unpacked_labels = unpack(test_exact);
-                std::cout << "True annotation:\t";
-                for (size_t value : unpacked_labels) {
-                    std::cout << value << " ";
-                }
-                std::cout << std::endl;
-                unpacked_labels = unpack(curannot);
-                std::cout << "Corrected annotation:\t";
-                for (size_t value : unpacked_labels) {
-                    std::cout << value << " ";
-                }
-                std::cout << std::endl;
+                stats->messages += "FN: " + int_kmer + "\n";
+                append_labels("True annotation:\t", test_exact);
+                append_labels("Corrected annotation:\t", curannot);
             }
         }
         //if (stats[0] && stats[1] && stats[2]) {
         //    break;
         //}
     }
-    return stats;
+
+    stats->num_edges++;
+    stats->fp_pre_bits += num_bits[0];
+    stats->fp_bits += num_bits[1];
+    stats->fn_bits += num_bits[2];
+    stats->fp_pre_edges += num_bits[0] > 0;
+    stats->fp_edges += num_bits[1] > 0;
+    stats->fn_edges += num_bits[2] > 0;
+    stats->num_traversed += num_traversed;
+
+    size_t bucket = 0;
+    while (num_traversed >> bucket) {
+        bucket++;
+    }
+    if (bucket >= stats->path_lengths.size())
+        stats->path_lengths.resize(bucket + 1, 0);
+    stats->path_lengths[bucket]++;
 }
 
 } // namespace hash_annotate
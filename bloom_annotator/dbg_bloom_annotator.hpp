@@ -4,6 +4,8 @@
 #include "hashers.hpp"
 
 #include <map>
+#include <memory>
+#include <functional>
 #include <unordered_map>
 
 
@@ -13,6 +15,8 @@ class DeBruijnGraphWrapper {
   public:
     typedef uint64_t edge_index;
 
+    static constexpr edge_index npos = static_cast<edge_index>(-1);
+
     virtual ~DeBruijnGraphWrapper() {}
 
     virtual size_t get_k() const = 0;
@@ -21,8 +25,26 @@ class DeBruijnGraphWrapper {
     virtual edge_index last_edge() const = 0;
     virtual edge_index map_kmer(const std::string &kmer) const = 0;
 
+    // Map all consecutive (k+1)-mers of the sequence to edges, writing
+    // sequence.size() - k indices to |indices|. Characters are encoded as
+    // in encode_sequence, and the missing k-mers are mapped to npos.
+    virtual void map_kmers(const std::string &sequence, edge_index *indices) const {
+        std::string encoded = encode_sequence(sequence);
+        for (size_t i = 0; i + get_k() < encoded.size(); ++i) {
+            indices[i] = map_kmer(encoded.substr(i, get_k() + 1));
+        }
+    }
+
     virtual size_t get_num_edges() const = 0;
 
+    // Graphs of canonical k-mers treat each k-mer and its reverse
+    // complement as the same edge, so they are annotated together
+    virtual bool is_canonical() const { return false; }
+
+    // The index from first_edge() to last_edge() of an edge returned by
+    // the traversal, which may also encode its orientation
+    virtual edge_index get_edge_id(edge_index i) const { return i; }
+
     // Transform sequence to the same kind as the de bruijn graph stores
     virtual std::string encode_sequence(const std::string &sequence) const {
         return sequence;
@@ -46,6 +68,19 @@ class DeBruijnGraphWrapper {
     virtual edge_index next_edge(edge_index i, char edge_label) const = 0;
     virtual edge_index prev_edge(edge_index i) const = 0;
 
+    // Number of edges outgoing from/incoming to the source k-mer of this edge
+    virtual size_t get_outdegree(edge_index i) const = 0;
+    virtual size_t get_indegree(edge_index i) const = 0;
+
+    // Get all edges outgoing from the target k-mer of this edge (the ones
+    // next_edge chooses from), in the order next_edge checks them.
+    // |edges| is cleared first, so the same vector can be reused.
+    virtual void get_outgoing_edges(edge_index i,
+                                    std::vector<edge_index> &edges) const = 0;
+    // Get all edges incoming to the source k-mer of this edge
+    virtual void get_incoming_edges(edge_index i,
+                                    std::vector<edge_index> &edges) const = 0;
+
 };
 
 class PreciseAnnotator {
@@ -56,8 +91,18 @@ class PreciseAnnotator {
 };
 
 
+/**
+ * The serialized annotation keeps the rows in the order of the edges of
+ * the graph, with the columns of each row delta and varint coded. The rows
+ * are split into blocks of kBlockRows, which are found through an offset
+ * table and can be decoded independently. The annotations serialized with
+ * the k-mers of the rows, without the format tag, can still be loaded.
+ */
 class PreciseHashAnnotator : public PreciseAnnotator {
   public:
+    static constexpr uint64_t kFormatTag = 0x3145534943455250llu;
+    static constexpr size_t kBlockRows = 1 << 16;
+
     PreciseHashAnnotator(const DeBruijnGraphWrapper &graph) : graph_(graph) {}
 
     void add_sequence(const std::string &sequence,
@@ -80,8 +125,18 @@ class PreciseHashAnnotator : public PreciseAnnotator {
     uint64_t serialize(std::ostream &out) const;
     uint64_t serialize(const std::string &filename) const;
 
-    void load(std::istream &in);
-    void load(const std::string &filename);
+    // The blocks are decoded on |num_threads| threads
+    void load(std::istream &in, size_t num_threads = 1);
+    void load(const std::string &filename, size_t num_threads = 1);
+
+    // Load the rows of a serialized annotation in the order of the edges.
+    // Returns false and leaves the stream where it was if the annotation
+    // has the format with the k-mers of the rows.
+    static bool load_rows(std::istream &in,
+                          std::set<pos_t> *prefix_indices,
+                          size_t *num_columns,
+                          std::vector<std::vector<pos_t>> *rows,
+                          size_t num_threads = 1);
 
     void clear_prefix() { prefix_indices_.clear(); }
 
@@ -101,6 +156,9 @@ class PreciseHashAnnotator : public PreciseAnnotator {
 
     size_t num_prefix_columns() const { return prefix_indices_.size(); }
 
+    // The number of distinct label sets of the k-mers
+    size_t num_label_sets() const { return annotation_exact.num_classes(); }
+
     size_t size() const { return annotation_exact.get_num_edges(); }
 
     std::unordered_map<size_t, size_t> compute_permutation_map() const;
@@ -123,38 +181,209 @@ class PreciseHashAnnotator : public PreciseAnnotator {
     const DeBruijnGraphWrapper &graph_;
 
   private:
+    // The smaller of the k-mer and its reverse complement if the graph
+    // is canonical, the k-mer itself otherwise
+    std::string canonical_kmer(const std::string &kmer) const;
+
     ExactHashAnnotation annotation_exact;
     std::set<pos_t> prefix_indices_;
 };
 
+// Write the serialized PreciseHashAnnotator format one row at a time,
+// keeping only the current block in memory. The stream must be seekable,
+// since the offset table is filled in by finish().
+class PreciseRowWriter {
+  public:
+    PreciseRowWriter(std::ostream &out,
+                     const std::set<pos_t> &prefix_indices,
+                     size_t num_columns,
+                     size_t num_rows);
+
+    // Append the sorted |columns| of the next row
+    void write_row(const std::vector<pos_t> &columns);
+
+    // Returns the number of bytes written, once all rows are written
+    uint64_t finish();
+
+  private:
+    void flush_block();
+
+    std::ostream &out_;
+    const size_t num_rows_;
+    size_t row_ = 0;
+    std::string block_;
+    std::vector<uint64_t> offsets_;
+    std::streampos offsets_pos_;
+    uint64_t data_size_ = 0;
+    uint64_t written_bytes_ = 0;
+};
+
 class BloomAnnotator {
   public:
+    // Layout of the Bloom filters. The blocked filters keep all bits of
+    // a k-mer in one cache line, at the cost of a slightly higher FPP.
+    // The bit-sliced layout shares one filter between all columns and
+    // fetches the bits of all columns of a k-mer at once. The frozen
+    // layout keeps static ribbon filters made by freeze().
+    enum Layout {
+        STANDARD,
+        BLOCKED,
+        BIT_SLICED,
+        FROZEN
+    };
+
+    // Hash functions of the k-mers. The double hashing derives all hash
+    // values from one rolling hash, the cyclic one rolls each separately
+    // and is kept for reading older annotations. The canonical hashing
+    // gives the same values to the reverse complements, and is always
+    // used with graphs of canonical k-mers.
+    enum Hashing {
+        CYCLIC,
+        DOUBLE,
+        CANONICAL
+    };
+
     // Computes optimal `bloom_size_factor` and `num_hash_functions` automatically
     BloomAnnotator(const DeBruijnGraphWrapper &graph,
                    double bloom_fpp,
-                   bool verbose = false);
+                   bool verbose = false,
+                   Layout layout = STANDARD,
+                   Hashing hashing = DOUBLE);
 
     // If not provided, computes optimal `num_hash_functions` automatically
     BloomAnnotator(const DeBruijnGraphWrapper &graph,
                    double bloom_size_factor,
                    size_t num_hash_functions,
-                   bool verbose = false);
+                   bool verbose = false,
+                   Layout layout = STANDARD,
+                   Hashing hashing = DOUBLE);
+
+    // Size the shared filter of the bit-sliced layout for |num_elements|
+    // k-mers per column. Has no effect after the first insertion or with
+    // the other layouts, which size the filters per column.
+    void reserve(size_t num_elements);
+
+    // Size the filter of the column for |num_elements| k-mers, if it has
+    // not been sized yet. Bit-sliced annotations are sized for the largest
+    // of their columns.
+    void reserve_column(size_t column, size_t num_elements);
+
+    // Add the k-mers of the sequence to the distinct k-mer count estimate,
+    // which can then be passed to reserve_column()
+    void count_kmers(const std::string &sequence, HyperLogLog *counter) const;
 
     void add_sequence(const std::string &sequence, size_t column, size_t num_elements = 0);
 
+    // Add a batch of sequences using |num_threads| threads, the i-th one
+    // to the columns |columns[i]|, with |num_elements[i]| passed on as in
+    // add_sequence if given. The filters are the same as when adding the
+    // sequences one by one in order.
+    void add_sequences(const std::vector<std::string> &sequences,
+                       const std::vector<std::vector<size_t>> &columns,
+                       size_t num_threads,
+                       const std::vector<size_t> &num_elements = {});
+
     void add_column(const std::string &sequence, size_t num_elements = 0);
 
+    // Replace the filters with static ribbon filters built from the edges
+    // of each column in the exact annotation. The k-mers not in a column
+    // pass its filter with the probability 2^-|fingerprint_bits|, which is
+    // by default the largest power of two not above the Bloom filter FPP.
+    // No sequences can be added afterwards.
+    void freeze(const PreciseAnnotator &annotation_exact,
+                size_t fingerprint_bits = 0,
+                size_t num_threads = 1);
+
     std::vector<uint64_t> get_annotation(DeBruijnGraphWrapper::edge_index i) const;
 
+    // Safe to call concurrently. Adds the number of edges traversed
+    // for the correction to |num_traversed| if it is passed.
     std::vector<uint64_t> get_annotation_corrected(DeBruijnGraphWrapper::edge_index i,
                                                    bool check_both_directions = false,
-                                                   size_t path_cutoff = 50) const;
+                                                   size_t path_cutoff = 50,
+                                                   size_t *num_traversed = NULL) const;
 
     std::vector<uint64_t> annotation_from_kmer(const std::string &kmer) const;
 
+    typedef std::function<void(DeBruijnGraphWrapper::edge_index,
+                               const uint64_t *)> AnnotationCallback;
+
+    // Compute the corrected annotations of all edges, as
+    // get_annotation_corrected() does when checking both directions with
+    // no limit on the path length, but hashing each unitig once. The
+    // annotations of a unitig are then computed in two linear sweeps.
+    // Unitigs forming cycles are cut at their first edge. The callback
+    // gets each edge and its num_words() words, and is called
+    // concurrently from |num_threads| threads.
+    void get_annotations_corrected(const AnnotationCallback &callback,
+                                   size_t num_threads = 1) const;
+
+    // Write the corrected annotations of all edges in the format of
+    // PreciseHashAnnotator::export_rows
+    uint64_t export_rows(std::ostream &out, size_t num_threads = 1) const;
+    uint64_t export_rows(const std::string &filename, size_t num_threads = 1) const;
+
+    // Annotate all k-mers of the sequence, rolling the hash from one k-mer
+    // to the next. Writes num_words() words per k-mer to |annotations|,
+    // the k-mers missing in the graph get empty annotations. Returns the
+    // number of k-mers found in the graph. The annotations are the raw
+    // filter lookups, without the correction of get_annotation_corrected,
+    // so they are supersets of the exact ones.
+    size_t annotate_sequence(const std::string &sequence, uint64_t *annotations) const;
+
+    // Count the k-mers of the sequence annotated with each column, adding
+    // them to the num_columns() values at |counts|. A column is in the
+    // union of the k-mer annotations if its count is non-zero, and in
+    // their intersection if it is equal to the returned number of k-mers
+    // found in the graph. As the k-mers are annotated by annotate_sequence,
+    // the counts are upper bounds including the false positives.
+    size_t count_labels(const std::string &sequence, uint64_t *counts) const;
+
+    // Counters of the false positive evaluation. The negatives of a
+    // column are the evaluated edges minus its positives, the edges
+    // having it in the exact annotation.
+    struct FPStats {
+        uint64_t num_edges = 0;
+        uint64_t fp_edges = 0;
+        uint64_t fp_pre_edges = 0;
+        uint64_t fn_edges = 0;
+        uint64_t fp_bits = 0;
+        uint64_t fp_pre_bits = 0;
+        uint64_t fn_bits = 0;
+        uint64_t num_traversed = 0;
+
+        std::vector<uint64_t> column_positives;
+        std::vector<uint64_t> column_fp;
+        std::vector<uint64_t> column_fp_pre;
+        std::vector<uint64_t> column_fn;
+
+        // The i-th bucket counts the corrections traversing from 2^(i-1)
+        // to 2^i - 1 edges, the first one those traversing none
+        std::vector<uint64_t> path_lengths;
+
+        // The diagnostics of the tested edges, for stdout and stderr, in
+        // the order of the edges
+        std::string messages;
+        std::string errors;
+
+        void merge(const FPStats &other);
+    };
+
+    // Compare the corrected annotations of about |num| evenly spaced
+    // edges, or of all edges if |num| is 0, to the exact annotation.
+    // The edges are split between |num_threads| threads, and their
+    // diagnostics are printed once all of them are tested.
+    FPStats evaluate_fp(const PreciseAnnotator &annotation_exact,
+                        size_t num = 0,
+                        bool check_both_directions = false,
+                        size_t num_threads = 1) const;
+
+    // Print the statistics of evaluate_fp, with the false positive
+    // rates of the columns and the path lengths of the corrections
     void test_fp_all(const PreciseAnnotator &annotation_exact,
                      size_t num = 0,
-                     bool check_both_directions = false) const;
+                     bool check_both_directions = false,
+                     size_t num_threads = 1) const;
 
     uint64_t serialize(std::ostream &out) const;
     uint64_t serialize(const std::string &filename) const;
@@ -172,24 +401,46 @@ class BloomAnnotator {
 
     size_t get_size(size_t i) const;
 
-    size_t num_columns() const { return annotation.size(); }
+    size_t num_columns() const { return annotation->size(); }
+
+    size_t num_words() const { return annotation->num_words(); }
+
+    Layout layout() const { return layout_; }
+
+    Hashing hashing() const { return hashing_; }
 
   private:
     std::string kmer_from_index(DeBruijnGraphWrapper::edge_index index) const;
 
-    std::vector<uint64_t> test_fp(DeBruijnGraphWrapper::edge_index i,
-                                const PreciseAnnotator &annotation_exact,
-                                bool check_both_directions = false) const;
+    // Add the column if needed and size its filter on the first insertion
+    void init_column(size_t column, size_t num_elements);
+
+    // Get the edges of the unitig passing through a non-dummy edge in
+    // order. Returns true if the unitig is a cycle, which then starts
+    // with the edge preceding |i|.
+    bool get_unitig(DeBruijnGraphWrapper::edge_index i,
+                    std::vector<DeBruijnGraphWrapper::edge_index> *unitig) const;
+
+    std::unique_ptr<RollingMultiHash> make_hasher(const std::string &kmer) const;
+    // Uses the number of hash functions of the annotation if |num_hash| is 0
+    std::unique_ptr<HashIterator> make_hash_iterator(const std::string &sequence,
+                                                     size_t num_hash = 0) const;
+
+    void test_fp(DeBruijnGraphWrapper::edge_index i,
+                 const PreciseAnnotator &annotation_exact,
+                 bool check_both_directions,
+                 FPStats *stats) const;
 
     const DeBruijnGraphWrapper &graph_;
     double bloom_size_factor_;
     double bloom_fpp_;
-    BloomHashAnnotation annotation;
+    Layout layout_;
+    Hashing hashing_;
+    std::unique_ptr<MultiHashAnnotation> annotation;
 
     //TODO: get rid of this if not using degree Bloom filter
     std::vector<size_t> sizes_v;
 
-    size_t total_traversed_;
     bool verbose_;
 };
 
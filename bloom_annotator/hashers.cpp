@@ -1,6 +1,8 @@
 #include "hashers.hpp"
 
 #include <fstream>
+#include <cmath>
+#include <stdexcept>
 #include <cyclichash.h>
 
 #include "../serialization.hpp"
@@ -42,6 +44,24 @@ uint64_t popcount(const std::vector<uint64_t> &a) {
     return popcount;
 }
 
+char complement(char c) {
+    switch (c) {
+        case 'A': return 'T';
+        case 'C': return 'G';
+        case 'G': return 'C';
+        case 'T': return 'A';
+        default: return c;
+    }
+}
+
+void count_bits(const uint64_t *a, size_t num_words, uint64_t *counts) {
+    for (size_t i = 0; i < num_words; ++i) {
+        for (uint64_t word = a[i]; word; word &= word - 1) {
+            counts[i * 64 + __builtin_ctzll(word)]++;
+        }
+    }
+}
+
 bool equal(const std::vector<uint64_t> &a,
            const std::vector<uint64_t> &b) {
     assert(a.size() == b.size() && "Checking different sizes");
@@ -127,26 +147,151 @@ void CyclicMultiHash::reverse_update(char prev) {
 }
 
 
-//CyclicHashIterator
-CyclicHashIterator::CyclicHashIterator(const char *begin, const char *end,
-                                       size_t k, size_t num_hash)
-      : hasher_(begin, k, num_hash),
-        next_(begin + k),
-        end_(end) {
-    assert(begin <= end);
-    assert((begin + k > end) == is_end());
+//DoubleHash
+constexpr uint64_t DoubleMultiHash::kFormatTag;
+
+static uint64_t rotl(uint64_t x, size_t shift) {
+    shift %= 64;
+    return shift ? (x << shift) | (x >> (64 - shift)) : x;
 }
 
-CyclicHashIterator::CyclicHashIterator(const std::string &sequence,
-                                       size_t k, size_t num_hash)
-      : CyclicHashIterator(&sequence.front(), &sequence.back() + 1, k, num_hash) {}
+static uint64_t mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdllu;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53llu;
+    h ^= h >> 33;
+    return h;
+}
 
-CyclicHashIterator& CyclicHashIterator::operator++() {
-    if (!is_end()) {
-        hasher_.update(*next_);
+// The i-th hash value is h1 + i * h2, with h1 and h2 mixed from |base|
+static void derive_hashes(uint64_t base, MultiHash *hashes) {
+    uint64_t h1 = mix(base);
+    // odd, so that the values are all different
+    uint64_t h2 = mix(base ^ 0x6a09e667f3bcc909llu) | 1;
+    uint64_t *values = hashes->data();
+    for (size_t i = 0; i < hashes->size(); ++i) {
+        values[i] = h1 + i * h2;
     }
-    next_++;
-    return *this;
+}
+
+// Random values of the characters for the rolling hash (buzhash)
+static const uint64_t* char_values() {
+    static const std::vector<uint64_t> values = []() {
+        std::vector<uint64_t> values(256);
+        uint64_t state = 0x9e3779b97f4a7c15llu;
+        for (auto &value : values) {
+            state += 0x9e3779b97f4a7c15llu;
+            value = mix(state);
+        }
+        return values;
+    }();
+    return values.data();
+}
+
+DoubleMultiHash::DoubleMultiHash(const char *data, size_t k, size_t num_hash)
+      : hashes_(num_hash),
+        k_(k),
+        rolling_hash_(0),
+        cache_(data, k),
+        begin_(0) {
+    assert(k_);
+
+    const uint64_t *values = char_values();
+    for (size_t i = 0; i < k_; ++i) {
+        if (!data[i])
+            break;
+        rolling_hash_ = rotl(rolling_hash_, 1) ^ values[static_cast<unsigned char>(data[i])];
+    }
+    derive_hashes(rolling_hash_, &hashes_);
+}
+
+bool DoubleMultiHash::reinitialize(const char *data, size_t k, size_t num_hash) {
+    if (k != k_ || num_hash != hashes_.size())
+        return false;
+
+    for (size_t i = 0; i < k_; ++i) {
+        update(data[i]);
+    }
+    return true;
+}
+
+void DoubleMultiHash::update(char next) {
+    const uint64_t *values = char_values();
+    rolling_hash_ = rotl(rolling_hash_, 1)
+                  ^ rotl(values[static_cast<unsigned char>(cache_[begin_])], k_)
+                  ^ values[static_cast<unsigned char>(next)];
+    cache_[begin_] = next;
+    begin_ = (begin_ == cache_.size() - 1 ? 0 : begin_ + 1);
+    derive_hashes(rolling_hash_, &hashes_);
+}
+
+void DoubleMultiHash::reverse_update(char prev) {
+    begin_ = (begin_ == 0 ? cache_.size() - 1 : begin_ - 1);
+    const uint64_t *values = char_values();
+    rolling_hash_ = rotl(rolling_hash_ ^ values[static_cast<unsigned char>(cache_[begin_])], 63)
+                  ^ rotl(values[static_cast<unsigned char>(prev)], k_ - 1);
+    cache_[begin_] = prev;
+    derive_hashes(rolling_hash_, &hashes_);
+}
+
+
+//CanonicalHash
+constexpr uint64_t CanonicalMultiHash::kFormatTag;
+
+CanonicalMultiHash::CanonicalMultiHash(const char *data, size_t k, size_t num_hash)
+      : hashes_(num_hash),
+        k_(k),
+        forward_hash_(0),
+        reverse_hash_(0),
+        cache_(data, k),
+        begin_(0) {
+    assert(k_);
+
+    const uint64_t *values = char_values();
+    for (size_t i = 0; i < k_; ++i) {
+        if (!data[i])
+            break;
+        forward_hash_ = rotl(forward_hash_, 1) ^ values[static_cast<unsigned char>(data[i])];
+        reverse_hash_ ^= rotl(values[static_cast<unsigned char>(complement(data[i]))], i);
+    }
+    derive_hashes(std::min(forward_hash_, reverse_hash_), &hashes_);
+}
+
+bool CanonicalMultiHash::reinitialize(const char *data, size_t k, size_t num_hash) {
+    if (k != k_ || num_hash != hashes_.size())
+        return false;
+
+    for (size_t i = 0; i < k_; ++i) {
+        update(data[i]);
+    }
+    return true;
+}
+
+void CanonicalMultiHash::update(char next) {
+    const uint64_t *values = char_values();
+    unsigned char first = cache_[begin_];
+    forward_hash_ = rotl(forward_hash_, 1)
+                  ^ rotl(values[first], k_)
+                  ^ values[static_cast<unsigned char>(next)];
+    reverse_hash_ = rotl(reverse_hash_ ^ values[static_cast<unsigned char>(complement(first))], 63)
+                  ^ rotl(values[static_cast<unsigned char>(complement(next))], k_ - 1);
+    cache_[begin_] = next;
+    begin_ = (begin_ == cache_.size() - 1 ? 0 : begin_ + 1);
+    derive_hashes(std::min(forward_hash_, reverse_hash_), &hashes_);
+}
+
+void CanonicalMultiHash::reverse_update(char prev) {
+    begin_ = (begin_ == 0 ? cache_.size() - 1 : begin_ - 1);
+    const uint64_t *values = char_values();
+    unsigned char last = cache_[begin_];
+    forward_hash_ = rotl(forward_hash_ ^ values[last], 63)
+                  ^ rotl(values[static_cast<unsigned char>(prev)], k_ - 1);
+    reverse_hash_ = rotl(reverse_hash_, 1)
+                  ^ rotl(values[static_cast<unsigned char>(complement(last))], k_)
+                  ^ values[static_cast<unsigned char>(complement(prev))];
+    cache_[begin_] = prev;
+    derive_hashes(std::min(forward_hash_, reverse_hash_), &hashes_);
 }
 
 
@@ -191,6 +336,13 @@ bool BloomFilter::insert(const MultiHash &multihash) {
     */
 }
 
+void BloomFilter::insert_concurrent(const MultiHash &multihash) {
+    for (auto hash : multihash) {
+        uint64_t i = hash % n_bits_;
+        __atomic_fetch_or(&bits[i >> 6], 1llu << (i % 64), __ATOMIC_RELAXED);
+    }
+}
+
 uint64_t BloomFilter::serialize(std::ostream &out) const {
     return serialization::serializeNumber(out, n_bits_)
          + serialization::serializeNumberVector(out, bits);
@@ -231,6 +383,62 @@ double BloomFilter::occupancy() const {
     return static_cast<double>(count) / static_cast<double>(bits.size() * 64);
 }
 
+static uint64_t hash_columns(const std::vector<pos_t> &indices) {
+    uint64_t h = indices.size();
+    for (auto i : indices) {
+        h = mix(h ^ i) + i;
+    }
+    return h;
+}
+
+void ExactHashAnnotation::clear() {
+    kmer_map_.clear();
+    classes_.assign(1, std::vector<pos_t>());
+    class_ids_.clear();
+    class_ids_.emplace(hash_columns(classes_.front()), 0);
+    transitions_.clear();
+}
+
+ExactHashAnnotation::class_t
+ExactHashAnnotation::get_class(std::vector<pos_t>&& indices) {
+    uint64_t hash = hash_columns(indices);
+    auto range = class_ids_.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (classes_[it->second] == indices)
+            return it->second;
+    }
+
+    if (classes_.size() > static_cast<class_t>(-1)) {
+        std::cerr << "ERROR: too many distinct label sets" << std::endl;
+        exit(1);
+    }
+    class_t color = classes_.size();
+    class_ids_.emplace(hash, color);
+    classes_.emplace_back(std::move(indices));
+    return color;
+}
+
+ExactHashAnnotation::class_t ExactHashAnnotation::add_column(class_t color, pos_t i) {
+    uint64_t key = (static_cast<uint64_t>(color) << 32) | i;
+    auto it = transitions_.find(key);
+    if (it != transitions_.end())
+        return it->second;
+
+    const auto &indices = classes_[color];
+    auto pos = std::lower_bound(indices.begin(), indices.end(), i);
+    class_t next = color;
+    if (pos == indices.end() || *pos != i) {
+        std::vector<pos_t> next_indices;
+        next_indices.reserve(indices.size() + 1);
+        next_indices.insert(next_indices.end(), indices.begin(), pos);
+        next_indices.push_back(i);
+        next_indices.insert(next_indices.end(), pos, indices.end());
+        next = get_class(std::move(next_indices));
+    }
+    transitions_.emplace(key, next);
+    return next;
+}
+
 bool ExactHashAnnotation::operator==(const ExactHashAnnotation &that) const {
     if (kmer_map_.size() != that.kmer_map_.size())
         return false;
@@ -240,10 +448,8 @@ bool ExactHashAnnotation::operator==(const ExactHashAnnotation &that) const {
         auto find_it = that.kmer_map_.find(it.first);
         if (find_it == that.kmer_map_.end())
             return false;
-        if (!std::equal(find_it->second.begin(), find_it->second.end(),
-                        it.second.begin(), it.second.end())) {
+        if (classes_[it.second] != that.classes_[find_it->second])
             return false;
-        }
     }
     return true;
 }
@@ -257,8 +463,9 @@ uint64_t ExactHashAnnotation::serialize(std::ostream &out) const {
     written_bytes += serialization::serializeNumber(out, num_columns_);
     written_bytes += serialization::serializeNumber(out, kmer_map_.size());
     for (auto &it : kmer_map_) {
-        written_bytes += serialization::serializeNumber(out, it.second.size());
-        for (auto &i : it.second) {
+        const auto &indices = classes_[it.second];
+        written_bytes += serialization::serializeNumber(out, indices.size());
+        for (auto &i : indices) {
             written_bytes += serialization::serializeNumber(out, i);
         }
         written_bytes += serialization::serializeString(out, it.first);
@@ -274,15 +481,18 @@ uint64_t ExactHashAnnotation::serialize(const std::string &filename) const {
 void ExactHashAnnotation::load(std::istream &in) {
     num_columns_ = serialization::loadNumber(in);
 
-    kmer_map_.clear();
+    clear();
     size_t kmer_map_size = serialization::loadNumber(in);
+    kmer_map_.reserve(kmer_map_size);
     while (kmer_map_size--) {
-        std::set<pos_t> nums;
-        size_t num_size = serialization::loadNumber(in);
-        while (num_size--) {
-            nums.insert(serialization::loadNumber(in));
+        std::vector<pos_t> nums(serialization::loadNumber(in));
+        for (auto &i : nums) {
+            i = serialization::loadNumber(in);
         }
-        kmer_map_[serialization::loadString(in)] = nums;
+        std::sort(nums.begin(), nums.end());
+        nums.erase(std::unique(nums.begin(), nums.end()), nums.end());
+        class_t color = get_class(std::move(nums));
+        kmer_map_[serialization::loadString(in)] = color;
     }
 }
 
@@ -293,4 +503,461 @@ void ExactHashAnnotation::load(const std::string &filename) {
 }
 
 
+constexpr size_t BlockedBloomFilter::kBlockWords;
+constexpr size_t BlockedBloomFilter::kBlockBits;
+constexpr uint64_t BlockedBloomFilter::kFormatTag;
+
+BlockedBloomFilter::BlockedBloomFilter(size_t n_bits) {
+    if (n_bits > 0)
+        resize(n_bits);
+}
+
+BlockedBloomFilter::BlockedBloomFilter(const BlockedBloomFilter &other) {
+    *this = other;
+}
+
+BlockedBloomFilter& BlockedBloomFilter::operator=(const BlockedBloomFilter &other) {
+    if (this == &other)
+        return *this;
+
+    resize(other.n_bits_);
+    std::copy(other.blocks(), other.blocks() + num_blocks() * kBlockWords, blocks());
+    return *this;
+}
+
+void BlockedBloomFilter::resize(size_t new_size) {
+    n_bits_ = new_size;
+    // reserve space for aligning the blocks to cache lines
+    bits.assign(num_blocks() * kBlockWords + kBlockWords - 1, 0);
+}
+
+size_t BlockedBloomFilter::get_block(const MultiHash &multihash, uint64_t *mask) const {
+    std::fill(mask, mask + kBlockWords, 0);
+    for (auto hash : multihash) {
+        mask[(hash >> 6) % kBlockWords] |= 1llu << (hash % 64);
+    }
+    // map the first hash value to a block without division
+    uint64_t block = (static_cast<__uint128_t>(multihash.front()) * num_blocks()) >> 64;
+    return block * kBlockWords;
+}
+
+bool BlockedBloomFilter::find(const MultiHash &multihash) const {
+    if (!n_bits_) {
+        std::cerr << "ERROR: Bloom filter not initialized\n";
+        exit(1);
+    }
+    if (multihash.empty())
+        return false;
+
+    uint64_t mask[kBlockWords];
+    const uint64_t *block = blocks() + get_block(multihash, mask);
+    // no early exit, so that the loop gets vectorized
+    uint64_t missing = 0;
+    for (size_t i = 0; i < kBlockWords; ++i) {
+        missing |= mask[i] & ~block[i];
+    }
+    return !missing;
+}
+
+bool BlockedBloomFilter::insert(const MultiHash &multihash) {
+    if (multihash.empty())
+        return false;
+
+    uint64_t mask[kBlockWords];
+    uint64_t *block = blocks() + get_block(multihash, mask);
+    uint64_t missing = 0;
+    for (size_t i = 0; i < kBlockWords; ++i) {
+        missing |= mask[i] & ~block[i];
+        block[i] |= mask[i];
+    }
+    return !missing;
+}
+
+void BlockedBloomFilter::insert_concurrent(const MultiHash &multihash) {
+    if (multihash.empty())
+        return;
+
+    uint64_t mask[kBlockWords];
+    uint64_t *block = blocks() + get_block(multihash, mask);
+    for (size_t i = 0; i < kBlockWords; ++i) {
+        if (mask[i])
+            __atomic_fetch_or(&block[i], mask[i], __ATOMIC_RELAXED);
+    }
+}
+
+uint64_t BlockedBloomFilter::serialize(std::ostream &out) const {
+    return serialization::serializeNumber(out, n_bits_)
+         + serialization::serializeRawArray(out, blocks(), num_blocks() * kBlockWords);
+}
+
+void BlockedBloomFilter::load(std::istream &in) {
+    resize(serialization::loadNumber(in));
+    auto blocks_read = serialization::loadRawArray<uint64_t>(in, num_blocks() * kBlockWords);
+    std::copy(blocks_read.begin(), blocks_read.end(), blocks());
+}
+
+bool BlockedBloomFilter::operator==(const BlockedBloomFilter &a) const {
+    return n_bits_ == a.n_bits_
+        && std::equal(blocks(), blocks() + num_blocks() * kBlockWords, a.blocks());
+}
+
+double BlockedBloomFilter::occupancy() const {
+    uint64_t count = 0;
+    for (size_t i = 0; i < num_blocks() * kBlockWords; ++i) {
+        count += static_cast<uint64_t>(__builtin_popcountll(blocks()[i]));
+    }
+    return static_cast<double>(count) / static_cast<double>(num_blocks() * kBlockBits);
+}
+
+
+constexpr uint64_t RibbonFilter::kFormatTag;
+constexpr size_t RibbonFilter::kMaxFingerprintBits;
+constexpr size_t RibbonFilter::kSegmentKeys;
+constexpr uint64_t RibbonFilter::kMaxSeed;
+
+RibbonFilter::RibbonFilter(size_t n_bits) {
+    std::ignore = n_bits;
+}
+
+size_t RibbonFilter::get_segment(uint64_t key) const {
+    return (static_cast<__uint128_t>(mix(key)) * num_segments()) >> 64;
+}
+
+void RibbonFilter::get_row(uint64_t key, size_t segment, size_t *start,
+                           uint64_t *coeffs, uint32_t *fingerprint) const {
+    uint64_t num_slots = (offsets_[segment + 1] - offsets_[segment]) * 64;
+    uint64_t h = mix(key ^ ((seeds_[segment] + 1) * 0x9e3779b97f4a7c15llu));
+    *start = (static_cast<__uint128_t>(h) * (num_slots - 63)) >> 64;
+    // the first coefficient is set, so the row starts at its slot
+    *coeffs = mix(h ^ 0xbb67ae8584caa73bllu) | 1;
+    *fingerprint = h & ((uint64_t(1) << fingerprint_bits_) - 1);
+}
+
+void RibbonFilter::build(std::vector<uint64_t> keys, size_t fingerprint_bits) {
+    if (!fingerprint_bits || fingerprint_bits > kMaxFingerprintBits) {
+        std::cerr << "ERROR: invalid number of fingerprint bits "
+                  << fingerprint_bits << std::endl;
+        exit(1);
+    }
+    fingerprint_bits_ = fingerprint_bits;
+
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    seeds_.assign((keys.size() + kSegmentKeys - 1) / kSegmentKeys, 0);
+    offsets_.assign(num_segments() + 1, 0);
+    solution_.clear();
+
+    // order the keys by their segments
+    std::vector<std::pair<size_t, uint64_t>> segment_keys(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        segment_keys[i] = std::make_pair(get_segment(keys[i]), keys[i]);
+    }
+    std::sort(segment_keys.begin(), segment_keys.end());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        keys[i] = segment_keys[i].second;
+    }
+
+    auto begin = keys.begin();
+    for (size_t segment = 0; segment < num_segments(); ++segment) {
+        auto end = begin;
+        while (end != keys.end() && segment_keys[end - keys.begin()].first == segment) {
+            ++end;
+        }
+        size_t num_keys = end - begin;
+
+        // start with 1/32 extra slots and add 1/64, but at least a block,
+        // after each failed attempt
+        const size_t extra_slots = std::max(num_keys / 64, size_t(64));
+        for (seeds_[segment] = 0; ; ++seeds_[segment]) {
+            // the seed is serialized together with the number of blocks
+            if (seeds_[segment] == kMaxSeed) {
+                std::cerr << "ERROR: can't build the ribbon filter for segment "
+                          << segment << " of " << num_keys << " keys" << std::endl;
+                exit(1);
+            }
+            size_t num_slots = num_keys + num_keys / 32
+                                 + extra_slots * seeds_[segment] + 1;
+            offsets_[segment + 1] = offsets_[segment] + (num_slots + 63) / 64;
+            if (solve_segment(&*begin, &*begin + num_keys, segment))
+                break;
+        }
+        begin = end;
+    }
+}
+
+bool RibbonFilter::solve_segment(const uint64_t *begin, const uint64_t *end,
+                                 size_t segment) {
+    const size_t num_blocks = offsets_[segment + 1] - offsets_[segment];
+    const size_t num_slots = num_blocks * 64;
+
+    // banding: the row of each key is reduced by the rows already placed
+    // until its first coefficient lands on an empty slot
+    std::vector<uint64_t> coeffs(num_slots, 0);
+    std::vector<uint32_t> results(num_slots, 0);
+    for (const uint64_t *key = begin; key != end; ++key) {
+        size_t i;
+        uint64_t c;
+        uint32_t r;
+        get_row(*key, segment, &i, &c, &r);
+        while (coeffs[i]) {
+            c ^= coeffs[i];
+            r ^= results[i];
+            if (!c) {
+                if (r)
+                    return false;
+                break;
+            }
+            size_t shift = __builtin_ctzll(c);
+            i += shift;
+            c >>= shift;
+        }
+        if (c) {
+            coeffs[i] = c;
+            results[i] = r;
+        }
+    }
+
+    // back substitution from the last slot, the empty ones are set to zero
+    const size_t width = fingerprint_bits_;
+    solution_.resize(offsets_[segment] * width);
+    solution_.resize(offsets_[segment + 1] * width, 0);
+    uint64_t *blocks = &solution_[offsets_[segment] * width];
+    for (size_t i = num_slots; i-- > 0; ) {
+        if (!coeffs[i])
+            continue;
+
+        size_t block = i / 64;
+        size_t offset = i % 64;
+        for (size_t j = 0; j < width; ++j) {
+            uint64_t window = blocks[block * width + j] >> offset;
+            if (offset && block + 1 < num_blocks)
+                window |= blocks[(block + 1) * width + j] << (64 - offset);
+
+            uint64_t bit = ((results[i] >> j) ^ __builtin_parityll(window & coeffs[i])) & 1;
+            blocks[block * width + j] |= bit << offset;
+        }
+    }
+    return true;
+}
+
+void RibbonFilter::resize(size_t new_size) {
+    std::ignore = new_size;
+    std::cerr << "ERROR: static filters can't be resized" << std::endl;
+    exit(1);
+}
+
+bool RibbonFilter::find(const MultiHash &multihash) const {
+    if (!num_segments())
+        return false;
+
+    uint64_t key = get_key(multihash);
+    size_t segment = get_segment(key);
+    size_t start;
+    uint64_t coeffs;
+    uint32_t fingerprint;
+    get_row(key, segment, &start, &coeffs, &fingerprint);
+
+    const size_t width = fingerprint_bits_;
+    const uint64_t *block = &solution_[(offsets_[segment] + start / 64) * width];
+    const size_t offset = start % 64;
+    uint32_t found = 0;
+    for (size_t j = 0; j < width; ++j) {
+        uint64_t window = block[j] >> offset;
+        if (offset)
+            window |= block[width + j] << (64 - offset);
+        found |= static_cast<uint32_t>(__builtin_parityll(window & coeffs)) << j;
+    }
+    return found == fingerprint;
+}
+
+bool RibbonFilter::insert(const MultiHash &multihash) {
+    std::ignore = multihash;
+    std::cerr << "ERROR: can't insert into a static filter" << std::endl;
+    exit(1);
+}
+
+void RibbonFilter::insert_concurrent(const MultiHash &multihash) {
+    insert(multihash);
+}
+
+// Most columns have one segment, so each segment is written as one word
+// with its number of blocks and its seed
+uint64_t RibbonFilter::serialize(std::ostream &out) const {
+    std::vector<uint64_t> segments(num_segments());
+    for (size_t i = 0; i < num_segments(); ++i) {
+        segments[i] = (offsets_[i + 1] - offsets_[i]) * kMaxSeed + seeds_[i];
+    }
+    return serialization::serializeNumber(out, fingerprint_bits_)
+         + serialization::serializeNumberVector(out, segments)
+         + serialization::serializeRawArray(out, solution_.data(), solution_.size());
+}
+
+void RibbonFilter::load(std::istream &in) {
+    fingerprint_bits_ = serialization::loadNumber(in);
+    if (fingerprint_bits_ > kMaxFingerprintBits)
+        throw std::runtime_error("Corrupted ribbon filter");
+
+    auto segments = serialization::loadNumberVector(in);
+    offsets_.assign(segments.size() + 1, 0);
+    seeds_.resize(segments.size());
+    for (size_t i = 0; i < segments.size(); ++i) {
+        offsets_[i + 1] = offsets_[i] + segments[i] / kMaxSeed;
+        seeds_[i] = segments[i] % kMaxSeed;
+    }
+    solution_ = serialization::loadRawArray<uint64_t>(in, offsets_.back() * fingerprint_bits_);
+}
+
+bool RibbonFilter::operator==(const RibbonFilter &a) const {
+    return fingerprint_bits_ == a.fingerprint_bits_
+        && offsets_ == a.offsets_
+        && seeds_ == a.seeds_
+        && solution_ == a.solution_;
+}
+
+double RibbonFilter::occupancy() const {
+    uint64_t count = 0;
+    for (uint64_t word : solution_) {
+        count += static_cast<uint64_t>(__builtin_popcountll(word));
+    }
+    return solution_.size()
+        ? static_cast<double>(count) / static_cast<double>(solution_.size() * 64)
+        : 0;
+}
+
+
+HyperLogLog::HyperLogLog(size_t precision)
+      : precision_(precision), registers_(size_t(1) << precision, 0) {
+    assert(precision >= 4 && precision < 32);
+}
+
+void HyperLogLog::merge(const HyperLogLog &other) {
+    assert(precision_ == other.precision_);
+    for (size_t i = 0; i < registers_.size(); ++i) {
+        registers_[i] = std::max(registers_[i], other.registers_[i]);
+    }
+}
+
+double HyperLogLog::estimate() const {
+    const double m = registers_.size();
+    double sum = 0;
+    size_t num_zeros = 0;
+    for (uint8_t reg : registers_) {
+        sum += std::ldexp(1.0, -reg);
+        num_zeros += !reg;
+    }
+    double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+
+    // linear counting is more accurate for small cardinalities
+    if (estimate <= 2.5 * m && num_zeros)
+        return m * std::log(m / num_zeros);
+
+    return estimate;
+}
+
+
+constexpr uint64_t BitSlicedAnnotation::kFormatTag;
+
+void BitSlicedAnnotation::resize(size_t size) {
+    assert(size > num_columns_);
+    size_t old_words = num_words();
+    num_columns_ = size;
+    if (num_words() == old_words || !num_rows_)
+        return;
+
+    // widen the rows
+    std::vector<uint64_t> rows(num_rows_ * num_words(), 0);
+    for (size_t i = 0; i < num_rows_; ++i) {
+        std::copy(&rows_[i * old_words], &rows_[(i + 1) * old_words],
+                  &rows[i * num_words()]);
+    }
+    rows_.swap(rows);
+}
+
+void BitSlicedAnnotation::resize_column(size_t i, size_t size) {
+    std::ignore = i;
+    if (!empty_ || size <= num_rows_)
+        return;
+
+    num_rows_ = size;
+    rows_.assign(num_rows_ * num_words(), 0);
+}
+
+void BitSlicedAnnotation::insert(const MultiHash &hash, pos_t column) {
+    assert(column < num_columns_);
+    if (!num_rows_) {
+        std::cerr << "ERROR: Bloom filter not initialized\n";
+        exit(1);
+    }
+    empty_ = false;
+    for (auto h : hash) {
+        rows_[get_row(h) + (column >> 6)] |= 1llu << (column % 64);
+    }
+}
+
+void BitSlicedAnnotation::insert_concurrent(const MultiHash &hash, pos_t column) {
+    assert(column < num_columns_);
+    if (!num_rows_) {
+        std::cerr << "ERROR: Bloom filter not initialized\n";
+        exit(1);
+    }
+    __atomic_store_n(&empty_, false, __ATOMIC_RELAXED);
+    for (auto h : hash) {
+        __atomic_fetch_or(&rows_[get_row(h) + (column >> 6)],
+                          1llu << (column % 64), __ATOMIC_RELAXED);
+    }
+}
+
+std::vector<uint64_t> BitSlicedAnnotation::find(const MultiHash &hash) const {
+    std::vector<uint64_t> annot(num_words(), 0);
+    find(hash, annot.data());
+    return annot;
+}
+
+void BitSlicedAnnotation::find(const MultiHash &hash, uint64_t *annot) const {
+    if (!num_rows_) {
+        std::cerr << "ERROR: Bloom filter not initialized\n";
+        exit(1);
+    }
+    if (hash.empty())
+        return;
+
+    for (size_t w = 0; w < num_words(); ++w) {
+        uint64_t word = ~0llu;
+        for (size_t i = 0; i < hash.size() && word; ++i) {
+            word &= rows_[get_row(hash[i]) + w];
+        }
+        annot[w] |= word;
+    }
+}
+
+void BitSlicedAnnotation::find(const MultiHash &hash,
+                               const uint64_t *mask,
+                               uint64_t *annot) const {
+    if (!num_rows_) {
+        std::cerr << "ERROR: Bloom filter not initialized\n";
+        exit(1);
+    }
+    for (size_t w = 0; w < num_words(); ++w) {
+        uint64_t word = hash.size() ? mask[w] : 0;
+        for (size_t i = 0; i < hash.size() && word; ++i) {
+            word &= rows_[get_row(hash[i]) + w];
+        }
+        annot[w] = word;
+    }
+}
+
+uint64_t BitSlicedAnnotation::serialize(std::ostream &out) const {
+    return serialization::serializeNumber(out, num_columns_)
+         + serialization::serializeNumber(out, num_rows_)
+         + serialization::serializeRawArray(out, rows_.data(), rows_.size());
+}
+
+void BitSlicedAnnotation::load(std::istream &in) {
+    num_columns_ = serialization::loadNumber(in);
+    num_rows_ = serialization::loadNumber(in);
+    rows_ = serialization::loadRawArray<uint64_t>(in, num_rows_ * num_words());
+    empty_ = !num_rows_;
+}
+
 } // namespace hash_annotate
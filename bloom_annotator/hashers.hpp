@@ -1,6 +1,7 @@
 #ifndef __ANNOBLOOM__
 #define __ANNOBLOOM__
 
+#include <cstdint>
 #include <iostream>
 #include <cassert>
 #include <vector>
@@ -9,6 +10,7 @@
 #include <unordered_set>
 #include <unordered_map>
 #include <set>
+#include <tuple>
 
 
 namespace hash_annotate {
@@ -26,6 +28,9 @@ std::vector<uint64_t> merge_and(const std::vector<uint64_t> &a,
 
 uint64_t popcount(const std::vector<uint64_t> &a);
 
+// Increment counts[i] for each bit i set in the |num_words| words at |a|
+void count_bits(const uint64_t *a, size_t num_words, uint64_t *counts);
+
 bool test_bit(const std::vector<uint64_t> &a, pos_t i);
 
 void set_bit(std::vector<uint64_t> &a, pos_t i);
@@ -35,6 +40,9 @@ bool equal(const std::vector<uint64_t> &a,
 
 void print(const std::vector<uint64_t> &a);
 
+// Complement of a nucleotide, the other characters are their own complements
+char complement(char c);
+
 
 class HashIterator {
   public:
@@ -74,7 +82,18 @@ class DummyHasher : MultiHasher<std::string> {
     std::string hash_;
 };
 
-class CyclicMultiHash : public MultiHasher<MultiHash> {
+// Multiple hash values of a k-mer rolled from one k-mer to the next
+class RollingMultiHash : public MultiHasher<MultiHash> {
+  public:
+    virtual ~RollingMultiHash() {}
+
+    // Drop the first character and append |next|
+    virtual void update(char next) = 0;
+    // Drop the last character and prepend |prev|
+    virtual void reverse_update(char prev) = 0;
+};
+
+class CyclicMultiHash : public RollingMultiHash {
   public:
     CyclicMultiHash(const char *data, size_t k, size_t num_hash);
 
@@ -103,27 +122,111 @@ class CyclicMultiHash : public MultiHasher<MultiHash> {
     std::vector<void*> chashers_;
 };
 
-class CyclicHashIterator : public HashIterator {
+/**
+ * Derives all hash values of a k-mer from a single rolling hash by double
+ * hashing: the i-th value is h1 + i * h2, where h1 and h2 are two mixes of
+ * the rolling hash. A rolling update costs the same for any number of hash
+ * functions, and the loop computing the values gets vectorized.
+ */
+class DoubleMultiHash : public RollingMultiHash {
+  public:
+    // Written before the annotations hashed with this hasher, spells "DBLHASH1"
+    static constexpr uint64_t kFormatTag = 0x31485341484c4244llu;
+
+    DoubleMultiHash(const char *data, size_t k, size_t num_hash);
+
+    DoubleMultiHash(const std::string &sequence, size_t num_hash)
+          : DoubleMultiHash(&sequence[0], sequence.length(), num_hash) {}
+
+    bool reinitialize(const char *data, size_t k, size_t num_hash);
+
+    void update(char next);
+    void reverse_update(char prev);
+
+    const MultiHash& get_hash() const { return hashes_; }
+
+  private:
+    MultiHash hashes_;
+    size_t k_;
+    uint64_t rolling_hash_;
+
+    std::string cache_;
+    size_t begin_;
+};
+
+/**
+ * Same as DoubleMultiHash, but the k-mer and its reverse complement get
+ * the same hash values. Rolling hashes of both strands are updated
+ * together, as in ntHash, and the values are derived from the smaller one.
+ */
+class CanonicalMultiHash : public RollingMultiHash {
   public:
-    CyclicHashIterator(const char *begin, const char *end,
-                       size_t k, size_t num_hash);
-    CyclicHashIterator(const std::string &sequence, size_t k, size_t num_hash);
+    // Written before the annotations hashed with this hasher, spells "CANHASH1"
+    static constexpr uint64_t kFormatTag = 0x31485341484e4143llu;
+
+    CanonicalMultiHash(const char *data, size_t k, size_t num_hash);
+
+    CanonicalMultiHash(const std::string &sequence, size_t num_hash)
+          : CanonicalMultiHash(&sequence[0], sequence.length(), num_hash) {}
+
+    bool reinitialize(const char *data, size_t k, size_t num_hash);
+
+    void update(char next);
+    void reverse_update(char prev);
+
+    const MultiHash& get_hash() const { return hashes_; }
+
+  private:
+    MultiHash hashes_;
+    size_t k_;
+    uint64_t forward_hash_;
+    uint64_t reverse_hash_;
+
+    std::string cache_;
+    size_t begin_;
+};
+
+template <class Hasher>
+class RollingHashIterator : public HashIterator {
+  public:
+    RollingHashIterator(const char *begin, const char *end,
+                        size_t k, size_t num_hash)
+          : hasher_(begin, k, num_hash),
+            next_(begin + k),
+            end_(end) {
+        assert(begin <= end);
+        assert((begin + k > end) == is_end());
+    }
+
+    RollingHashIterator(const std::string &sequence, size_t k, size_t num_hash)
+          : RollingHashIterator(&sequence.front(), &sequence.back() + 1, k, num_hash) {}
 
-    CyclicHashIterator(CyclicHashIterator &&other) = default;
-    CyclicHashIterator& operator=(CyclicHashIterator &&other) = default;
+    RollingHashIterator(RollingHashIterator &&other) = default;
+    RollingHashIterator& operator=(RollingHashIterator &&other) = default;
+
+    RollingHashIterator& operator++() {
+        if (!is_end()) {
+            hasher_.update(*next_);
+        }
+        next_++;
+        return *this;
+    }
 
-    CyclicHashIterator& operator++();
     bool is_end() const { return next_ > end_; }
 
     const MultiHash& operator*() const { return hasher_.get_hash(); }
     const MultiHash* operator->() const { return &hasher_.get_hash(); }
 
   private:
-    CyclicMultiHash hasher_;
+    Hasher hasher_;
     const char *next_;
     const char *end_;
 };
 
+typedef RollingHashIterator<CyclicMultiHash> CyclicHashIterator;
+typedef RollingHashIterator<DoubleMultiHash> DoubleHashIterator;
+typedef RollingHashIterator<CanonicalMultiHash> CanonicalHashIterator;
+
 
 class ExactFilter {
   public:
@@ -151,6 +254,8 @@ class BloomFilter {
 
     bool find(const MultiHash &multihash) const;
     bool insert(const MultiHash &multihash);
+    // Same as insert, but safe to call from several threads at once
+    void insert_concurrent(const MultiHash &multihash);
 
     uint64_t serialize(std::ostream &out) const;
     void load(std::istream &in);
@@ -166,17 +271,175 @@ class BloomFilter {
 };
 
 
+/**
+ * Bloom filter with all bits of an element set in one 512-bit block,
+ * so that each query touches a single cache line. The block is chosen
+ * by the first hash value, and each hash value sets one bit in it.
+ */
+class BlockedBloomFilter {
+  public:
+    static constexpr size_t kBlockWords = 8;
+    static constexpr size_t kBlockBits = kBlockWords * 64;
+
+    // Written before the annotations stored with this filter,
+    // spells "BLOCKED1"
+    static constexpr uint64_t kFormatTag = 0x3144454b434f4c42llu;
+
+    explicit BlockedBloomFilter(size_t n_bits = 0);
+
+    // The copies align their blocks again
+    BlockedBloomFilter(const BlockedBloomFilter &other);
+    BlockedBloomFilter(BlockedBloomFilter&&) = default;
+    BlockedBloomFilter& operator=(const BlockedBloomFilter &other);
+    BlockedBloomFilter& operator=(BlockedBloomFilter&&) = default;
+
+    size_t size() const { return n_bits_; }
+    void resize(size_t new_size);
+
+    bool find(const MultiHash &multihash) const;
+    bool insert(const MultiHash &multihash);
+    // Same as insert, but safe to call from several threads at once
+    void insert_concurrent(const MultiHash &multihash);
+
+    uint64_t serialize(std::ostream &out) const;
+    void load(std::istream &in);
+
+    bool operator==(const BlockedBloomFilter &a) const;
+    bool operator!=(const BlockedBloomFilter &a) const { return !operator==(a); }
+
+    double occupancy() const;
+
+  private:
+    size_t num_blocks() const { return (n_bits_ + kBlockBits - 1) / kBlockBits; }
+
+    // The blocks start at the first cache-line aligned word of |bits|
+    const uint64_t* blocks() const {
+        return bits.data() + ((-reinterpret_cast<uintptr_t>(bits.data()) >> 3)
+                                & (kBlockWords - 1));
+    }
+    uint64_t* blocks() {
+        return const_cast<uint64_t*>(
+            const_cast<const BlockedBloomFilter&>(*this).blocks()
+        );
+    }
+
+    // Get the offset of the block of the element and its mask in the block
+    size_t get_block(const MultiHash &multihash, uint64_t *mask) const;
+
+    std::vector<uint64_t> bits;
+    uint64_t n_bits_ = 0;
+};
+
+
+/**
+ * Static filter for a fixed set of keys, a standard ribbon filter. The
+ * r-bit fingerprints of the keys are stored as the solution of a banded
+ * linear system over GF(2), in which each key has 64 coefficients
+ * starting at its own slot. A query computes r parities from the two
+ * blocks of 64 slots under the window, so it reads one or two cache
+ * lines. The false positive rate is 2^-r, with about 1.04 r bits per key
+ * for large sets instead of the 1.44 r bits of a Bloom filter.
+ *
+ * The keys are split into segments of about kSegmentKeys keys, each
+ * solved separately with its own seed, since the slots a single system
+ * needs grow with the number of keys.
+ *
+ * The filter is built once from all keys and can't be modified.
+ */
+class RibbonFilter {
+  public:
+    // Written before the annotations stored with this filter,
+    // spells "RIBBON01"
+    static constexpr uint64_t kFormatTag = 0x31304e4f42424952llu;
+    static constexpr size_t kMaxFingerprintBits = 32;
+    static constexpr size_t kSegmentKeys = 8192;
+    // The attempts to solve a segment never get close to this,
+    // building the filter fails if they do
+    static constexpr uint64_t kMaxSeed = 1 << 16;
+
+    // The filter is sized by build(), |n_bits| is ignored
+    explicit RibbonFilter(size_t n_bits = 0);
+
+    // The key of an element, derived from its first hash value
+    static uint64_t get_key(const MultiHash &multihash) { return multihash.at(0); }
+
+    // Build the filter for the keys with fingerprints of
+    // |fingerprint_bits| bits. The keys may repeat.
+    void build(std::vector<uint64_t> keys, size_t fingerprint_bits);
+
+    size_t size() const { return solution_.size() * 64; }
+    // Resizing or inserting into a static filter is an error
+    void resize(size_t new_size);
+
+    bool find(const MultiHash &multihash) const;
+    bool insert(const MultiHash &multihash);
+    void insert_concurrent(const MultiHash &multihash);
+
+    uint64_t serialize(std::ostream &out) const;
+    void load(std::istream &in);
+
+    bool operator==(const RibbonFilter &a) const;
+    bool operator!=(const RibbonFilter &a) const { return !operator==(a); }
+
+    double occupancy() const;
+
+  private:
+    size_t num_segments() const { return seeds_.size(); }
+
+    size_t get_segment(uint64_t key) const;
+
+    // Get the first slot of the key relative to its segment,
+    // its coefficients and its fingerprint
+    void get_row(uint64_t key, size_t segment, size_t *start,
+                 uint64_t *coeffs, uint32_t *fingerprint) const;
+
+    // Solve the system of the segment with its current seed and number
+    // of blocks, appending the solution. Returns false if it has none.
+    bool solve_segment(const uint64_t *begin, const uint64_t *end, size_t segment);
+
+    uint64_t fingerprint_bits_ = 0;
+    // The first block of each segment, and the end of the last one
+    std::vector<uint64_t> offsets_;
+    std::vector<uint64_t> seeds_;
+    // For each block of 64 slots, one word per fingerprint bit
+    std::vector<uint64_t> solution_;
+};
+
+
+/**
+ * HyperLogLog sketch estimating the number of distinct elements from
+ * their hash values, with 2^precision registers. The relative standard
+ * error is about 1.04 / sqrt(2^precision), 1.6% with the default.
+ */
+class HyperLogLog {
+  public:
+    explicit HyperLogLog(size_t precision = 12);
+
+    // The hash values must be uniformly distributed
+    void insert(uint64_t hash) {
+        uint64_t rest = hash << precision_;
+        uint8_t rank = rest ? __builtin_clzll(rest) + 1 : 64 - precision_ + 1;
+        uint8_t &reg = registers_[hash >> (64 - precision_)];
+        reg = std::max(reg, rank);
+    }
+
+    // Estimate the number of distinct elements in the union
+    void merge(const HyperLogLog &other);
+
+    double estimate() const;
+
+  private:
+    size_t precision_;
+    std::vector<uint8_t> registers_;
+};
+
+
 template <class Filter, class Hash, class Hasher>
 class HashAnnotation {
   public:
     explicit HashAnnotation(size_t num_hash_functions = 0)
           : num_hash_functions_(num_hash_functions) {}
 
-    ~HashAnnotation() {
-        if (hasher_)
-            delete hasher_;
-    }
-
     void resize(size_t size) {
         assert(size > color_bits.size());
         color_bits.resize(size, Filter());
@@ -295,6 +558,34 @@ class HashAnnotation {
         return annot;
     }
 
+    // Same as above, but sets the bits in the caller's buffer
+    // |annot| of num_words() words without clearing it
+    void find(const Hash &hash, uint64_t *annot) const {
+        for (size_t i = 0; i < color_bits.size(); ++i) {
+            if (color_bits[i].find(hash)) {
+                annot[i >> 6] |= 1llu << (i % 64);
+            }
+        }
+    }
+
+    // Probe only the columns set in |mask| and write the result to |annot|.
+    // Both have num_words() words and may point to the same buffer.
+    void find(const Hash &hash, const uint64_t *mask, uint64_t *annot) const {
+        for (size_t w = 0; w < num_words(); ++w) {
+            uint64_t candidates = mask[w];
+            uint64_t found = 0;
+            while (candidates) {
+                size_t i = w * 64 + static_cast<size_t>(__builtin_ctzll(candidates));
+                candidates &= candidates - 1;
+                if (color_bits[i].find(hash))
+                    found |= 1llu << (i % 64);
+            }
+            annot[w] = found;
+        }
+    }
+
+    size_t num_words() const { return (color_bits.size() >> 6) + 1; }
+
     uint64_t serialize(std::ostream &out) const {
         uint64_t written_bytes = 0;
         size_t size = color_bits.size();
@@ -352,37 +643,157 @@ class HashAnnotation {
         return compute_hash(sequence.data(), sequence.data() + sequence.size());
     }
 
+    // The hasher is not cached, so that queries can run concurrently
     template <typename T>
     Hash compute_hash(const T *begin, const T *end) const {
         assert(end >= begin);
-        Hasher *&hasher = const_cast<Hasher*&>(hasher_);
-        if (hasher && !hasher->reinitialize(reinterpret_cast<const char*>(begin),
-                                            static_cast<size_t>(end - begin) * sizeof(T),
-                                            num_hash_functions_)) {
-            delete hasher;
-            hasher = NULL;
-        }
-        if (!hasher) {
-            hasher = new Hasher(reinterpret_cast<const char*>(begin),
-                                static_cast<size_t>(end - begin) * sizeof(T),
-                                num_hash_functions_);
-        }
-        return hasher->get_hash();
+        return Hasher(reinterpret_cast<const char*>(begin),
+                      static_cast<size_t>(end - begin) * sizeof(T),
+                      num_hash_functions_).get_hash();
     }
 
   private:
     std::vector<Filter> color_bits;
     size_t num_hash_functions_;
-    Hasher *hasher_ = NULL;
 };
 
 
 typedef HashAnnotation<BloomFilter, MultiHash, CyclicMultiHash> BloomHashAnnotation;
+typedef HashAnnotation<BlockedBloomFilter, MultiHash, CyclicMultiHash> BlockedBloomHashAnnotation;
+typedef HashAnnotation<BloomFilter, MultiHash, DoubleMultiHash> DoubleBloomHashAnnotation;
+
+
+/**
+ * Interface to the Bloom filter annotations with different filter layouts,
+ * so that the layout can be chosen at runtime (e.g. from the file format)
+ */
+class MultiHashAnnotation {
+  public:
+    virtual ~MultiHashAnnotation() {}
+
+    virtual size_t size() const = 0;
+    virtual void resize(size_t size) = 0;
+
+    virtual size_t num_hash_functions() const = 0;
+
+    // Size of the filter of the i-th column in bits
+    virtual size_t column_size(size_t i) const = 0;
+    virtual void resize_column(size_t i, size_t size) = 0;
+
+    virtual void insert(const MultiHash &hash, pos_t column) = 0;
+    // Same as insert, but safe to call from several threads at once.
+    // The columns must be resized beforehand.
+    virtual void insert_concurrent(const MultiHash &hash, pos_t column) = 0;
+
+    virtual std::vector<uint64_t> find(const MultiHash &hash) const = 0;
+    // Set the bits of the columns containing |hash| in |annot|,
+    // which must have num_words() words
+    virtual void find(const MultiHash &hash, uint64_t *annot) const = 0;
+    // Write to |annot| the columns set in |mask| containing |hash|,
+    // probing only these columns. |annot| may be the same as |mask|.
+    virtual void find(const MultiHash &hash, const uint64_t *mask, uint64_t *annot) const = 0;
+    virtual size_t num_words() const = 0;
+
+    virtual uint64_t serialize(std::ostream &out) const = 0;
+    virtual void load(std::istream &in) = 0;
+};
+
+template <class Filter>
+class FilterAnnotation : public MultiHashAnnotation {
+  public:
+    explicit FilterAnnotation(size_t num_hash_functions)
+          : annotation_(num_hash_functions) {}
+
+    size_t size() const { return annotation_.size(); }
+    void resize(size_t size) { annotation_.resize(size); }
+
+    size_t num_hash_functions() const { return annotation_.num_hash_functions(); }
+
+    size_t column_size(size_t i) const { return annotation_[i].size(); }
+    void resize_column(size_t i, size_t size) { annotation_[i].resize(size); }
+
+    void insert(const MultiHash &hash, pos_t column) {
+        assert(column < size());
+        annotation_[column].insert(hash);
+    }
+    void insert_concurrent(const MultiHash &hash, pos_t column) {
+        assert(column < size());
+        annotation_[column].insert_concurrent(hash);
+    }
+
+    std::vector<uint64_t> find(const MultiHash &hash) const { return annotation_.find(hash); }
+    void find(const MultiHash &hash, uint64_t *annot) const { annotation_.find(hash, annot); }
+    void find(const MultiHash &hash, const uint64_t *mask, uint64_t *annot) const {
+        annotation_.find(hash, mask, annot);
+    }
+    size_t num_words() const { return annotation_.num_words(); }
+
+    uint64_t serialize(std::ostream &out) const { return annotation_.serialize(out); }
+    void load(std::istream &in) { annotation_.load(in); }
+
+    Filter& operator[](size_t i) { return annotation_[i]; }
+    const Filter& operator[](size_t i) const { return annotation_[i]; }
+
+  private:
+    HashAnnotation<Filter, MultiHash, CyclicMultiHash> annotation_;
+};
+
+/**
+ * Bloom filter annotation with one hash space shared by all columns, as in
+ * the bit-sliced signatures of BIGSI and COBS. Each filter position holds
+ * a row with a bit per column, so a lookup fetches one row per hash
+ * function and ANDs them instead of probing every column separately.
+ * The rows have num_words() words, the same as the annotations.
+ */
+class BitSlicedAnnotation : public MultiHashAnnotation {
+  public:
+    // Written before the annotations with this layout, spells "SLICED01"
+    static constexpr uint64_t kFormatTag = 0x3130444543494c53llu;
+
+    explicit BitSlicedAnnotation(size_t num_hash_functions)
+          : num_hash_functions_(num_hash_functions) {}
+
+    size_t size() const { return num_columns_; }
+    void resize(size_t size);
+
+    size_t num_hash_functions() const { return num_hash_functions_; }
+
+    // The columns share the filter, which can only be resized before the
+    // first insertion. Later requests for a larger size are ignored.
+    size_t column_size(size_t i) const { std::ignore = i; return num_rows_; }
+    void resize_column(size_t i, size_t size);
+
+    void insert(const MultiHash &hash, pos_t column);
+    void insert_concurrent(const MultiHash &hash, pos_t column);
+
+    std::vector<uint64_t> find(const MultiHash &hash) const;
+    void find(const MultiHash &hash, uint64_t *annot) const;
+    void find(const MultiHash &hash, const uint64_t *mask, uint64_t *annot) const;
+    size_t num_words() const { return (num_columns_ >> 6) + 1; }
+
+    uint64_t serialize(std::ostream &out) const;
+    void load(std::istream &in);
+
+  private:
+    // Map the hash value to a row without division
+    size_t get_row(uint64_t hash) const {
+        return ((static_cast<__uint128_t>(hash) * num_rows_) >> 64) * num_words();
+    }
+
+    size_t num_hash_functions_;
+    size_t num_columns_ = 0;
+    size_t num_rows_ = 0;
+    bool empty_ = true;
+    std::vector<uint64_t> rows_;
+};
+
 //typedef HashAnnotation<ExactFilter, std::string, DummyHasher> ExactHashAnnotation;
 
+// Exact annotation of k-mers. The distinct label sets (color classes) are
+// interned into a table and each k-mer keeps only the id of its class.
 class ExactHashAnnotation {
     public:
-    ExactHashAnnotation() : num_columns_(0) { }
+    ExactHashAnnotation() : num_columns_(0) { clear(); }
 
     template <typename T>
     std::vector<uint64_t> find(const T *begin, const T *end, long long i = -1) const {
@@ -396,16 +807,14 @@ class ExactHashAnnotation {
 
     std::vector<uint64_t> find(const std::string &kmer, long long i = -1) const {
         std::vector<uint64_t> annot((num_columns_ + 63) >> 6, 0);
-        auto it = kmer_map_.find(kmer);
-        if (it == kmer_map_.end())
-            return annot;
+        const auto &indices = find_indices(kmer);
         if (i == -1) {
-            for (auto &index : it->second) {
+            for (auto index : indices) {
                 set_bit(annot, index);
             }
         } else {
             assert(i >= 0);
-            if (it->second.find(static_cast<pos_t>(i)) != it->second.end())
+            if (std::binary_search(indices.begin(), indices.end(), static_cast<pos_t>(i)))
                 set_bit(annot, static_cast<pos_t>(i));
         }
         return annot;
@@ -416,16 +825,29 @@ class ExactHashAnnotation {
             num_columns_ = std::max(num_columns_, i + 1);
         }
         std::vector<uint64_t> annot((num_columns_ + 63) >> 6, 0);
-        auto &indices = kmer_map_[kmer];
+        auto &color = kmer_map_.emplace(kmer, 0).first->second;
         if (i < static_cast<pos_t>(-1)) {
-            indices.insert(i);
+            color = add_column(color, i);
         }
-        for (auto &index : indices) {
+        for (auto index : classes_[color]) {
             set_bit(annot, index);
         }
         return annot;
     }
 
+    // Set the sorted columns of the k-mer
+    void insert_row(const std::string &kmer, std::vector<pos_t>&& indices) {
+        if (indices.size())
+            num_columns_ = std::max(num_columns_, indices.back() + 1);
+        kmer_map_[kmer] = get_class(std::move(indices));
+    }
+
+    // The sorted columns of the k-mer, empty if it is not in the annotation
+    const std::vector<pos_t>& find_indices(const std::string &kmer) const {
+        auto it = kmer_map_.find(kmer);
+        return classes_[it != kmer_map_.end() ? it->second : 0];
+    }
+
     size_t size() const {
         return num_columns_;
     }
@@ -434,6 +856,10 @@ class ExactHashAnnotation {
         return kmer_map_.size();
     }
 
+    size_t num_classes() const {
+        return classes_.size();
+    }
+
     void resize(size_t size) {
         num_columns_ = size;
     }
@@ -459,9 +885,30 @@ class ExactHashAnnotation {
     friend class PreciseHashAnnotator;
 
   private:
-    typedef std::unordered_map<std::string, std::set<pos_t>> kmer_storage_t;
+    typedef uint32_t class_t;
+
+    // Remove all k-mers and classes but the empty one
+    void clear();
+
+    // The id of the class with the sorted columns |indices|, which is
+    // added to the table if it is new
+    class_t get_class(std::vector<pos_t>&& indices);
+
+    // The class of the columns of |color| and the column |i|
+    class_t add_column(class_t color, pos_t i);
+
+    typedef std::unordered_map<std::string, class_t> kmer_storage_t;
     kmer_storage_t kmer_map_;
     pos_t num_columns_;
+
+    // The sorted columns of each class, the first class is empty
+    std::vector<std::vector<pos_t>> classes_;
+    // The ids of the classes by the hashes of their columns, the columns
+    // themselves are only kept in classes_
+    std::unordered_multimap<uint64_t, class_t> class_ids_;
+    // Memoized add_column, by the class id in the upper and the column
+    // in the lower half
+    std::unordered_map<uint64_t, class_t> transitions_;
 };
 
 
@@ -39,6 +39,8 @@ Config::Config(int argc, const char *argv[]) {
             verbose = true;
         } else if (!strcmp(argv[i], "-r") || !strcmp(argv[i], "--reverse")) {
             reverse = true;
+        } else if (!strcmp(argv[i], "--canonical")) {
+            canonical = true;
         } else if (!strcmp(argv[i], "--fasta-anno")) {
             fasta_anno = true;
         } else if (!strcmp(argv[i], "-k") || !strcmp(argv[i], "--kmer-length")) {
@@ -47,16 +49,30 @@ Config::Config(int argc, const char *argv[]) {
             p = atoi(argv[++i]);
         } else if (!strcmp(argv[i], "--wavelet-trie")) {
             wavelet_trie = true;
+        } else if (!strcmp(argv[i], "--frozen-graph")) {
+            frozen_graph = true;
         } else if (!strcmp(argv[i], "--bloom-false-pos-prob")) {
             bloom_fpp = std::stof(argv[++i]);
         } else if (!strcmp(argv[i], "--bloom-bits-per-edge")) {
             bloom_bits_per_edge = std::stof(argv[++i]);
         } else if (!strcmp(argv[i], "--discovery-fraction")) {
             discovery_fraction = std::stof(argv[++i]);
+        } else if (!strcmp(argv[i], "--bloom-blocked")) {
+            bloom_blocked = true;
+        } else if (!strcmp(argv[i], "--bloom-sizing-pass")) {
+            bloom_sizing_pass = true;
+        } else if (!strcmp(argv[i], "--bloom-freeze")) {
+            bloom_freeze = true;
+        } else if (!strcmp(argv[i], "--bloom-bit-sliced")) {
+            bloom_bit_sliced = true;
         } else if (!strcmp(argv[i], "--bloom-hash-functions")) {
             bloom_num_hash_functions = atoi(argv[++i]);
         } else if (!strcmp(argv[i], "--bloom-test-num-kmers")) {
             bloom_test_num_kmers = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--index-set-memory")) {
+            index_set_memory = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--reorder-columns")) {
+            reorder_columns = true;
         } else if (!strcmp(argv[i], "--num-permutations")) {
             num_permutations = atoi(argv[++i]);
         } else if (!strcmp(argv[i], "-o") || !strcmp(argv[i], "--outfile-base")) {
@@ -103,6 +119,17 @@ Config::Config(int argc, const char *argv[]) {
     if (!fname.size() && infbase.empty())
         print_usage_and_exit = true;
 
+    if (index_set_memory && (outfbase.empty() || bloom_freeze || bloom_test_num_kmers)) {
+        std::cerr << "The index set built on disk needs an output file"
+                  << " and can't be used to freeze or test the Bloom filters" << std::endl;
+        print_usage_and_exit = true;
+    }
+
+    if (bloom_blocked && bloom_bit_sliced) {
+        std::cerr << "Only one Bloom filter layout can be chosen" << std::endl;
+        print_usage_and_exit = true;
+    }
+
     if (fasta_header_delimiter.size() > 1) {
         std::cerr << "FASTA header delimiter must be at most one character" << std::endl;
         print_usage_and_exit = true;
@@ -145,11 +172,19 @@ void Config::print_usage(const std::string &prog_name, IdentityType identity) {
             fprintf(stderr, "\t-k --kmer-length [INT] \t\t\tlength of the k-mer to use [3]\n");
             fprintf(stderr, "\t-p --parallel [INT] \t\t\tnumber of threads to use for wavelet trie compression [1]\n");
             fprintf(stderr, "\t   --wavelet-trie \t\t\tconstruct wavelet trie [off]\n");
+            fprintf(stderr, "\t   --reorder-columns \t\t\torder the columns greedily by the sampled rows each newly covers [off]\n");
+            fprintf(stderr, "\t   --frozen-graph \t\t\tstore the graph with a minimal perfect hash index [off]\n");
             fprintf(stderr, "\t   --bloom-false-pos-prob [FLOAT] \tFalse positive probability in bloom filter [-1]\n");
             fprintf(stderr, "\t   --bloom-bits-per-edge [FLOAT] \tBits per edge used in bloom filter annotator [0.4]\n");
             fprintf(stderr, "\t   --bloom-hash-functions [INT] \tNumber of hash functions used in bloom filter [off]\n");
+            fprintf(stderr, "\t   --bloom-blocked \t\t\tKeep the bits of each k-mer in one cache line [off]\n");
+            fprintf(stderr, "\t   --bloom-bit-sliced \t\t\tShare one filter between all columns [off]\n");
+            fprintf(stderr, "\t   --bloom-sizing-pass \t\t\tSize the filters from a first pass over the input [off]\n");
+            fprintf(stderr, "\t   --bloom-freeze \t\t\tConvert the filters into static ribbon filters [off]\n");
             fprintf(stderr, "\t   --bloom-test-num-kmers \t\tEstimate false positive rate for every n k-mers [0]\n");
+            fprintf(stderr, "\t   --index-set-memory [INT] \t\tBuild the index set on disk using this many MB of memory [off]\n");
             fprintf(stderr, "\t-r --reverse \t\t\t\tadd reverse complement reads [off]\n");
+            fprintf(stderr, "\t   --canonical \t\t\tindex k-mers together with their reverse complements [off]\n");
         } break;
         case UPDATE: {
             fprintf(stderr, "Usage: %s update [options] -i <graph_basename> FASTQ1 [[FASTQ2] ...]\n\n", prog_name.c_str());
@@ -165,19 +200,25 @@ void Config::print_usage(const std::string &prog_name, IdentityType identity) {
             fprintf(stderr, "\t-r --reverse \t\t\t\tadd reverse complement reads [off]\n");
         } break;
         case MAP: {
-            fprintf(stderr, "Usage: %s map [options] -i <graph_basename> k-mer [[k-mer] ...]\n\n", prog_name.c_str());
+            fprintf(stderr, "Usage: %s map [options] -i <graph_basename> k-mer|FASTQ [[k-mer|FASTQ] ...]\n\n", prog_name.c_str());
 
             fprintf(stderr, "Available options for map:\n");
             fprintf(stderr, "\t   --wavelet-trie \tuse wavelet trie for annotation [off]\n"
                             "\t                  \t                         default: Bloom filter\n");
             fprintf(stderr, "\t-i --infile-base [STR] \tinput colored graph basename\n");
-            // fprintf(stderr, "\t-p --parallel [INT] \tnumber of threads to use for wavelet trie compression [1]\n");
+            fprintf(stderr, "\t   --frozen-graph \tuse a minimal perfect hash index for the graph [off]\n"
+                            "\t                  \t(built on each run unless the graph was built with it)\n");
+            fprintf(stderr, "\t   --discovery-fraction [FLOAT] \tfraction of the k-mers of a read a label must annotate [1.0]\n"
+                            "\t                  \t(with the Bloom filter, the k-mer counts of the reads are\n"
+                            "\t                  \t uncorrected upper bounds including false positives)\n");
+            fprintf(stderr, "\t-p --parallel [INT] \tnumber of threads to use for querying [1]\n");
         } break;
         case PERMUTATION: {
             fprintf(stderr, "Usage: %s permutation [options] -i <graph_basename>\n\n", prog_name.c_str());
 
             fprintf(stderr, "Available options for permutation:\n");
             fprintf(stderr, "\t   --num-permutations \t\tnumber of column index permutations to test [0]\n");
+            fprintf(stderr, "\t   --reorder-columns \t\talso test the optimized column order [off]\n");
             fprintf(stderr, "\t-p --parallel [INT] \t\tnumber of threads (one permutation per thread) [1]\n");
             fprintf(stderr, "\t-i --infile-base [STR] \tinput colored graph basename\n");
         } break;
@@ -186,6 +227,9 @@ void Config::print_usage(const std::string &prog_name, IdentityType identity) {
             
             fprintf(stderr, "Available options for query:\n");
             fprintf(stderr, "\t-i --infile-base [STR] \tinput colored graph basename\n");
+            fprintf(stderr, "\t-p --parallel [INT] \tnumber of threads to use for querying [1]\n");
+            fprintf(stderr, "\t   --frozen-graph \tuse a minimal perfect hash index for the graph [off]\n"
+                            "\t                  \t(built on each run unless the graph was built with it)\n");
             fprintf(stderr, "\t   --wavelet-trie \tuse wavelet trie for annotation [off]\n"
                             "\t                  \t                         default: Bloom filter\n");
         } break;
@@ -203,6 +247,7 @@ void Config::print_usage(const std::string &prog_name, IdentityType identity) {
             fprintf(stderr, "Available options for compress:\n");
             fprintf(stderr, "\t-i --infile-base [STR] \tinput colored graph basename\n");
             fprintf(stderr, "\t-p --parallel [INT] \t\tnumber of threads (one permutation per thread) [1]\n");
+            fprintf(stderr, "\t   --reorder-columns \torder the columns greedily by the sampled rows each newly covers [off]\n");
         } break;
     }
 
@@ -11,8 +11,15 @@ class Config {
 
     bool verbose = false;
     bool reverse = false;
+    bool canonical = false;
     bool fasta_anno = false;
     bool wavelet_trie = false;
+    bool frozen_graph = false;
+    bool bloom_blocked = false;
+    bool bloom_bit_sliced = false;
+    bool bloom_sizing_pass = false;
+    bool bloom_freeze = false;
+    bool reorder_columns = false;
 
     unsigned int k = 3;
     unsigned int distance = 0;
@@ -21,6 +28,7 @@ class Config {
     unsigned int bloom_test_num_kmers = 0;
     unsigned int p = 1;
     unsigned int num_permutations = 0;
+    unsigned int index_set_memory = 0;
 
     double bloom_fpp = -1;
     double bloom_bits_per_edge = -1;
@@ -1,18 +1,54 @@
 #include "dbg_hash.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
 #include "serialization.hpp"
+#include "thread_pool.hpp"
 
 const std::string kAlphabet = "ACGTN$";
+const size_t kNumLabels = 6;
+
+constexpr uint32_t DBGHash::kLabelsMask;
+constexpr size_t DBGHash::kOutgoing;
+constexpr size_t DBGHash::kIncoming;
+constexpr size_t DBGHash::kNext;
+constexpr size_t DBGHash::kTarget;
+constexpr DBGHash::edge_index DBGHash::kReverse;
+constexpr size_t DBGHash::kMapBatchSize;
+
 
+// "DBGHASH" followed by the format version, stored in the native byte order.
+// The version 3 header also has the flags, the version 2 one doesn't.
+const uint64_t kFileMagic = 0x0348534148474244llu;
+const uint64_t kFileMagicV2 = 0x0248534148474244llu;
+const uint64_t kCanonicalFlag = 1;
 
 uint64_t DBGHash::serialize(std::ostream &out) const {
-    return serialization::serializeNumber(out, kmers_.size())
-         + serialization::serializeNumber(out, k_)
-         + serialization::serializeStringMap(out, indices_);
+    const uint64_t header[4] = { kFileMagic, k_, kmers_.size(),
+                                 canonical_ ? kCanonicalFlag : 0 };
+    uint64_t written_bytes = serialization::serializeRawArray(out, header, 4);
+    written_bytes += kmers_.serialize(out);
+    written_bytes += serialization::serializeRawArray(
+        out,
+        mapped_adjacency_ ? mapped_adjacency_ : adjacency_.data(),
+        kmers_.size()
+    );
+    return written_bytes;
 }
 
 uint64_t DBGHash::serialize(const std::string &filename) const {
-    std::ofstream out(filename);
-    return serialize(out);
+    // the graph may be mapped from this very file, so replace it
+    // only once the new one has been written
+    std::string temp_filename = filename + ".tmp";
+    std::ofstream out(temp_filename);
+    uint64_t written_bytes = serialize(out);
+    out.close();
+    if (std::rename(temp_filename.c_str(), filename.c_str())) {
+        std::cerr << "ERROR: can't write graph to " << filename << std::endl;
+        exit(1);
+    }
+    return written_bytes;
 }
 
 bool DBGHash::load(std::istream &in) {
@@ -20,14 +56,25 @@ bool DBGHash::load(std::istream &in) {
         return false;
 
     try {
-        size_t size = serialization::loadNumber(in);
-        k_ = serialization::loadNumber(in);
-        kmers_.resize(size);
-        indices_ = std::move(serialization::loadStringMap(in));
-        //kmers_.resize(indices_.size());
-        for (auto &kmer : indices_) {
-            kmers_[kmer.second] = &kmer.first;
-        }
+        auto header = serialization::loadRawArray<uint64_t>(in, 3);
+        if (header[0] != kFileMagic && header[0] != kFileMagicV2)
+            return false;
+
+        uint64_t flags = header[0] == kFileMagic
+                            ? serialization::loadRawArray<uint64_t>(in, 1)[0]
+                            : 0;
+
+        memory_map_.reset();
+        mapped_adjacency_ = NULL;
+
+        k_ = header[1];
+        canonical_ = flags & kCanonicalFlag;
+        kmers_ = KMerHashTable(k_ + 1);
+        kmers_.load(in);
+        if (kmers_.size() != header[2])
+            return false;
+
+        adjacency_ = serialization::loadRawArray<uint32_t>(in, kmers_.size());
         return true;
     } catch (...) {
         return false;
@@ -35,8 +82,43 @@ bool DBGHash::load(std::istream &in) {
 }
 
 bool DBGHash::load(const std::string &filename) {
-    std::ifstream in(filename);
-    return load(in);
+    try {
+        auto memory_map = std::make_shared<utils::MemoryMap>(filename);
+        const char *data = memory_map->data();
+        const char *end = data + memory_map->size();
+
+        const uint64_t *header = serialization::mapRawArray<uint64_t>(data, end, 3);
+        if (header[0] != kFileMagic && header[0] != kFileMagicV2)
+            return false;
+
+        uint64_t flags = header[0] == kFileMagic
+                            ? *serialization::mapRawArray<uint64_t>(data, end, 1)
+                            : 0;
+
+        k_ = header[1];
+        canonical_ = flags & kCanonicalFlag;
+        kmers_ = KMerHashTable(k_ + 1);
+        data = kmers_.map(data, end);
+        if (kmers_.size() != header[2])
+            return false;
+
+        adjacency_.clear();
+        mapped_adjacency_ = serialization::mapRawArray<uint32_t>(data, end, kmers_.size());
+        memory_map_ = memory_map;
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
+
+void DBGHash::unmap() {
+    if (!memory_map_)
+        return;
+
+    kmers_.unmap();
+    adjacency_.assign(mapped_adjacency_, mapped_adjacency_ + kmers_.size());
+    mapped_adjacency_ = NULL;
+    memory_map_.reset();
 }
 
 std::string DBGHash::encode_sequence(const std::string &sequence) const {
@@ -50,35 +132,42 @@ std::string DBGHash::encode_sequence(const std::string &sequence) const {
 }
 
 std::string DBGHash::get_node_kmer(edge_index i) const {
-    std::string kmer = *kmers_[i];
-    kmer.pop_back();
-    return kmer;
+    return get_kmer(i).to_string(k_);
 }
 
-bool DBGHash::has_the_only_outgoing_edge(edge_index i) const {
-    std::string kmer = *kmers_[i];
+KMer DBGHash::get_kmer(edge_index i) const {
+    KMer kmer = kmers_[i & ~kReverse];
+    if (i & kReverse)
+        kmer.reverse_complement(k_ + 1);
+    return kmer;
+}
 
-    size_t num_edges = 0;
-    for (char c : kAlphabet) {
-        kmer.back() = c;
-        num_edges += (indices_.find(kmer) != indices_.end());
-    }
+bool DBGHash::canonicalize(KMer *kmer) const {
+    KMer reverse = *kmer;
+    reverse.reverse_complement(k_ + 1);
+    if (!(reverse < *kmer))
+        return false;
 
-    return num_edges == 1;
+    *kmer = reverse;
+    return true;
 }
 
-bool DBGHash::has_the_only_incoming_edge(edge_index i) const {
-    std::string kmer("$");
-    kmer += *kmers_[i];
-    kmer.pop_back();
-
-    size_t num_edges = 0;
-    for (char c : kAlphabet) {
-        kmer.front() = c;
-        num_edges += (indices_.find(kmer) != indices_.end());
-    }
+DBGHash::edge_index DBGHash::find_edge(KMer kmer) const {
+    bool reversed = canonical_ && canonicalize(&kmer);
+    edge_index i = kmers_.find(kmer);
+    return i != KMerHashTable::npos && reversed ? i | kReverse : i;
+}
 
-    return num_edges == 1;
+uint32_t DBGHash::reverse_adjacency(uint32_t adjacency) {
+    // complement the labels: A <-> T, C <-> G
+    auto complement = [](uint32_t labels) {
+        return (labels & 0x21) | ((labels & 0x02) << 3) | ((labels & 0x10) >> 3)
+                               | ((labels & 0x04) << 1) | ((labels & 0x08) >> 1);
+    };
+    return complement((adjacency >> kTarget) & kLabelsMask) << kOutgoing
+         | complement((adjacency >> kNext) & kLabelsMask) << kIncoming
+         | complement((adjacency >> kIncoming) & kLabelsMask) << kNext
+         | complement((adjacency >> kOutgoing) & kLabelsMask) << kTarget;
 }
 
 bool DBGHash::is_dummy_edge(const std::string &kmer) const {
@@ -95,63 +184,360 @@ bool DBGHash::is_dummy_label(char c) const {
 }
 
 DBGHash::edge_index DBGHash::next_edge(edge_index i, char edge_label) const {
-    std::string kmer = *kmers_[i];
-    kmer.back() = edge_label;
+    uint32_t adjacency = get_adjacency(i);
+    KMer kmer = get_kmer(i);
+    uint8_t label = KMer::encode(edge_label);
 
-    kmer.erase(kmer.begin());
-    kmer.push_back('$');
+    // step from the target of the sibling edge with |edge_label|
+    uint32_t next = adjacency >> kNext;
+    if (label != kmer[k_]) {
+        kmer.set(k_, label);
+        next = adjacency & (1u << (kOutgoing + label))
+            ? get_adjacency(find_edge(kmer)) >> kNext
+            // without the sibling edge, any edge from its target is checked
+            : kLabelsMask;
+    }
+    kmer.shift_forward(k_ + 1, 0);
 
     for (char c : kAlphabet) {
-        kmer.back() = c;
-        auto it = indices_.find(kmer);
-        if (it != indices_.end())
-            return it->second;
+        uint8_t code = KMer::encode(c);
+        if (next & (1u << code)) {
+            kmer.set(k_, code);
+            edge_index j = find_edge(kmer);
+            if (j != npos)
+                return j;
+        }
     }
     assert(false && "Can't traverse if there are no outgoing edges");
     return 0;
 }
 
 DBGHash::edge_index DBGHash::prev_edge(edge_index i) const {
-    std::string kmer("$");
-    kmer += *kmers_[i];
-    kmer.pop_back();
+    uint32_t prev = get_adjacency(i) >> kIncoming;
+    KMer kmer = get_kmer(i);
+    kmer.shift_backward(k_ + 1, 0);
 
     for (char c : kAlphabet) {
-        kmer.front() = c;
-        auto it = indices_.find(kmer);
-        if (it != indices_.end())
-            return it->second;
+        uint8_t code = KMer::encode(c);
+        if (prev & (1u << code)) {
+            kmer.set(0, code);
+            return find_edge(kmer);
+        }
     }
     assert(false && "Can't traverse if there are not incoming edges");
     return 0;
 }
 
+void DBGHash::get_outgoing_edges(edge_index i, std::vector<edge_index> &edges) const {
+    edges.clear();
+
+    uint32_t next = get_adjacency(i) >> kNext;
+    if (!(next & kLabelsMask))
+        return;
+
+    KMer kmer = get_kmer(i);
+    kmer.shift_forward(k_ + 1, 0);
+
+    for (char c : kAlphabet) {
+        uint8_t code = KMer::encode(c);
+        if (next & (1u << code)) {
+            kmer.set(k_, code);
+            edges.push_back(find_edge(kmer));
+            assert(edges.back() != KMerHashTable::npos);
+        }
+    }
+}
+
+void DBGHash::get_incoming_edges(edge_index i, std::vector<edge_index> &edges) const {
+    edges.clear();
+
+    uint32_t prev = get_adjacency(i) >> kIncoming;
+    if (!(prev & kLabelsMask))
+        return;
+
+    KMer kmer = get_kmer(i);
+    kmer.shift_backward(k_ + 1, 0);
+
+    for (char c : kAlphabet) {
+        uint8_t code = KMer::encode(c);
+        if (prev & (1u << code)) {
+            kmer.set(0, code);
+            edges.push_back(find_edge(kmer));
+            assert(edges.back() != KMerHashTable::npos);
+        }
+    }
+}
+
+void DBGHash::link_edge(edge_index i) {
+    assert(kAlphabet.size() == kNumLabels);
+    const KMer kmer = kmers_[i];
+
+    // edges sharing the source k-mer, incoming to the source k-mer,
+    // outgoing from the target k-mer, and sharing the target k-mer
+    const size_t num_kinds = canonical_ ? 4 : 3;
+    KMer neighbours[4 * kNumLabels];
+    KMer source_prev = kmer;
+    source_prev.shift_backward(k_ + 1, 0);
+    KMer target_next = kmer;
+    target_next.shift_forward(k_ + 1, 0);
+    for (uint8_t code = 0; code < kNumLabels; ++code) {
+        neighbours[code] = kmer;
+        neighbours[code].set(k_, code);
+        neighbours[kNumLabels + code] = source_prev;
+        neighbours[kNumLabels + code].set(0, code);
+        neighbours[2 * kNumLabels + code] = target_next;
+        neighbours[2 * kNumLabels + code].set(k_, code);
+        neighbours[3 * kNumLabels + code] = kmer;
+        neighbours[3 * kNumLabels + code].set(0, code);
+    }
+
+    // the neighbours stored as their reverse complements get
+    // the bits of this edge in that orientation
+    bool reversed[4 * kNumLabels] = {};
+    for (size_t j = 0; canonical_ && j < num_kinds * kNumLabels; ++j) {
+        reversed[j] = canonicalize(&neighbours[j]);
+    }
+
+    edge_index indices[4 * kNumLabels];
+    kmers_.find(neighbours, num_kinds * kNumLabels, indices);
+
+    const uint32_t shifts[4] = { kOutgoing, kIncoming, kNext, kTarget };
+    // the bit this edge sets in the masks of each kind of neighbour
+    const uint32_t bits[4] = { (1u << kmer[k_]) << kOutgoing,
+                               (1u << kmer[k_]) << kNext,
+                               (1u << kmer[0]) << kIncoming,
+                               (1u << kmer[0]) << kTarget };
+    uint32_t mask = 0;
+    for (size_t t = 0; t < num_kinds; ++t) {
+        for (uint8_t code = 0; code < kNumLabels; ++code) {
+            size_t j = t * kNumLabels + code;
+            if (indices[j] != KMerHashTable::npos) {
+                mask |= (1u << code) << shifts[t];
+                __sync_fetch_and_or(&adjacency_[indices[j]],
+                                    reversed[j] ? reverse_adjacency(bits[t]) : bits[t]);
+            }
+        }
+    }
+
+    __sync_fetch_and_or(&adjacency_[i], mask);
+}
+
 std::string DBGHash::transform_sequence(const std::string &sequence, bool rooted) const {
     return (!rooted ? std::string(k_ + 1, '$') : std::string())
         + encode_sequence(sequence)
         + (!rooted ? std::string(1, '$') : std::string());
 }
 
+void DBGHash::map_kmers(const std::string &sequence, edge_index *indices) const {
+    if (sequence.size() < k_ + 1)
+        return;
+
+    auto encode = [](char c) {
+        uint8_t code = KMer::encode(c);
+        return code != KMer::kInvalidCode ? code : KMer::encode('N');
+    };
+
+    KMer kmer;
+    for (size_t i = 0; i < k_; ++i) {
+        kmer.set(i, encode(sequence[i]));
+    }
+    // the reverse complement is rolled along in graphs of canonical k-mers
+    KMer reverse;
+
+    KMer batch[kMapBatchSize];
+    size_t num_kmers = sequence.size() - k_;
+    for (size_t begin = 0; begin < num_kmers; begin += kMapBatchSize) {
+        size_t batch_size = std::min(kMapBatchSize, num_kmers - begin);
+        for (size_t j = 0; j < batch_size; ++j) {
+            if (begin + j) {
+                uint8_t code = encode(sequence[begin + j + k_]);
+                kmer.shift_forward(k_ + 1, code);
+                if (canonical_)
+                    reverse.shift_backward(k_ + 1, KMer::complement(code));
+            } else {
+                kmer.set(k_, encode(sequence[k_]));
+                reverse = kmer;
+                reverse.reverse_complement(k_ + 1);
+            }
+            batch[j] = canonical_ && reverse < kmer ? reverse : kmer;
+        }
+        kmers_.find(batch, batch_size, indices + begin);
+    }
+}
+
 void DBGHash::add_sequence(const std::string &sequence, bool rooted) {
     // Don't annotate short sequences
     if (sequence.size() < k_ + 1)
         return;
 
+    unmap();
+
     std::string transformed_seq = transform_sequence(sequence, rooted);
-   
-    for (size_t i = 0; i + k_ < transformed_seq.size(); ++i) {
-        std::string kmer = transformed_seq.substr(i, k_ + 1);
-        /*
-        if (indices_.find(kmer) == indices_.end()) {
-            indices_[kmer] = kmers_.size();
-            kmers_.push_back(kmer);
+
+    KMer kmer;
+    KMer reverse;
+    kmer.pack(transformed_seq.data(), k_);
+    for (size_t i = k_; i < transformed_seq.size(); ++i) {
+        uint8_t code = KMer::encode(transformed_seq[i]);
+        if (i > k_) {
+            kmer.shift_forward(k_ + 1, code);
+            if (canonical_)
+                reverse.shift_backward(k_ + 1, KMer::complement(code));
+        } else {
+            kmer.set(k_, code);
+            reverse = kmer;
+            reverse.reverse_complement(k_ + 1);
+        }
+        auto inserted = kmers_.emplace(canonical_ && reverse < kmer ? reverse : kmer);
+        if (inserted.second) {
+            adjacency_.push_back(0);
+            link_edge(inserted.first);
+        }
+    }
+}
+
+void DBGHash::add_sequences(const std::vector<std::string> &sequences,
+                            size_t num_threads,
+                            bool rooted) {
+    unmap();
+
+    if (num_threads <= 1) {
+        for (const auto &sequence : sequences) {
+            add_sequence(sequence, rooted);
         }
-        */
-        auto index_insert = indices_.emplace(kmer, kmers_.size());
-        if (index_insert.second) {
-            kmers_.push_back(&(index_insert.first->first));
+        return;
+    }
+
+    // k-mers are referenced by their (sequence, last character) positions,
+    // which also define the order of insertion
+    typedef std::pair<size_t, size_t> Occurrence;
+
+    const size_t num_words = KMer::num_words(k_ + 1);
+    const size_t num_blocks = num_threads * 4;
+    size_t num_shards = 1;
+    while (num_shards < num_blocks) {
+        num_shards *= 2;
+    }
+    auto get_shard = [&](const KMer &kmer) {
+        return (kmer.hash(num_words) >> 32) & (num_shards - 1);
+    };
+
+    std::vector<std::string> transformed(sequences.size());
+    auto get_kmer = [&](const Occurrence &occurrence) {
+        KMer kmer;
+        kmer.pack(&transformed[occurrence.first][occurrence.second - k_], k_ + 1);
+        if (canonical_)
+            canonicalize(&kmer);
+        return kmer;
+    };
+
+    // split the batch into chunks of roughly equal total length
+    size_t total_length = 0;
+    for (const auto &sequence : sequences) {
+        total_length += sequence.size();
+    }
+    std::vector<size_t> chunks { 0 };
+    size_t chunk_length = 0;
+    for (size_t i = 0; i < sequences.size(); ++i) {
+        chunk_length += sequences[i].size();
+        if (chunk_length * num_blocks >= total_length && i + 1 < sequences.size()) {
+            chunks.push_back(i + 1);
+            chunk_length = 0;
         }
     }
+    chunks.push_back(sequences.size());
+
+    utils::ThreadPool thread_pool(num_threads);
+
+    // 1. collect the first occurrences of new k-mers within each chunk
+    std::vector<std::vector<std::vector<Occurrence>>> chunk_kmers(
+        chunks.size() - 1, std::vector<std::vector<Occurrence>>(num_shards)
+    );
+    for (size_t c = 0; c + 1 < chunks.size(); ++c) {
+        thread_pool.enqueue([&, c]() {
+            KMerHashTable chunk_table(k_ + 1);
+            for (size_t s = chunks[c]; s < chunks[c + 1]; ++s) {
+                if (sequences[s].size() < k_ + 1)
+                    continue;
+
+                transformed[s] = transform_sequence(sequences[s], rooted);
+                const std::string &sequence = transformed[s];
+
+                KMer kmer;
+                KMer reverse;
+                kmer.pack(sequence.data(), k_);
+                for (size_t i = k_; i < sequence.size(); ++i) {
+                    uint8_t code = KMer::encode(sequence[i]);
+                    if (i > k_) {
+                        kmer.shift_forward(k_ + 1, code);
+                        if (canonical_)
+                            reverse.shift_backward(k_ + 1, KMer::complement(code));
+                    } else {
+                        kmer.set(k_, code);
+                        reverse = kmer;
+                        reverse.reverse_complement(k_ + 1);
+                    }
+                    const KMer &key = canonical_ && reverse < kmer ? reverse : kmer;
+                    if (kmers_.find(key) == KMerHashTable::npos
+                            && chunk_table.emplace(key).second)
+                        chunk_kmers[c][get_shard(key)].emplace_back(s, i);
+                }
+            }
+        });
+    }
+    thread_pool.join();
+
+    // 2. merge the chunks within each shard, keeping the first occurrences.
+    // Chunks are processed in order, so the result remains sorted.
+    std::vector<std::vector<Occurrence>> shard_kmers(num_shards);
+    for (size_t shard = 0; shard < num_shards; ++shard) {
+        thread_pool.enqueue([&, shard]() {
+            KMerHashTable shard_table(k_ + 1);
+            for (auto &kmers : chunk_kmers) {
+                for (const auto &occurrence : kmers[shard]) {
+                    if (shard_table.emplace(get_kmer(occurrence)).second)
+                        shard_kmers[shard].push_back(occurrence);
+                }
+                std::vector<Occurrence>().swap(kmers[shard]);
+            }
+        });
+    }
+    thread_pool.join();
+
+    // 3. order the new k-mers as the serial construction would insert them
+    std::vector<Occurrence> new_kmers;
+    for (auto &kmers : shard_kmers) {
+        new_kmers.insert(new_kmers.end(), kmers.begin(), kmers.end());
+        std::vector<Occurrence>().swap(kmers);
+    }
+    std::sort(new_kmers.begin(), new_kmers.end());
+
+    // 4. insert them and link with their neighbours
+    const size_t old_size = kmers_.size();
+    kmers_.resize(old_size + new_kmers.size());
+    adjacency_.resize(old_size + new_kmers.size(), 0);
+
+    const size_t block_size = (new_kmers.size() + num_blocks - 1) / num_blocks;
+    for (size_t begin = 0; begin < new_kmers.size(); begin += block_size) {
+        thread_pool.enqueue([&, begin]() {
+            size_t end = std::min(begin + block_size, new_kmers.size());
+            for (size_t i = begin; i < end; ++i) {
+                kmers_.set(old_size + i, get_kmer(new_kmers[i]));
+                kmers_.insert_index(old_size + i);
+            }
+        });
+    }
+    thread_pool.join();
+
+    for (size_t begin = 0; begin < new_kmers.size(); begin += block_size) {
+        thread_pool.enqueue([&, begin]() {
+            size_t end = std::min(begin + block_size, new_kmers.size());
+            for (size_t i = begin; i < end; ++i) {
+                link_edge(old_size + i);
+            }
+        });
+    }
+    thread_pool.join();
 }
 
 size_t DBGHash::get_num_edges() const {
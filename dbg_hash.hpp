@@ -2,30 +2,66 @@
 #define __DBG_HASH_HPP__
 
 #include <fstream>
-#include <unordered_map>
+#include <memory>
 
 #include "dbg_bloom_annotator.hpp"
+#include "kmer.hpp"
+#include "utils.hpp"
 
 
+/**
+ * In graphs of canonical k-mers, each k-mer is stored together with its
+ * reverse complement, and the edges from first_edge() to last_edge()
+ * are these pairs. map_kmer() maps both k-mers to the same edge. The
+ * traversal can also lead to the reverse complement orientations of the
+ * stored k-mers, which get their indices with kReverse set.
+ */
 class DBGHash : public hash_annotate::DeBruijnGraphWrapper {
   public:
-    DBGHash(const size_t k) : k_(k) {}
+    static constexpr edge_index kReverse = edge_index(1) << 63;
+
+    DBGHash(const size_t k, bool canonical = false)
+          : k_(k), canonical_(canonical), kmers_(k + 1) {}
 
     size_t get_k() const { return k_; }
 
+    bool is_canonical() const { return canonical_; }
+
+    edge_index get_edge_id(edge_index i) const { return i & ~kReverse; }
+
     edge_index first_edge() const { return 0; }
-    edge_index last_edge() const { return indices_.size() - 1; }
+    edge_index last_edge() const { return kmers_.size() - 1; }
 
     std::string encode_sequence(const std::string &sequence) const;
 
     std::string get_node_kmer(edge_index i) const;
 
-    char get_edge_label(edge_index i) const { return kmers_[i]->back(); }
+    char get_edge_label(edge_index i) const {
+        return KMer::decode(i & kReverse
+            ? KMer::complement(kmers_.get_code(i & ~kReverse, 0))
+            : kmers_.get_code(i, k_)
+        );
+    }
 
     // Check if the source k-mer for this edge has the only outgoing edge
-    bool has_the_only_outgoing_edge(edge_index i) const;
+    bool has_the_only_outgoing_edge(edge_index i) const {
+        return get_outdegree(i) == 1;
+    }
 
-    bool has_the_only_incoming_edge(edge_index i) const;
+    bool has_the_only_incoming_edge(edge_index i) const {
+        return get_indegree(i) == 1;
+    }
+
+    size_t get_outdegree(edge_index i) const {
+        return __builtin_popcount(get_adjacency(i) & (kLabelsMask << kOutgoing));
+    }
+
+    size_t get_indegree(edge_index i) const {
+        return __builtin_popcount(get_adjacency(i) & (kLabelsMask << kIncoming));
+    }
+
+    void get_outgoing_edges(edge_index i, std::vector<edge_index> &edges) const;
+    void get_incoming_edges(edge_index i, std::vector<edge_index> &edges) const;
 
     bool is_dummy_edge(const std::string &kmer) const;
     bool is_dummy_label(char edge_label) const;
@@ -39,29 +75,95 @@ class DBGHash : public hash_annotate::DeBruijnGraphWrapper {
             throw std::runtime_error("Incompatible k-mer size");
         }
 
-        auto find = indices_.find(kmer);
-        if (find == indices_.end())
+        KMer packed;
+        if (!packed.pack(kmer.data(), kmer.length()))
             return -1;
 
-        return find->second;
+        if (canonical_)
+            canonicalize(&packed);
+
+        return kmers_.find(packed);
     }
 
+    // Map the k-mers with a rolling window, looking them up in batches
+    void map_kmers(const std::string &sequence, edge_index *indices) const;
+
     void add_sequence(const std::string &sequence, bool rooted = false);
 
+    // Add a batch of sequences using |num_threads| threads. The edges get
+    // the same indices as when adding the sequences one by one in order.
+    void add_sequences(const std::vector<std::string> &sequences,
+                       size_t num_threads,
+                       bool rooted = false);
+
     size_t get_num_edges() const;
 
     uint64_t serialize(std::ostream &out) const;
     uint64_t serialize(const std::string &filename) const;
 
+    // Replace the k-mer hash table with a minimal perfect hash function
+    // to save space. The graph can still be modified, but that rebuilds
+    // the hash table.
+    void freeze() { kmers_.freeze(); }
+    bool is_frozen() const { return kmers_.is_frozen(); }
+
     bool load(std::istream &in);
+    // Map the graph file into memory and use it in place. The graph is
+    // copied into memory only if it gets modified.
     bool load(const std::string &filename);
 
     std::string transform_sequence(const std::string &sequence, bool rooted = false) const;
 
   private:
+    uint32_t get_adjacency(edge_index i) const {
+        uint32_t adjacency = mapped_adjacency_ ? mapped_adjacency_[i & ~kReverse]
+                                               : adjacency_[i & ~kReverse];
+        return i & kReverse ? reverse_adjacency(adjacency) : adjacency;
+    }
+
+    // The k-mer of the edge in its orientation
+    KMer get_kmer(edge_index i) const;
+
+    // Replace the k-mer with its reverse complement if that one is
+    // the canonical k-mer. Returns true if it was replaced.
+    bool canonicalize(KMer *kmer) const;
+
+    // Get the edge of the k-mer in any orientation, or npos if missing
+    edge_index find_edge(KMer kmer) const;
+
+    // The adjacency masks of the reverse complement of the k-mer
+    static uint32_t reverse_adjacency(uint32_t adjacency);
+
+    // Copy the memory-mapped graph into memory before modifying it
+    void unmap();
+
+    // Set the adjacency masks of a newly inserted edge and add it
+    // to the masks of its neighbours. The masks are updated atomically,
+    // so edges can be linked from several threads at once.
+    void link_edge(edge_index i);
+
+    // Each edge keeps three bitmasks indexed by the codes of the last/first
+    // character: edges sharing its source k-mer (the outgoing edges of
+    // the source), edges incoming to its source k-mer, and edges outgoing
+    // from its target k-mer. The graphs of canonical k-mers also keep the
+    // edges sharing the target k-mer, which are the outgoing edges of the
+    // source in the reverse complement orientation.
+    static constexpr uint32_t kLabelsMask = 0x3F;
+    static constexpr size_t kOutgoing = 0;
+    static constexpr size_t kIncoming = 8;
+    static constexpr size_t kNext = 16;
+    static constexpr size_t kTarget = 24;
+
+    // Number of k-mers looked up at once in map_kmers
+    static constexpr size_t kMapBatchSize = 64;
+
     size_t k_;
-    std::unordered_map<std::string, size_t> indices_;
-    std::vector<const std::string*> kmers_;
+    bool canonical_;
+    KMerHashTable kmers_;
+    std::vector<uint32_t> adjacency_;
+
+    std::shared_ptr<utils::MemoryMap> memory_map_;
+    const uint32_t *mapped_adjacency_ = NULL;
 };
 
 
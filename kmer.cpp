@@ -0,0 +1,353 @@
+#include "kmer.hpp"
+
+#include <cassert>
+#include <algorithm>
+#include <stdexcept>
+
+#include "kmer_mphf.hpp"
+#include "serialization.hpp"
+
+
+constexpr size_t KMer::kBitsPerChar;
+constexpr size_t KMer::kCharsPerWord;
+constexpr size_t KMer::kMaxWords;
+constexpr size_t KMer::kMaxLength;
+constexpr uint8_t KMer::kInvalidCode;
+constexpr uint64_t KMer::kDefaultSeed;
+constexpr uint64_t KMerHashTable::npos;
+constexpr size_t KMerHashTable::kIndexBits;
+constexpr uint64_t KMerHashTable::kIndexMask;
+
+const char KMer::kCodeToChar[8] = { '$', 'A', 'C', 'G', 'T', 'N', '?', '?' };
+const uint8_t KMer::kComplement[8] = { 0, 4, 3, 2, 1, 5, 6, 7 };
+
+uint8_t KMer::encode(char c) {
+    switch (c) {
+        case '$': return 0;
+        case 'A': return 1;
+        case 'C': return 2;
+        case 'G': return 3;
+        case 'T': return 4;
+        case 'N': return 5;
+        default: return kInvalidCode;
+    }
+}
+
+bool KMer::pack(const char *begin, size_t length) {
+    assert(length <= kMaxLength);
+    std::fill(words_, words_ + kMaxWords, 0);
+    for (size_t i = 0; i < length; ++i) {
+        uint8_t code = encode(begin[i]);
+        if (code == kInvalidCode)
+            return false;
+        set(i, code);
+    }
+    return true;
+}
+
+void KMer::reverse_complement(size_t length) {
+    for (size_t i = 0, j = length; i < j--; ++i) {
+        uint8_t first = operator[](i);
+        set(i, complement(operator[](j)));
+        set(j, complement(first));
+    }
+}
+
+void KMer::shift_forward(size_t length, uint8_t code) {
+    assert(length);
+    size_t last_word = num_words(length) - 1;
+    for (size_t w = 0; w < last_word; ++w) {
+        words_[w] = (words_[w] >> kBitsPerChar)
+                  | ((words_[w + 1] & 7) << (kBitsPerChar * (kCharsPerWord - 1)));
+    }
+    words_[last_word] >>= kBitsPerChar;
+    set(length - 1, code);
+}
+
+void KMer::shift_backward(size_t length, uint8_t code) {
+    assert(length);
+    const word_type mask = (word_type(1) << (kBitsPerChar * kCharsPerWord)) - 1;
+    size_t words = num_words(length);
+    for (size_t w = words - 1; w > 0; --w) {
+        words_[w] = ((words_[w] << kBitsPerChar) & mask)
+                  | (words_[w - 1] >> (kBitsPerChar * (kCharsPerWord - 1)));
+    }
+    words_[0] = ((words_[0] << kBitsPerChar) & mask) | code;
+    if (length < words * kCharsPerWord)
+        set(length, 0);
+}
+
+std::string KMer::to_string(size_t length) const {
+    std::string kmer(length, '$');
+    for (size_t i = 0; i < length; ++i) {
+        kmer[i] = decode(operator[](i));
+    }
+    return kmer;
+}
+
+uint64_t KMer::hash(const word_type *words, size_t num_words, uint64_t seed) {
+    uint64_t h = seed;
+    for (size_t i = 0; i < num_words; ++i) {
+        h ^= words[i];
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdllu;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53llu;
+        h ^= h >> 33;
+    }
+    return h;
+}
+
+
+KMerHashTable::KMerHashTable(size_t length)
+      : length_(length), num_words_(KMer::num_words(length)) {
+    if (length_ > KMer::kMaxLength) {
+        throw std::runtime_error("k-mer is too long to be packed");
+    }
+}
+
+void KMerHashTable::find(const KMer *kmers, size_t num, uint64_t *indices) const {
+    if (is_frozen()) {
+        for (size_t j = 0; j < num; ++j) {
+            indices[j] = find(kmers[j], 0);
+        }
+        return;
+    }
+
+    if (!num_slots()) {
+        std::fill(indices, indices + num, npos);
+        return;
+    }
+
+    const uint64_t *slots = slots_data();
+    size_t mask = num_slots() - 1;
+    for (size_t j = 0; j < num; ++j) {
+        indices[j] = kmers[j].hash(num_words_);
+        __builtin_prefetch(&slots[indices[j] & mask]);
+    }
+    for (size_t j = 0; j < num; ++j) {
+        indices[j] = find(kmers[j], indices[j]);
+    }
+}
+
+// Read the i-th integer of width |width| from a bit-packed array
+static uint64_t get_packed(const uint64_t *array, uint64_t i, size_t width) {
+    uint64_t pos = i * width;
+    uint64_t value = array[pos / 64] >> (pos % 64);
+    if (pos % 64 + width > 64)
+        value |= array[pos / 64 + 1] << (64 - pos % 64);
+    return width < 64 ? value & ((uint64_t(1) << width) - 1) : value;
+}
+
+static void set_packed(uint64_t *array, uint64_t i, size_t width, uint64_t value) {
+    uint64_t pos = i * width;
+    array[pos / 64] |= value << (pos % 64);
+    if (pos % 64 + width > 64)
+        array[pos / 64 + 1] |= value >> (64 - pos % 64);
+}
+
+uint64_t KMerHashTable::find(const KMer &kmer, uint64_t hash) const {
+    if (is_frozen()) {
+        uint64_t value = (*mphf_)(kmer);
+        if (value >= size())
+            return npos;
+
+        uint64_t i = get_packed(slots_data(), value, permutation_width_);
+        return equal(i, kmer) ? i : npos;
+    }
+
+    if (!num_slots())
+        return npos;
+
+    const uint64_t *slots = slots_data();
+    size_t mask = num_slots() - 1;
+    for (size_t i = hash & mask; slots[i]; i = (i + 1) & mask) {
+        if (!((slots[i] ^ hash) & ~kIndexMask) && equal(get_index(slots[i]), kmer))
+            return get_index(slots[i]);
+    }
+    return npos;
+}
+
+std::pair<uint64_t, bool> KMerHashTable::emplace(const KMer &kmer) {
+    unmap();
+    thaw();
+
+    // keep the load factor below 0.7
+    if ((size() + 1) * 10 > slots_.size() * 7)
+        rehash(std::max(slots_.size() * 2, size_t(16)));
+
+    uint64_t hash = kmer.hash(num_words_);
+    size_t mask = slots_.size() - 1;
+    size_t i = hash & mask;
+    for (; slots_[i]; i = (i + 1) & mask) {
+        if (!((slots_[i] ^ hash) & ~kIndexMask) && equal(get_index(slots_[i]), kmer))
+            return std::make_pair(get_index(slots_[i]), false);
+    }
+    uint64_t index = size();
+    assert(index < kIndexMask);
+    kmers_.insert(kmers_.end(), kmer.data(), kmer.data() + num_words_);
+    slots_[i] = make_slot(hash, index);
+    return std::make_pair(index, true);
+}
+
+KMer KMerHashTable::operator[](uint64_t i) const {
+    assert(i < size());
+    KMer kmer;
+    const KMer::word_type *begin = kmers_data() + i * num_words_;
+    std::copy(begin, begin + num_words_, kmer.data());
+    return kmer;
+}
+
+void KMerHashTable::reserve(size_t size) {
+    unmap();
+    thaw();
+    kmers_.reserve(size * num_words_);
+    size_t capacity = 16;
+    while (size * 10 > capacity * 7) {
+        capacity *= 2;
+    }
+    if (capacity > slots_.size())
+        rehash(capacity);
+}
+
+void KMerHashTable::resize(size_t size) {
+    assert(size >= this->size());
+    reserve(size);
+    kmers_.resize(size * num_words_);
+}
+
+void KMerHashTable::insert_index(uint64_t index) {
+    assert(!mapped_ && !is_frozen());
+    assert(index < size());
+    size_t mask = slots_.size() - 1;
+    uint64_t hash = KMer::hash(&kmers_[index * num_words_], num_words_);
+    size_t i = hash & mask;
+    while (__atomic_load_n(&slots_[i], __ATOMIC_RELAXED)
+            || !__sync_bool_compare_and_swap(&slots_[i], 0, make_slot(hash, index))) {
+        i = (i + 1) & mask;
+    }
+}
+
+void KMerHashTable::rehash(size_t capacity) {
+    assert(!(capacity & (capacity - 1)));
+    slots_.assign(capacity, 0);
+    size_t mask = capacity - 1;
+    for (uint64_t index = 0; index < size(); ++index) {
+        uint64_t hash = KMer::hash(&kmers_[index * num_words_], num_words_);
+        size_t i = hash & mask;
+        while (slots_[i]) {
+            i = (i + 1) & mask;
+        }
+        slots_[i] = make_slot(hash, index);
+    }
+}
+
+void KMerHashTable::unmap() {
+    if (!mapped_)
+        return;
+
+    kmers_.assign(mapped_kmers_, mapped_kmers_ + mapped_size_ * num_words_);
+    if (mapped_slots_)
+        slots_.assign(mapped_slots_, mapped_slots_ + mapped_num_slots_);
+    mapped_ = false;
+    mapped_kmers_ = NULL;
+    mapped_slots_ = NULL;
+    mapped_size_ = 0;
+    mapped_num_slots_ = 0;
+}
+
+void KMerHashTable::freeze() {
+    if (is_frozen())
+        return;
+
+    auto mphf = std::make_shared<KMerMPHF>(kmers_data(), size(), num_words_);
+
+    permutation_width_ = 1;
+    while (permutation_width_ < 64 && (size() >> permutation_width_))
+        permutation_width_++;
+
+    std::vector<uint64_t> permutation((size() * permutation_width_ + 63) / 64, 0);
+    for (uint64_t i = 0; i < size(); ++i) {
+        set_packed(permutation.data(), (*mphf)((*this)[i]), permutation_width_, i);
+    }
+
+    // the k-mers stay mapped if they are
+    mapped_slots_ = NULL;
+    mapped_num_slots_ = 0;
+    slots_.swap(permutation);
+    mphf_ = mphf;
+}
+
+void KMerHashTable::thaw() {
+    if (!is_frozen())
+        return;
+
+    mphf_.reset();
+    permutation_width_ = 0;
+    slots_.clear();
+    size_t capacity = 16;
+    while (size() * 10 > capacity * 7) {
+        capacity *= 2;
+    }
+    rehash(capacity);
+}
+
+uint64_t KMerHashTable::serialize(std::ostream &out) const {
+    const uint64_t header[4] = { num_words_, size(), num_slots(), permutation_width_ };
+    uint64_t written_bytes = serialization::serializeRawArray(out, header, 4);
+    written_bytes += serialization::serializeRawArray(out, kmers_data(), size() * num_words_);
+    if (is_frozen())
+        written_bytes += mphf_->serialize(out);
+    written_bytes += serialization::serializeRawArray(out, slots_data(), num_slots());
+    return written_bytes;
+}
+
+void KMerHashTable::load(std::istream &in) {
+    auto header = serialization::loadRawArray<uint64_t>(in, 4);
+    if (header[0] != num_words_
+            || (!header[3] && (header[2] & (header[2] - 1))))
+        throw std::runtime_error("Corrupted k-mer table");
+
+    mapped_ = false;
+    mapped_kmers_ = NULL;
+    mapped_slots_ = NULL;
+    kmers_ = serialization::loadRawArray<KMer::word_type>(in, header[1] * num_words_);
+    permutation_width_ = header[3];
+    if (permutation_width_) {
+        auto mphf = std::make_shared<KMerMPHF>();
+        mphf->load(in);
+        mphf_ = mphf;
+    } else {
+        mphf_.reset();
+    }
+    slots_ = serialization::loadRawArray<uint64_t>(in, header[2]);
+}
+
+const char* KMerHashTable::map(const char *data, const char *end) {
+    const uint64_t *header = serialization::mapRawArray<uint64_t>(data, end, 4);
+    if (header[0] != num_words_
+            || (!header[3] && (header[2] & (header[2] - 1))))
+        throw std::runtime_error("Corrupted k-mer table");
+
+    kmers_.clear();
+    kmers_.shrink_to_fit();
+    slots_.clear();
+    slots_.shrink_to_fit();
+
+    mapped_ = true;
+    mapped_size_ = header[1];
+    mapped_num_slots_ = header[2];
+    mapped_kmers_ = serialization::mapRawArray<KMer::word_type>(
+        data, end, mapped_size_ * num_words_
+    );
+    permutation_width_ = header[3];
+    if (permutation_width_) {
+        auto mphf = std::make_shared<KMerMPHF>();
+        data = mphf->load(data, end);
+        mphf_ = mphf;
+    } else {
+        mphf_.reset();
+    }
+    mapped_slots_ = serialization::mapRawArray<uint64_t>(data, end, mapped_num_slots_);
+    return data;
+}
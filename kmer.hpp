@@ -0,0 +1,215 @@
+#ifndef __KMER_HPP__
+#define __KMER_HPP__
+
+#include <cstdint>
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <memory>
+
+
+/**
+ * A k-mer over the alphabet "$ACGTN" packed with 3 bits per character.
+ * Characters never straddle words: 21 of them fit into one 64-bit word,
+ * so k-mers of length up to 21 take one word, up to 42 take two, etc.
+ * Positions past the k-mer length are kept zero.
+ */
+class KMer {
+  public:
+    typedef uint64_t word_type;
+
+    static constexpr size_t kBitsPerChar = 3;
+    static constexpr size_t kCharsPerWord = 21;
+    static constexpr size_t kMaxWords = 8;
+    static constexpr size_t kMaxLength = kCharsPerWord * kMaxWords;
+    static constexpr uint8_t kInvalidCode = 7;
+
+    KMer() : words_{} {}
+
+    // Returns false if the sequence contains characters not in the alphabet
+    bool pack(const char *begin, size_t length);
+
+    static uint8_t encode(char c);
+    static char decode(uint8_t code) { return kCodeToChar[code & 7]; }
+
+    static size_t num_words(size_t length) {
+        return length ? (length + kCharsPerWord - 1) / kCharsPerWord : 1;
+    }
+
+    uint8_t operator[](size_t i) const {
+        return (words_[i / kCharsPerWord]
+                    >> (kBitsPerChar * (i % kCharsPerWord))) & 7;
+    }
+
+    void set(size_t i, uint8_t code) {
+        word_type &word = words_[i / kCharsPerWord];
+        size_t offset = kBitsPerChar * (i % kCharsPerWord);
+        word = (word & ~(word_type(7) << offset)) | (word_type(code) << offset);
+    }
+
+    // The complement of a code, '$' and 'N' are their own complements
+    static uint8_t complement(uint8_t code) { return kComplement[code & 7]; }
+
+    void reverse_complement(size_t length);
+
+    // Drop the first character and append |code| at the end
+    void shift_forward(size_t length, uint8_t code);
+
+    // Drop the last character and prepend |code| at the front
+    void shift_backward(size_t length, uint8_t code);
+
+    std::string to_string(size_t length) const;
+
+    static constexpr uint64_t kDefaultSeed = 0x9e3779b97f4a7c15llu;
+
+    uint64_t hash(size_t num_words, uint64_t seed = kDefaultSeed) const {
+        return hash(words_, num_words, seed);
+    }
+
+    static uint64_t hash(const word_type *words, size_t num_words,
+                         uint64_t seed = kDefaultSeed);
+
+    word_type* data() { return words_; }
+    const word_type* data() const { return words_; }
+
+    // An arbitrary total order, used to pick canonical k-mers
+    bool operator<(const KMer &other) const {
+        return std::lexicographical_compare(words_, words_ + kMaxWords,
+                                            other.words_, other.words_ + kMaxWords);
+    }
+
+  private:
+    static const char kCodeToChar[8];
+    static const uint8_t kComplement[8];
+
+    word_type words_[kMaxWords];
+};
+
+
+class KMerMPHF;
+
+/**
+ * Dictionary of packed k-mers of a fixed length. The k-mers are stored
+ * contiguously in insertion order, so each one is identified by its index,
+ * and lookups go through an open-addressing (linear probing) table holding
+ * these indices.
+ *
+ * The serialized table can also be used in place from a memory-mapped
+ * file. A mapped table is copied into memory on the first modification.
+ *
+ * A table can be frozen to replace the hash table with a minimal perfect
+ * hash function and a bit-packed permutation from its values to the k-mer
+ * indices, which takes a few times less space. Modifying a frozen table
+ * rebuilds the hash table.
+ */
+class KMerHashTable {
+  public:
+    static constexpr uint64_t npos = static_cast<uint64_t>(-1);
+
+    explicit KMerHashTable(size_t length = 0);
+
+    size_t length() const { return length_; }
+    size_t size() const {
+        return mapped_ ? mapped_size_ : kmers_.size() / num_words_;
+    }
+
+    // Returns npos if the k-mer is not in the table
+    uint64_t find(const KMer &kmer) const {
+        return find(kmer, kmer.hash(num_words_));
+    }
+
+    // Look up several k-mers at once, prefetching their slots first
+    void find(const KMer *kmers, size_t num, uint64_t *indices) const;
+
+    // Inserts the k-mer if it is not present. Returns its index and
+    // whether it has been inserted.
+    std::pair<uint64_t, bool> emplace(const KMer &kmer);
+
+    KMer operator[](uint64_t i) const;
+
+    uint8_t get_code(uint64_t i, size_t pos) const {
+        const KMer::word_type &word
+            = kmers_data()[i * num_words_ + pos / KMer::kCharsPerWord];
+        return (word >> (KMer::kBitsPerChar * (pos % KMer::kCharsPerWord))) & 7;
+    }
+
+    void reserve(size_t size);
+
+    // Concurrent insertion of a batch of k-mers known to be absent:
+    // resize() the table first, then set() and insert_index() the new
+    // k-mers from any number of threads.
+    void resize(size_t size);
+    void set(uint64_t i, const KMer &kmer) {
+        assert(!mapped_);
+        std::copy(kmer.data(), kmer.data() + num_words_, &kmers_[i * num_words_]);
+    }
+    void insert_index(uint64_t i);
+
+    uint64_t serialize(std::ostream &out) const;
+    void load(std::istream &in);
+
+    // Use the serialized table at |data| in place. The memory must stay
+    // valid while the table is used. Returns the end of the table.
+    const char* map(const char *data, const char *end);
+    bool is_mapped() const { return mapped_; }
+    // Copy the mapped table into memory, called before any modification
+    void unmap();
+
+    void freeze();
+    bool is_frozen() const { return mphf_.get(); }
+
+  private:
+    // Rebuild the hash table of a frozen table
+    void thaw();
+
+    // Slots keep the index + 1 in the lower bits and the top bits of the
+    // hash value in the upper ones, so that most mismatches are rejected
+    // without looking up the k-mer itself
+    static constexpr size_t kIndexBits = 40;
+    static constexpr uint64_t kIndexMask = (uint64_t(1) << kIndexBits) - 1;
+
+    static uint64_t make_slot(uint64_t hash, uint64_t index) {
+        return (hash & ~kIndexMask) | (index + 1);
+    }
+    static uint64_t get_index(uint64_t slot) { return (slot & kIndexMask) - 1; }
+
+    uint64_t find(const KMer &kmer, uint64_t hash) const;
+
+    bool equal(uint64_t i, const KMer &kmer) const {
+        return !std::memcmp(&kmers_data()[i * num_words_], kmer.data(),
+                            num_words_ * sizeof(KMer::word_type));
+    }
+
+    const KMer::word_type* kmers_data() const {
+        return mapped_ ? mapped_kmers_ : kmers_.data();
+    }
+    const uint64_t* slots_data() const {
+        return mapped_slots_ ? mapped_slots_ : slots_.data();
+    }
+    size_t num_slots() const {
+        return mapped_slots_ ? mapped_num_slots_ : slots_.size();
+    }
+
+    void rehash(size_t capacity);
+
+    size_t length_;
+    size_t num_words_;
+    std::vector<KMer::word_type> kmers_;
+    // 0 marks an empty slot. In frozen tables, the slots hold
+    // the permutation instead, packed with permutation_width_ bits.
+    std::vector<uint64_t> slots_;
+
+    std::shared_ptr<const KMerMPHF> mphf_;
+    size_t permutation_width_ = 0;
+
+    bool mapped_ = false;
+    const KMer::word_type *mapped_kmers_ = NULL;
+    const uint64_t *mapped_slots_ = NULL;
+    size_t mapped_size_ = 0;
+    size_t mapped_num_slots_ = 0;
+};
+
+#endif // __KMER_HPP__
@@ -0,0 +1,158 @@
+#include "kmer_mphf.hpp"
+
+#include <cassert>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+
+#include "serialization.hpp"
+
+
+constexpr uint64_t KMerMPHF::npos;
+constexpr size_t KMerMPHF::kMaxLevels;
+constexpr size_t KMerMPHF::kBlockWords;
+
+KMerMPHF::KMerMPHF(const KMer::word_type *kmers,
+                   size_t num_kmers,
+                   size_t num_words,
+                   double gamma)
+      : num_words_(num_words), num_keys_(num_kmers) {
+    assert(gamma >= 1);
+
+    std::vector<uint64_t> keys(num_kmers);
+    std::iota(keys.begin(), keys.end(), 0);
+
+    for (size_t level = 0; level < kMaxLevels && keys.size(); ++level) {
+        uint64_t level_size = std::max(uint64_t(1),
+            static_cast<uint64_t>(gamma * keys.size() + 63) / 64) * 64;
+        level_offsets_.push_back(level_offsets_.back() + level_size);
+
+        std::vector<uint64_t> hits(level_size / 64, 0);
+        std::vector<uint64_t> collisions(level_size / 64, 0);
+        for (uint64_t key : keys) {
+            uint64_t pos = get_position(kmers + key * num_words_, level);
+            uint64_t bit = uint64_t(1) << (pos % 64);
+            if (hits[pos / 64] & bit) {
+                collisions[pos / 64] |= bit;
+            } else {
+                hits[pos / 64] |= bit;
+            }
+        }
+        for (size_t i = 0; i < hits.size(); ++i) {
+            hits[i] &= ~collisions[i];
+        }
+
+        // k-mers with collisions are passed to the next level
+        size_t num_left = 0;
+        for (uint64_t key : keys) {
+            uint64_t pos = get_position(kmers + key * num_words_, level);
+            if (!(hits[pos / 64] & (uint64_t(1) << (pos % 64))))
+                keys[num_left++] = key;
+        }
+        keys.resize(num_left);
+
+        bits_.insert(bits_.end(), hits.begin(), hits.end());
+    }
+
+    for (uint64_t key : keys) {
+        fallback_kmers_.insert(fallback_kmers_.end(),
+                               kmers + key * num_words_,
+                               kmers + (key + 1) * num_words_);
+    }
+
+    uint64_t num_ones = 0;
+    for (size_t i = 0; i < bits_.size(); ++i) {
+        if (i % kBlockWords == 0)
+            ranks_.push_back(num_ones);
+        num_ones += __builtin_popcountll(bits_[i]);
+    }
+    assert(num_ones + keys.size() == num_keys_);
+}
+
+uint64_t KMerMPHF::get_seed(size_t level) {
+    return KMer::kDefaultSeed + (level + 1) * 0xbf58476d1ce4e5b9llu;
+}
+
+uint64_t KMerMPHF::get_position(const KMer::word_type *kmer, size_t level) const {
+    const uint64_t *level_offsets = level_offsets_data();
+    uint64_t level_size = level_offsets[level + 1] - level_offsets[level];
+    uint64_t hash = KMer::hash(kmer, num_words_, get_seed(level));
+    // map the hash value to [0, level_size) without a division
+    return static_cast<uint64_t>(
+        (static_cast<unsigned __int128>(hash) * level_size) >> 64
+    );
+}
+
+uint64_t KMerMPHF::rank(uint64_t pos) const {
+    const uint64_t *bits = bits_data();
+    size_t word = pos / 64;
+    uint64_t result = ranks_data()[word / kBlockWords];
+    for (size_t i = word / kBlockWords * kBlockWords; i < word; ++i) {
+        result += __builtin_popcountll(bits[i]);
+    }
+    if (pos % 64)
+        result += __builtin_popcountll(bits[word] << (64 - pos % 64));
+    return result;
+}
+
+uint64_t KMerMPHF::operator()(const KMer &kmer) const {
+    const uint64_t *bits = bits_data();
+    const uint64_t *level_offsets = level_offsets_data();
+    for (size_t level = 0; level + 1 < level_offsets_size(); ++level) {
+        uint64_t pos = level_offsets[level] + get_position(kmer.data(), level);
+        if (bits[pos / 64] & (uint64_t(1) << (pos % 64)))
+            return rank(pos);
+    }
+
+    const KMer::word_type *fallback_kmers = fallback_kmers_data();
+    size_t num_fallback = fallback_kmers_size() / num_words_;
+    for (size_t i = 0; i < num_fallback; ++i) {
+        if (!std::memcmp(&fallback_kmers[i * num_words_], kmer.data(),
+                         num_words_ * sizeof(KMer::word_type)))
+            return num_keys_ - num_fallback + i;
+    }
+    return npos;
+}
+
+uint64_t KMerMPHF::serialize(std::ostream &out) const {
+    const uint64_t header[6] = {
+        num_words_, num_keys_,
+        bits_size(), ranks_size(), level_offsets_size(), fallback_kmers_size()
+    };
+    return serialization::serializeRawArray(out, header, 6)
+         + serialization::serializeRawArray(out, bits_data(), bits_size())
+         + serialization::serializeRawArray(out, ranks_data(), ranks_size())
+         + serialization::serializeRawArray(out, level_offsets_data(), level_offsets_size())
+         + serialization::serializeRawArray(out, fallback_kmers_data(), fallback_kmers_size());
+}
+
+void KMerMPHF::load(std::istream &in) {
+    auto header = serialization::loadRawArray<uint64_t>(in, 6);
+    num_words_ = header[0];
+    num_keys_ = header[1];
+    bits_ = serialization::loadRawArray<uint64_t>(in, header[2]);
+    ranks_ = serialization::loadRawArray<uint64_t>(in, header[3]);
+    level_offsets_ = serialization::loadRawArray<uint64_t>(in, header[4]);
+    fallback_kmers_ = serialization::loadRawArray<KMer::word_type>(in, header[5]);
+    mapped_ = false;
+}
+
+const char* KMerMPHF::load(const char *data, const char *end) {
+    const uint64_t *header = serialization::mapRawArray<uint64_t>(data, end, 6);
+    num_words_ = header[0];
+    num_keys_ = header[1];
+
+    bits_.clear();
+    ranks_.clear();
+    level_offsets_.clear();
+    fallback_kmers_.clear();
+
+    mapped_ = true;
+    std::copy(header + 2, header + 6, mapped_sizes_);
+    mapped_bits_ = serialization::mapRawArray<uint64_t>(data, end, mapped_sizes_[0]);
+    mapped_ranks_ = serialization::mapRawArray<uint64_t>(data, end, mapped_sizes_[1]);
+    mapped_level_offsets_ = serialization::mapRawArray<uint64_t>(data, end, mapped_sizes_[2]);
+    mapped_fallback_kmers_
+        = serialization::mapRawArray<KMer::word_type>(data, end, mapped_sizes_[3]);
+    return data;
+}
@@ -0,0 +1,90 @@
+#ifndef __KMER_MPHF_HPP__
+#define __KMER_MPHF_HPP__
+
+#include <vector>
+#include <iostream>
+
+#include "kmer.hpp"
+
+
+/**
+ * Minimal perfect hash function over a static set of packed k-mers, built
+ * level by level as in BBHash (Limasset et al., 2017). A k-mer that does
+ * not collide with other k-mers at a level gets its own bit there, the
+ * rest go to the next level. The value of a k-mer is the rank of its bit
+ * in all levels. The few k-mers left after the last level are stored as is.
+ *
+ * For k-mers not from the set, the function returns an arbitrary value
+ * or npos, so the result must be verified by the caller.
+ */
+class KMerMPHF {
+  public:
+    static constexpr uint64_t npos = static_cast<uint64_t>(-1);
+
+    explicit KMerMPHF(size_t num_words = 1) : num_words_(num_words) {}
+
+    // Build the function for |num_kmers| distinct k-mers stored contiguously,
+    // |gamma| is the number of bits per k-mer at each level
+    KMerMPHF(const KMer::word_type *kmers,
+             size_t num_kmers,
+             size_t num_words,
+             double gamma = 2);
+
+    uint64_t operator()(const KMer &kmer) const;
+
+    size_t size() const { return num_keys_; }
+
+    uint64_t serialize(std::ostream &out) const;
+    void load(std::istream &in);
+    // Use the serialized function at |data| in place. The memory must stay
+    // valid while the function is used. Returns the end of the data.
+    const char* load(const char *data, const char *end);
+
+  private:
+    static constexpr size_t kMaxLevels = 32;
+    static constexpr size_t kBlockWords = 8;
+
+    static uint64_t get_seed(size_t level);
+    uint64_t get_position(const KMer::word_type *kmer, size_t level) const;
+
+    // Number of set bits before position |pos|
+    uint64_t rank(uint64_t pos) const;
+
+    const uint64_t* bits_data() const { return mapped_ ? mapped_bits_ : bits_.data(); }
+    size_t bits_size() const { return mapped_ ? mapped_sizes_[0] : bits_.size(); }
+    const uint64_t* ranks_data() const { return mapped_ ? mapped_ranks_ : ranks_.data(); }
+    size_t ranks_size() const { return mapped_ ? mapped_sizes_[1] : ranks_.size(); }
+    const uint64_t* level_offsets_data() const {
+        return mapped_ ? mapped_level_offsets_ : level_offsets_.data();
+    }
+    size_t level_offsets_size() const {
+        return mapped_ ? mapped_sizes_[2] : level_offsets_.size();
+    }
+    const KMer::word_type* fallback_kmers_data() const {
+        return mapped_ ? mapped_fallback_kmers_ : fallback_kmers_.data();
+    }
+    size_t fallback_kmers_size() const {
+        return mapped_ ? mapped_sizes_[3] : fallback_kmers_.size();
+    }
+
+    size_t num_words_;
+    uint64_t num_keys_ = 0;
+    // the bits of all levels concatenated, each level is a multiple of 64 bits
+    std::vector<uint64_t> bits_;
+    // number of set bits before each block of kBlockWords words
+    std::vector<uint64_t> ranks_;
+    // offsets of the levels in bits_, followed by the total number of bits
+    std::vector<uint64_t> level_offsets_ { 0 };
+    // k-mers left after the last level, they get the largest values
+    std::vector<KMer::word_type> fallback_kmers_;
+
+    // The same arrays in the serialized function used in place
+    bool mapped_ = false;
+    const uint64_t *mapped_bits_ = NULL;
+    const uint64_t *mapped_ranks_ = NULL;
+    const uint64_t *mapped_level_offsets_ = NULL;
+    const KMer::word_type *mapped_fallback_kmers_ = NULL;
+    uint64_t mapped_sizes_[4] = {};
+};
+
+#endif // __KMER_MPHF_HPP__
@@ -4,6 +4,8 @@
 #include <map>
 #include <memory>
 #include <algorithm>
+#include <thread>
+#include <future>
 
 #include <zlib.h>
 
@@ -14,51 +16,40 @@
 #include "vcf_parser.hpp"
 #include "dbg_bloom_annotator.hpp"
 #include "wavelet_trie_annotator.hpp"
+#include "precise_builder.hpp"
 #include "unix_tools.hpp"
+#include "thread_pool.hpp"
 
 KSEQ_INIT(gzFile, gzread);
 
+// Total length of the sequences in a batch passed from the reader thread
+const size_t kReadBatchLength = 1 << 24;
+// Maximum number of batches buffered between the reader and the consumers
+const size_t kReadQueueSize = 4;
 
-template <class Graph, class Map>
-void annotate_kmers(const std::vector<std::string> &kmers, const Graph &graph,
-                                                           const Map &get_coloring) {
-    for (const auto &kmer : kmers) {
-        std::cout << kmer << "\t";
-        if (kmer.size() != graph.get_k() + 1) {
-            std::cout << "\n";
-            std::cerr << "Error: Wrong k-mer size (" << kmer.size()
-                                                     << " instead of "
-                                                     << graph.get_k() + 1
-                                                     << ")\n";
-            continue;
-        }
-        std::vector<uint64_t> coloring;
-        auto kmer_index = graph.map_kmer(kmer);
-        if (kmer_index >= graph.first_edge()
-                && kmer_index <= graph.last_edge()) {
-            coloring = get_coloring(kmer_index);
-        }
+struct ReadBatch {
+    std::vector<std::string> names;
+    std::vector<std::string> sequences;
+    size_t length = 0;
+};
 
-        if (coloring.size())
-            std::cout << coloring[0];
-
-        for (size_t i = 1; i < coloring.size(); ++i) {
-            std::cout << "," << coloring[i];
-        }
-        std::cout << "\n";
-    }
+void print_stage_stats(const std::string &stage, double time, uint64_t num_bases) {
+    std::cout << stage << "\t" << time << "\t"
+              << (time > 0 ? num_bases / time / 1e6 : 0) << " Mbp/sec" << std::endl;
 }
 
+
 std::vector<size_t> wavelet_trie_test_permutations(
         const DBGHash &graph,
         const hash_annotate::PreciseHashAnnotator &precise,
         size_t num_perm,
         size_t p,
+        bool reorder_columns = false,
         bool verbose = false) {
     if (verbose) {
         std::cout << "Testing permutations: " << precise.num_prefix_columns() << " prefix columns" << std::endl;
     }
-    std::vector<size_t> sizes(num_perm + 1);
+    std::vector<size_t> sizes(num_perm + 1 + reorder_columns);
     utils::ThreadPool thread_pool(p);
     //original permutation
     thread_pool.enqueue([&]() {
@@ -72,8 +63,21 @@ std::vector<size_t> wavelet_trie_test_permutations(
 
     std::srand(42);
 
+    //optimized order, last
+    if (reorder_columns) {
+        thread_pool.enqueue([&]() {
+            std::ostringstream sout;
+            annotate::WaveletTrieAnnotator wtr(
+                    precise,
+                    graph,
+                    1,
+                    annotate::WaveletTrieAnnotator::compute_column_order(precise));
+            sizes.back() = wtr.serialize(sout);
+        });
+    }
+
     //shuffles
-    for (size_t _i = 1; _i < sizes.size(); ++_i) {
+    for (size_t _i = 1; _i <= num_perm; ++_i) {
         std::vector<size_t> indices(precise.num_columns());
         std::iota(indices.begin(), indices.end(), 0);
         std::random_shuffle(indices.begin(), indices.end());
@@ -101,6 +105,22 @@ std::vector<size_t> wavelet_trie_test_permutations(
     return sizes;
 }
 
+// Rough upper bound on the number of k-mers in the input files, taking
+// the gzipped files to be compressed at most four times
+size_t estimate_num_kmers(const std::vector<std::string> &files) {
+    size_t num_kmers = 0;
+    for (const auto &file : files) {
+        std::ifstream in(file, std::ios::binary | std::ios::ate);
+        if (!in.good())
+            continue;
+        size_t size = static_cast<size_t>(in.tellg());
+        num_kmers += file.size() > 3 && file.substr(file.size() - 3) == ".gz"
+                        ? size * 4
+                        : size;
+    }
+    return num_kmers;
+}
+
 template <class Callback>
 void read_vcf_file_critical(const std::string &filename,
                             const std::string &ref_filename,
@@ -174,6 +194,198 @@ void read_fasta_file_critical(const std::string &filename,
     gzclose(input_p);
 }
 
+// Call |process(begin, end, out, err)| on consecutive chunks of [0, size)
+// from |num_threads| threads and print their outputs in the chunk order
+template <class Callback>
+void process_in_order(size_t size, size_t num_threads, Callback process) {
+    num_threads = std::max(num_threads, static_cast<size_t>(1));
+    utils::ThreadPool thread_pool(num_threads > 1 ? num_threads : 0);
+    size_t chunk_size = (size + num_threads - 1) / num_threads;
+    std::vector<std::future<std::pair<std::string, std::string>>> outputs;
+    for (size_t begin = 0; begin < size; begin += chunk_size) {
+        size_t end = std::min(begin + chunk_size, size);
+        outputs.push_back(thread_pool.enqueue([&process, begin, end]() {
+            std::ostringstream out;
+            std::ostringstream err;
+            process(begin, end, out, err);
+            return std::make_pair(out.str(), err.str());
+        }));
+    }
+    for (auto &output : outputs) {
+        auto result = output.get();
+        std::cout << result.first;
+        std::cerr << result.second;
+    }
+}
+
+template <class Graph, class Map>
+void annotate_kmers(const std::vector<std::string> &kmers, const Graph &graph,
+                                                           const Map &get_coloring,
+                                                           size_t num_threads = 1) {
+    process_in_order(kmers.size(), num_threads,
+        [&](size_t begin, size_t end, std::ostream &out, std::ostream &err) {
+            for (size_t j = begin; j < end; ++j) {
+                const auto &kmer = kmers[j];
+                out << kmer << "\t";
+                if (kmer.size() != graph.get_k() + 1) {
+                    out << "\n";
+                    err << "Error: Wrong k-mer size (" << kmer.size()
+                                                      << " instead of "
+                                                      << graph.get_k() + 1
+                                                      << ")\n";
+                    continue;
+                }
+                std::vector<uint64_t> coloring;
+                auto kmer_index = graph.map_kmer(kmer);
+                if (kmer_index >= graph.first_edge()
+                        && kmer_index <= graph.last_edge()) {
+                    coloring = get_coloring(kmer_index);
+                }
+
+                if (coloring.size())
+                    out << coloring[0];
+
+                for (size_t i = 1; i < coloring.size(); ++i) {
+                    out << "," << coloring[i];
+                }
+                out << "\n";
+            }
+        }
+    );
+}
+
+// Print for each read the number of its k-mers found in the graph and
+// the columns annotating at least |discovery_fraction| of these k-mers,
+// each with the number of k-mers it annotates. The fraction 1 gives the
+// intersection of the k-mer annotations, and 0 their union. With the
+// Bloom filter annotation, the counts are not corrected for false
+// positives.
+// The reads of each batch are split between |num_threads| threads.
+template <class Annotator>
+void annotate_reads(const std::string &filename, const Annotator &annotator,
+                                                 double discovery_fraction,
+                                                 size_t num_threads = 1) {
+    // decompress and parse the input in a separate thread
+    utils::BoundedQueue<ReadBatch> batches(kReadQueueSize);
+    std::thread reader([&]() {
+        ReadBatch batch;
+        read_fasta_file_critical(filename, [&](kseq_t *read_stream) {
+            batch.names.emplace_back(read_stream->name.s);
+            batch.sequences.emplace_back(read_stream->seq.s, read_stream->seq.l);
+            batch.length += read_stream->seq.l;
+            if (batch.length >= kReadBatchLength) {
+                batches.push(std::move(batch));
+                batch = ReadBatch();
+            }
+        });
+        if (batch.sequences.size())
+            batches.push(std::move(batch));
+        batches.close();
+    });
+
+    ReadBatch batch;
+    while (batches.pop(&batch)) {
+        process_in_order(batch.sequences.size(), num_threads,
+            [&](size_t begin, size_t end, std::ostream &out, std::ostream &) {
+                std::vector<uint64_t> counts(annotator.num_columns());
+                for (size_t j = begin; j < end; ++j) {
+                    std::fill(counts.begin(), counts.end(), 0);
+                    size_t num_found = annotator.count_labels(batch.sequences[j],
+                                                              counts.data());
+                    out << batch.names[j] << "\t" << num_found << "\t";
+                    const char *sep = "";
+                    for (size_t i = 0; i < counts.size(); ++i) {
+                        if (counts[i] && counts[i] >= discovery_fraction * num_found) {
+                            out << sep << i << ":" << counts[i];
+                            sep = ",";
+                        }
+                    }
+                    out << "\n";
+                }
+            }
+        );
+    }
+    reader.join();
+}
+
+// The labels of a read: the name of the file for FASTQ files, and the
+// header for FASTA files, split in two at the delimiter if one is given
+std::vector<std::string> get_read_labels(const std::string &header,
+                                         const std::string &filename,
+                                         bool fastq,
+                                         const std::string &delimiter) {
+    std::vector<std::string> labels;
+    if (fastq) {
+        //TODO annotations for reference genome
+        labels.push_back(filename);
+        return labels;
+    }
+    const char *name = header.c_str();
+    const char *sep = NULL;
+    if (!delimiter.empty())
+        sep = strchr(name, delimiter[0]);
+    if (sep) {
+        labels.emplace_back(sep);
+        labels.emplace_back(std::string(name, sep));
+    } else {
+        labels.emplace_back(name);
+    }
+    return labels;
+}
+
+// Stream the input files once to estimate the number of distinct k-mers
+// of each column. The labels are assigned to columns in |annot_map| in
+// the same order as in the construction.
+std::vector<size_t> estimate_column_kmers(const std::vector<std::string> &files,
+                                          const Config &config,
+                                          size_t k,
+                                          const hash_annotate::BloomAnnotator &annotator,
+                                          std::unordered_map<std::string, size_t> *annot_map) {
+    std::vector<hash_annotate::HyperLogLog> counters;
+    auto get_counter = [&](const std::string &label) {
+        size_t column = annot_map->emplace(label, annot_map->size()).first->second;
+        if (column >= counters.size())
+            counters.resize(column + 1);
+        return &counters[column];
+    };
+
+    for (const auto &file : files) {
+        if (utils::get_filetype(file) == "VCF") {
+            std::vector<std::string> annotation;
+            read_vcf_file_critical(file, config.refpath, k, &annotation,
+                [&](std::string &seq, std::vector<std::string> *annotation) {
+                    for (const auto &label : *annotation) {
+                        auto *counter = get_counter(label);
+                        annotator.count_kmers(seq, counter);
+                        if (config.reverse) {
+                            std::string reverse = seq;
+                            reverse_complement(reverse.begin(), reverse.end());
+                            annotator.count_kmers(reverse, counter);
+                        }
+                    }
+                });
+        } else if (utils::get_filetype(file) == "FASTA"
+                    || utils::get_filetype(file) == "FASTQ") {
+            bool fastq = utils::get_filetype(file) == "FASTQ";
+            read_fasta_file_critical(file,
+                [&](kseq_t *read_stream) {
+                    std::string sequence(read_stream->seq.s, read_stream->seq.l);
+                    for (const auto &label : get_read_labels(read_stream->name.s, file, fastq,
+                                                             config.fasta_header_delimiter)) {
+                        annotator.count_kmers(sequence, get_counter(label));
+                    }
+                },
+                config.reverse);
+        }
+    }
+
+    std::vector<size_t> num_kmers(counters.size());
+    for (size_t i = 0; i < counters.size(); ++i) {
+        num_kmers[i] = static_cast<size_t>(counters[i].estimate() + 0.5);
+    }
+    return num_kmers;
+}
+
 int main(int argc, const char *argv[]) {
 
     // parse command line arguments and options
@@ -190,13 +402,14 @@ int main(int argc, const char *argv[]) {
     std::unique_ptr<hash_annotate::BloomAnnotator> annotator;
     std::unique_ptr<hash_annotate::PreciseHashAnnotator> precise_annotator;
     std::unique_ptr<annotate::WaveletTrieAnnotator> wt_annotator;
+    std::unique_ptr<hash_annotate::PreciseAnnotationBuilder> precise_builder;
 
     if (config->identity == Config::BUILD) {
 
         double graph_const_time = 0;
         double precise_const_time = 0;
         Timer result_timer;
-        DBGHash hashing_graph(config->k);
+        DBGHash hashing_graph(config->k, config->canonical);
         wt_annotator.reset(new annotate::WaveletTrieAnnotator(hashing_graph, config->p));
         precise_annotator.reset(new hash_annotate::PreciseHashAnnotator(hashing_graph));
         std::unordered_map<std::string, size_t> annot_map;
@@ -206,15 +419,27 @@ int main(int argc, const char *argv[]) {
             hashing_graph.load(config->infbase + ".graph.dbg");
             graph_const_time += result_timer.elapsed();
         }
+        // canonical graphs index both strands of every k-mer
+        if (hashing_graph.is_canonical())
+            config->reverse = false;
+
+        auto layout = hash_annotate::BloomAnnotator::STANDARD;
+        if (config->bloom_blocked)
+            layout = hash_annotate::BloomAnnotator::BLOCKED;
+        if (config->bloom_bit_sliced)
+            layout = hash_annotate::BloomAnnotator::BIT_SLICED;
 
         if (config->bloom_fpp > -0.5
                 || config->bloom_bits_per_edge > -0.5
                 || config->bloom_num_hash_functions > 0) {
             if (config->bloom_fpp > -0.5) {
                 // Expected FPP is set, optimize other parameters automatically
-                annotator.reset(new hash_annotate::BloomAnnotator(hashing_graph,
-                                                                  config->bloom_fpp,
-                                                                  config->verbose));
+                annotator.reset(new hash_annotate::BloomAnnotator(
+                    hashing_graph,
+                    config->bloom_fpp,
+                    config->verbose,
+                    layout
+                ));
             } else {
                 assert(config->bloom_bits_per_edge >= 0);
                 // Experiment mode, estimate FPP given other parameters,
@@ -223,7 +448,8 @@ int main(int argc, const char *argv[]) {
                     hashing_graph,
                     config->bloom_bits_per_edge,
                     config->bloom_num_hash_functions,
-                    config->verbose
+                    config->verbose,
+                    layout
                 ));
             }
         }
@@ -232,6 +458,30 @@ int main(int argc, const char *argv[]) {
             std::cout << "\tBits per edge:\t" << annotator->size_factor() << std::endl;
             std::cout << "\tNum hash functions:\t" << annotator->num_hash_functions() << std::endl;
             std::cout << "\tApprox false pos prob:\t" << annotator->approx_false_positive_rate() << std::endl;
+
+            if (config->bloom_sizing_pass) {
+                // size the filters for the distinct k-mers of their columns
+                Timer sizing_timer;
+                auto column_kmers = estimate_column_kmers(files, *config,
+                                                          hashing_graph.get_k(),
+                                                          *annotator, &annot_map);
+                for (size_t i = 0; i < column_kmers.size(); ++i) {
+                    if (column_kmers[i])
+                        annotator->reserve_column(i, column_kmers[i]);
+                }
+                std::cout << "\tSizing pass:\t" << sizing_timer.elapsed() << "sec" << std::endl;
+            } else if (layout == hash_annotate::BloomAnnotator::BIT_SLICED) {
+                // all columns share one filter, so size it for the largest possible one
+                std::vector<std::string> inputs = files;
+                if (!config->refpath.empty())
+                    inputs.push_back(config->refpath);
+                annotator->reserve(config->infbase.empty()
+                    ? estimate_num_kmers(inputs) * (static_cast<size_t>(config->reverse) + 1)
+                    : hashing_graph.get_num_edges()
+                );
+            }
+            if (layout == hash_annotate::BloomAnnotator::BIT_SLICED)
+                std::cout << "\tFilter size:\t" << annotator->get_size(0) << std::endl;
         }
         if (!config->infbase.empty()) {
             if (annotator.get()) {
@@ -243,6 +493,14 @@ int main(int argc, const char *argv[]) {
                 precise_annotator.reset();
                 wt_annotator.reset();
             }
+        } else if (config->index_set_memory) {
+            // build the index set in sorted runs on disk instead
+            precise_annotator.reset();
+            precise_builder.reset(new hash_annotate::PreciseAnnotationBuilder(
+                hashing_graph,
+                config->outfbase + ".precise.run",
+                static_cast<size_t>(config->index_set_memory) << 20
+            ));
         }
 
         bool has_vcf = false;
@@ -254,13 +512,18 @@ int main(int argc, const char *argv[]) {
         //one pass per suffix
         double file_read_time = 0;
         double bloom_const_time = 0;
+        // number of bases processed by each stage
+        uint64_t file_read_bases = 0;
+        uint64_t graph_const_bases = 0;
+        uint64_t precise_const_bases = 0;
+        uint64_t bloom_const_bases = 0;
         std::cout << "Start reading data and extracting k-mers..." << std::endl;
         Timer timer;
         timer.reset();
 
         // iterate over input files
         for (unsigned int f = 0; f < files.size(); ++f) {
-            if (!annotator.get() && !precise_annotator.get()) {
+            if (!annotator.get() && !precise_annotator.get() && !precise_builder.get()) {
             //if (!annotator.get() && !wt_annotator.get())
                 //break;
             //if (!annotator.get() && (wt_annotator.get() || precise_annotator.get())) {
@@ -298,6 +561,10 @@ int main(int argc, const char *argv[]) {
                                 precise_annotator->make_column_prefix(
                                         insert_annot_map.first->second);
                             }
+                            if (!_i && precise_builder.get()) {
+                                precise_builder->make_column_prefix(
+                                        insert_annot_map.first->second);
+                            }
                             auto insert_annot = variants.emplace(
                                     insert_annot_map.first->second,
                                     seq);
@@ -310,17 +577,26 @@ int main(int argc, const char *argv[]) {
 
                 file_read_time += data_reading_timer.elapsed();
                 for (auto &variant : variants) {
+                    file_read_bases += variant.second.length();
                     for (size_t j = 0; j < 2; ++j) {
                         if (config->infbase.empty()) {
                             data_reading_timer.reset();
                             hashing_graph.add_sequence(variant.second, true);
                             graph_const_time += data_reading_timer.elapsed();
+                            graph_const_bases += variant.second.length();
                             if (precise_annotator.get()) {
                             //if (wt_annotator.get()) {
                                 data_reading_timer.reset();
                                 //wt_annotator->add_sequence(variant.second, variant.first, true);
                                 precise_annotator->add_sequence(variant.second, variant.first, true);
                                 precise_const_time += data_reading_timer.elapsed();
+                                precise_const_bases += variant.second.length();
+                            }
+                            if (precise_builder.get()) {
+                                data_reading_timer.reset();
+                                precise_builder->add_sequence(variant.second, variant.first, true);
+                                precise_const_time += data_reading_timer.elapsed();
+                                precise_const_bases += variant.second.length();
                             }
                         }
                         if (annotator.get()) {
@@ -329,6 +605,7 @@ int main(int argc, const char *argv[]) {
                                         (variant.second.length() - hashing_graph.get_k())
                                             * (static_cast<size_t>(config->reverse) + 1));
                             bloom_const_time += data_reading_timer.elapsed();
+                            bloom_const_bases += variant.second.length();
                         }
                         if (config->reverse) {
                             reverse_complement(variant.second.begin(), variant.second.end());
@@ -339,78 +616,119 @@ int main(int argc, const char *argv[]) {
                 }
             } else if (utils::get_filetype(files[f]) == "FASTA"
                         || utils::get_filetype(files[f]) == "FASTQ") {
-                result_timer.reset();
                 bool fastq = utils::get_filetype(files[f]) == "FASTQ";
-                std::pair<std::unordered_map<std::string, size_t>::iterator, bool> map_ins;
-                std::vector<std::string> annotation;
-                if (fastq) {
-                    //TODO annotations for reference genome
-                    size_t cursize = annot_map.size();
-                    map_ins = annot_map.emplace(files[f], cursize);
-                    annotation.push_back(files[f]);
-                }
-
-                read_fasta_file_critical(files[f],
-                    [&](kseq_t *read_stream) {
-                        file_read_time += result_timer.elapsed();
-                        if (!fastq) {
-                            if (config->verbose) {
-                                std::cout << "Parsing " << read_stream->name.s << "\n";
-                            }
-                            annotation.clear();
-                            char *sep = NULL;
-                            if (!config->fasta_header_delimiter.empty())
-                                sep = strchr(read_stream->name.s, config->fasta_header_delimiter[0]);
-                            if (sep) {
-                                annotation.emplace_back(sep);
-                                annotation.emplace_back(std::string(read_stream->name.s, sep));
-                            } else {
-                                annotation.emplace_back(read_stream->name.s);
-                            }
-                        }
 
-                        if (config->infbase.empty()) {
-                            result_timer.reset();
-                            hashing_graph.add_sequence(read_stream->seq.s);
-                            graph_const_time += result_timer.elapsed();
+                // decompress and parse the input in a separate thread
+                utils::BoundedQueue<ReadBatch> batches(kReadQueueSize);
+                std::thread reader([&]() {
+                    Timer reading_timer;
+                    Timer data_reading_timer;
+                    ReadBatch batch;
+                    auto push_batch = [&]() {
+                        file_read_time += data_reading_timer.elapsed();
+                        file_read_bases += batch.length;
+                        batches.push(std::move(batch));
+                        batch = ReadBatch();
+                        data_reading_timer.reset();
+                    };
+                    read_fasta_file_critical(files[f],
+                        [&](kseq_t *read_stream) {
+                            batch.names.emplace_back(read_stream->name.s);
+                            batch.sequences.emplace_back(read_stream->seq.s,
+                                                         read_stream->seq.l);
+                            batch.length += read_stream->seq.l;
+                            if (batch.length >= kReadBatchLength)
+                                push_batch();
+                        },
+                        config->reverse,
+                        &reading_timer);
+                    if (batch.sequences.size())
+                        push_batch();
+                    batches.close();
+                });
+
+                // the graph is extended in this thread, the annotators in the pool
+                utils::ThreadPool annotation_pool(2);
+
+                ReadBatch batch;
+                std::vector<std::vector<size_t>> columns;
+                while (batches.pop(&batch)) {
+                    // map the labels to columns in order of appearance
+                    columns.assign(batch.sequences.size(), std::vector<size_t>());
+                    for (size_t i = 0; i < batch.sequences.size(); ++i) {
+                        if (!fastq && config->verbose) {
+                            std::cout << "Parsing " << batch.names[i] << "\n";
                         }
-
-                        if (annotation.empty() && precise_annotator.get() && config->infbase.empty()) {
-                        //if (annotation.empty() && wt_annotator.get() && config->infbase.empty()) {
-                            result_timer.reset();
-                            //wt_annotator->add_sequence(read_stream->seq.s);
-                            precise_annotator->add_sequence(read_stream->seq.s);
-                            precise_const_time += result_timer.elapsed();
+                        auto annotation = get_read_labels(batch.names[i], files[f], fastq,
+                                                          config->fasta_header_delimiter);
+                        assert(annotation.size() <= 2);
+                        for (const auto &label : annotation) {
+                            size_t cursize = annot_map.size();
+                            columns[i].push_back(annot_map.emplace(label, cursize).first->second);
                         }
+                    }
 
-                        assert(annotation.size() <= 2);
-                        for (size_t _i = 0; _i < annotation.size(); ++_i) {
-                            if (!fastq) {
-                                size_t cursize = annot_map.size();
-                                map_ins = annot_map.emplace(annotation[_i], cursize);
-                            }
-                            if (annotator.get()) {
-                                result_timer.reset();
-                                annotator->add_sequence(read_stream->seq.s, map_ins.first->second,
-                                        (read_stream->seq.l - hashing_graph.get_k())
-                                        * (static_cast<size_t>(config->reverse) + 1));
-                                bloom_const_time += result_timer.elapsed();
-                            }
-                            if (precise_annotator.get() && config->infbase.empty()) {
-                            //if (wt_annotator.get() && config->infbase.empty()) {
-                                result_timer.reset();
-                                if (!_i && annotation.size() > 1) {
-                                    precise_annotator->make_column_prefix(map_ins.first->second);
+                    std::future<void> precise_stage;
+                    if ((precise_annotator.get() && config->infbase.empty())
+                            || precise_builder.get()) {
+                    //if (wt_annotator.get() && config->infbase.empty()) {
+                        precise_stage = annotation_pool.enqueue([&]() {
+                            Timer stage_timer;
+                            // the index set is built either in memory or on disk
+                            auto add_batch = [&](auto &precise) {
+                                for (size_t i = 0; i < batch.sequences.size(); ++i) {
+                                    if (columns[i].empty()) {
+                                        //wt_annotator->add_sequence(batch.sequences[i]);
+                                        precise.add_sequence(batch.sequences[i]);
+                                    }
+                                    for (size_t _i = 0; _i < columns[i].size(); ++_i) {
+                                        if (!_i && columns[i].size() > 1) {
+                                            precise.make_column_prefix(columns[i][_i]);
+                                        }
+                                        //wt_annotator->add_sequence(batch.sequences[i], columns[i][_i]);
+                                        precise.add_sequence(batch.sequences[i], columns[i][_i]);
+                                    }
                                 }
-                                //wt_annotator->add_sequence(read_stream->seq.s, map_ins.first->second);
-                                precise_annotator->add_sequence(read_stream->seq.s, map_ins.first->second);
-                                precise_const_time += result_timer.elapsed();
+                            };
+                            if (precise_builder.get()) {
+                                add_batch(*precise_builder);
+                            } else {
+                                add_batch(*precise_annotator);
                             }
-                        }
-                        result_timer.reset();
-                    },
-                    config->reverse,
-                    &result_timer);
+                            precise_const_time += stage_timer.elapsed();
+                            precise_const_bases += batch.length;
+                        });
+                    }
+
+                    std::future<void> bloom_stage;
+                    if (annotator.get()) {
+                        bloom_stage = annotation_pool.enqueue([&]() {
+                            Timer stage_timer;
+                            std::vector<size_t> num_elements(batch.sequences.size());
+                            for (size_t i = 0; i < batch.sequences.size(); ++i) {
+                                num_elements[i] = (batch.sequences[i].size() - hashing_graph.get_k())
+                                                    * (static_cast<size_t>(config->reverse) + 1);
+                            }
+                            annotator->add_sequences(batch.sequences, columns,
+                                                     config->p, num_elements);
+                            bloom_const_time += stage_timer.elapsed();
+                            bloom_const_bases += batch.length;
+                        });
+                    }
+
+                    if (config->infbase.empty()) {
+                        Timer stage_timer;
+                        hashing_graph.add_sequences(batch.sequences, config->p);
+                        graph_const_time += stage_timer.elapsed();
+                        graph_const_bases += batch.length;
+                    }
+
+                    if (precise_stage.valid())
+                        precise_stage.get();
+                    if (bloom_stage.valid())
+                        bloom_stage.get();
+                }
+                reader.join();
             } else {
                 std::cerr << "ERROR: Filetype unknown for file "
                           << files[f] << std::endl;
@@ -423,34 +741,53 @@ int main(int argc, const char *argv[]) {
 
         //Runtime stats
         std::cout << "Runtime statistics" << std::endl;
-        std::cout << "File reading\t" << file_read_time << std::endl;
-        std::cout << "Graph construction\t" << graph_const_time << std::endl;
+        print_stage_stats("File reading", file_read_time, file_read_bases);
+        print_stage_stats("Graph construction", graph_const_time, graph_const_bases);
         if (annotator.get())
-            std::cout << "Bloom filter\t" << bloom_const_time << std::endl;
+            print_stage_stats("Bloom filter", bloom_const_time, bloom_const_bases);
         if (precise_annotator.get()) {
-            std::cout << "Index set\t" << precise_const_time << std::endl;
+            print_stage_stats("Index set", precise_const_time, precise_const_bases);
             std::cout << "# colors\t" << precise_annotator->num_columns() << std::endl;
             std::cout << "# class indicators\t" << precise_annotator->num_prefix_columns() << std::endl;
+            std::cout << "# label sets\t" << precise_annotator->num_label_sets() << std::endl;
+        }
+        if (precise_builder.get()) {
+            print_stage_stats("Index set", precise_const_time, precise_const_bases);
+            std::cout << "# colors\t" << precise_builder->num_columns() << std::endl;
+            std::cout << "# class indicators\t" << precise_builder->num_prefix_columns() << std::endl;
+        }
+        if (annotator.get() && config->bloom_freeze) {
+            if (!precise_annotator.get()) {
+                std::cerr << "ERROR: freezing the Bloom filters needs the exact annotation"
+                          << std::endl;
+                exit(1);
+            }
+            std::cout << "Freezing bloom filters\t" << std::flush;
+            timer.reset();
+            annotator->freeze(*precise_annotator, 0, config->p);
+            std::cout << timer.elapsed() << "sec" << std::endl;
         }
         //if (annotator.get() && precise_annotator.get() && config->bloom_test_num_kmers) {
-        if (annotator.get() && (wt_annotator.get() || precise_annotator.get()) && config->bloom_test_num_kmers) {
+        if (annotator.get() && precise_annotator.get() && config->bloom_test_num_kmers) {
             //Check FPP
             std::cout << "Approximating FPP...\t" << std::flush;
             timer.reset();
             /*
             if (wt_annotator.get()) {
-                annotator->test_fp_all(*wt_annotator, config->bloom_test_num_kmers, has_vcf);
+                annotator->test_fp_all(*wt_annotator, config->bloom_test_num_kmers, has_vcf, config->p);
             } else if (precise_annotator.get()) {
-                annotator->test_fp_all(*precise_annotator, config->bloom_test_num_kmers, has_vcf);
+                annotator->test_fp_all(*precise_annotator, config->bloom_test_num_kmers, has_vcf, config->p);
             }
             */
-            annotator->test_fp_all(*precise_annotator, config->bloom_test_num_kmers, has_vcf);
+            annotator->test_fp_all(*precise_annotator, config->bloom_test_num_kmers, has_vcf, config->p);
             std::cout << timer.elapsed() << "sec" << std::endl;
         }
         // output and cleanup
 
         // graph output
         if (!config->outfbase.empty() && config->infbase.empty()) {
+            if (config->frozen_graph)
+                hashing_graph.freeze();
             std::cout << "Serializing hash graph\t" << std::flush;
             std::cout << hashing_graph.serialize(config->outfbase + ".graph.dbg")
                       << " bytes" << std::endl;
@@ -461,22 +798,38 @@ int main(int argc, const char *argv[]) {
                       << " bytes" << std::endl;
         }
 
+        if (precise_builder.get()) {
+            std::cout << "Merging index set\t" << std::flush;
+            timer.reset();
+            std::cout << precise_builder->serialize(config->outfbase + ".precise.dbg")
+                      << " bytes\t"
+                      << precise_builder->num_runs() << " runs\t"
+                      << timer.elapsed() << " s" << std::endl;
+            // remove the runs
+            precise_builder.reset();
+        }
+
         if (config->wavelet_trie) {
             std::cout << "Computing wavelet trie\t" << std::flush;
             timer.reset();
             if (precise_annotator.get()) {
                 wt_annotator.reset(new annotate::WaveletTrieAnnotator(
-                    *precise_annotator, hashing_graph, config->p
+                    *precise_annotator, hashing_graph, config->p,
+                    config->reorder_columns
+                        ? annotate::WaveletTrieAnnotator::compute_column_order(*precise_annotator)
+                        : std::unordered_map<size_t, size_t>()
                 ));
             } else {
-                std::ifstream in(config->infbase + ".precise.dbg");
+                // stream the rows from the index set on disk
+                std::ifstream in((config->infbase.empty() ? config->outfbase : config->infbase)
+                                    + ".precise.dbg");
                 if (!in.good()) {
                     std::cerr << "ERROR: corrupt precise annotator. Please reconstruct it."
                               << std::endl;
                     exit(1);
                 }
                 wt_annotator.reset(new annotate::WaveletTrieAnnotator(hashing_graph, config->p));
-                wt_annotator->load_from_precise_file(in, config->p);
+                wt_annotator->load_from_precise_file(in, config->p, config->reorder_columns);
             }
             std::cout << wt_annotator->serialize(config->outfbase + ".wtr.dbg")
                       << " bytes\t"
@@ -517,6 +870,9 @@ int main(int argc, const char *argv[]) {
         if (config->verbose)
             std::cout << "k is " << hashing_graph.get_k() << std::endl;
 
+        if (hashing_graph.is_canonical())
+            config->reverse = false;
+
         if (config->verbose) {
             std::cout << "Graph loading: " << timer.elapsed() << "sec" << std::endl;
         }
@@ -760,13 +1116,15 @@ int main(int argc, const char *argv[]) {
             //Check FPP
             std::cout << "Approximating FPP...\t" << std::flush;
             timer.reset();
-            annotator->test_fp_all(*wt_annotator, config->bloom_test_num_kmers, has_vcf);
+            annotator->test_fp_all(*wt_annotator, config->bloom_test_num_kmers, has_vcf, config->p);
             std::cout << timer.elapsed() << "sec" << std::endl;
         }
         // output and cleanup
 
         // graph output
         if (!config->outfbase.empty()) {
+            if (config->frozen_graph)
+                hashing_graph.freeze();
             std::cout << "Serializing hash graph\t" << std::flush;
             std::cout << hashing_graph.serialize(config->outfbase + ".graph.dbg")
                       << " bytes" << std::endl;
@@ -838,11 +1196,28 @@ int main(int argc, const char *argv[]) {
                       << config->infbase + ".graph.dbg" << std::endl;
             exit(1);
         }
+        if (config->frozen_graph && !hashing_graph.is_frozen()) {
+            // the graphs frozen by build are used as they are
+            std::cerr << "Warning: the graph was not built with --frozen-graph, "
+                      << "building its minimal perfect hash index" << std::endl;
+            hashing_graph.freeze();
+        }
         if (config->verbose) {
             std::cout << "Graph loading: " << timer.elapsed() << "sec" << std::endl;
         }
         timer.reset();
 
+        // the arguments with FASTA/FASTQ file extensions are files with reads
+        std::vector<std::string> kmers;
+        std::vector<std::string> read_files;
+        for (const auto &file : files) {
+            if (utils::get_filetype(file).empty()) {
+                kmers.push_back(file);
+            } else {
+                read_files.push_back(file);
+            }
+        }
+
         if (config->wavelet_trie) {
             wt_annotator.reset(new annotate::WaveletTrieAnnotator(hashing_graph, config->p));
             if (!wt_annotator->load(config->infbase + ".wtr.dbg")) {
@@ -856,9 +1231,12 @@ int main(int argc, const char *argv[]) {
             }
             timer.reset();
 
-            annotate_kmers(files, hashing_graph, [&](uint64_t kmer_index) {
+            annotate_kmers(kmers, hashing_graph, [&](uint64_t kmer_index) {
                 return wt_annotator->annotate_edge(kmer_index);
-            });
+            }, config->p);
+            for (const auto &file : read_files) {
+                annotate_reads(file, *wt_annotator, config->discovery_fraction, config->p);
+            }
         } else {
             annotator.reset(new hash_annotate::BloomAnnotator(hashing_graph, 0.5));
             if (!annotator->load(config->infbase + ".anno.dbg")) {
@@ -872,9 +1250,12 @@ int main(int argc, const char *argv[]) {
             }
             timer.reset();
 
-            annotate_kmers(files, hashing_graph, [&](uint64_t kmer_index) {
+            annotate_kmers(kmers, hashing_graph, [&](uint64_t kmer_index) {
                 return annotator->get_annotation_corrected(kmer_index, true, 50);
-            });
+            }, config->p);
+            for (const auto &file : read_files) {
+                annotate_reads(file, *annotator, config->discovery_fraction, config->p);
+            }
         }
 
         if (config->verbose) {
@@ -894,7 +1275,7 @@ int main(int argc, const char *argv[]) {
         timer.reset();
 
         precise_annotator.reset(new hash_annotate::PreciseHashAnnotator(hashing_graph));
-        precise_annotator->load(config->infbase + ".precise.dbg");
+        precise_annotator->load(config->infbase + ".precise.dbg", config->p);
         if (config->verbose) {
             std::cout << "Annotation loading: " << timer.elapsed() << "sec" << std::endl;
         }
@@ -904,6 +1285,7 @@ int main(int argc, const char *argv[]) {
                 *precise_annotator,
                 config->num_permutations,
                 config->p,
+                config->reorder_columns,
                 config->verbose);
         if (config->verbose) {
             std::cout << "Permutations: " << timer.elapsed() << "sec" << std::endl;
@@ -927,9 +1309,16 @@ int main(int argc, const char *argv[]) {
             }
             timer.reset();
 
-            for (size_t i = 0; i < std::min(static_cast<size_t>(1000000), wt_annotator->size()); ++i) {
-                wt_annotator->annotate_edge(i);
-            }
+            process_in_order(std::min(static_cast<size_t>(1000000), wt_annotator->size()),
+                             config->p,
+                             [&](size_t begin, size_t end, std::ostream &, std::ostream &) {
+                // the rows are decoded in batches of consecutive edges
+                const size_t batch_size = 1 << 12;
+                std::vector<uint64_t> rows(batch_size * wt_annotator->num_words());
+                for (size_t i = begin; i < end; i += batch_size) {
+                    wt_annotator->export_rows(i, std::min(i + batch_size, end), rows.data());
+                }
+            });
 
         } else {
             if (!hashing_graph.load(config->infbase + ".graph.dbg")) {
@@ -937,6 +1326,12 @@ int main(int argc, const char *argv[]) {
                           << config->infbase + ".graph.dbg" << std::endl;
                 exit(1);
             }
+            if (config->frozen_graph && !hashing_graph.is_frozen()) {
+                // the graphs frozen by build are used as they are
+                std::cerr << "Warning: the graph was not built with --frozen-graph, "
+                          << "building its minimal perfect hash index" << std::endl;
+                hashing_graph.freeze();
+            }
             if (config->verbose) {
                 std::cout << "Graph loading: " << timer.elapsed() << "sec" << std::endl;
             }
@@ -944,7 +1339,7 @@ int main(int argc, const char *argv[]) {
 
             /*
             precise_annotator.reset(new hash_annotate::PreciseHashAnnotator(hashing_graph));
-            precise_annotator->load(config->infbase + ".precise.dbg");
+            precise_annotator->load(config->infbase + ".precise.dbg", config->p);
             if (config->verbose) {
                 std::cout << "Annotation loading: " << timer.elapsed() << "sec" << std::endl;
             }
@@ -963,9 +1358,10 @@ int main(int argc, const char *argv[]) {
             }
             timer.reset();
 
-            for (auto i = hashing_graph.first_edge(); i <= hashing_graph.last_edge(); ++i) {
-                annotator->get_annotation_corrected(i, true, 0);
-            }
+            annotator->get_annotations_corrected(
+                [](hash_annotate::DeBruijnGraphWrapper::edge_index, const uint64_t *) {},
+                config->p
+            );
         }
 
         std::cout << "Query: " << timer.elapsed() << "sec" << std::endl;
@@ -987,6 +1383,12 @@ int main(int argc, const char *argv[]) {
                       << static_cast<double>(std::get<2>(stats) * 100) / (std::get<0>(stats) * std::get<1>(stats)) << " %" << std::endl;
             std::cout << "# unique edge colorings\t"
                       << std::get<3>(stats) << std::endl;
+            if (config->verbose) {
+                for (size_t j = 0; j < wt_annotator->num_columns(); ++j) {
+                    std::cout << "# edges with label " << j << "\t"
+                              << wt_annotator->count_edges_with_label(j) << std::endl;
+                }
+            }
         }
     } else if (config->identity == Config::COMPRESS) {
         DBGHash hashing_graph(0);
@@ -1007,7 +1409,7 @@ int main(int argc, const char *argv[]) {
         std::cout << "Computing wavelet trie\t" << std::flush;
         wt_annotator.reset(new annotate::WaveletTrieAnnotator(hashing_graph, config->p));
         result_timer.reset();
-        wt_annotator->load_from_precise_file(in, config->p);
+        wt_annotator->load_from_precise_file(in, config->p, config->reorder_columns);
 
         std::cout << wt_annotator->serialize(config->outfbase + ".wtr.dbg")
                   << " bytes\t"
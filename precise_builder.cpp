@@ -0,0 +1,298 @@
+#include "precise_builder.hpp"
+
+#include <fstream>
+#include <algorithm>
+#include <numeric>
+#include <cstdio>
+
+#include "kmer.hpp"
+#include "serialization.hpp"
+
+
+namespace hash_annotate {
+
+// Compare the k-mers as the strings they encode, to pick the same
+// canonical k-mers as PreciseHashAnnotator
+static bool less_as_string(const KMer &a, const KMer &b, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        char first = KMer::decode(a[i]);
+        char second = KMer::decode(b[i]);
+        if (first != second)
+            return first < second;
+    }
+    return false;
+}
+
+constexpr size_t PreciseAnnotationBuilder::kMaxMergeRuns;
+
+PreciseAnnotationBuilder::PreciseAnnotationBuilder(const DeBruijnGraphWrapper &graph,
+                                                   const std::string &run_prefix,
+                                                   size_t memory_budget,
+                                                   size_t max_merge_runs)
+      : graph_(graph),
+        run_prefix_(run_prefix),
+        num_words_(KMer::num_words(graph.get_k() + 1)),
+        // the buffer and the order in which it is sorted
+        max_pairs_(std::max(memory_budget / ((num_words_ + 2) * sizeof(uint64_t)),
+                            size_t(1))),
+        max_merge_runs_(std::max(max_merge_runs, size_t(2))) {
+    if (graph_.get_k() + 1 > KMer::kMaxLength) {
+        std::cerr << "ERROR: k-mers are too long to be packed" << std::endl;
+        exit(1);
+    }
+    // don't let the buffer grow past the budget by doubling
+    buffer_.reserve(max_pairs_ * (num_words_ + 1));
+}
+
+PreciseAnnotationBuilder::~PreciseAnnotationBuilder() {
+    for (auto run : runs_) {
+        std::remove(get_run_filename(run).c_str());
+    }
+}
+
+std::string PreciseAnnotationBuilder::get_run_filename(size_t i) const {
+    return run_prefix_ + "." + std::to_string(i);
+}
+
+void PreciseAnnotationBuilder::add_sequence(const std::string &sequence,
+                                            pos_t column,
+                                            bool rooted) {
+    std::string preprocessed_seq = graph_.transform_sequence(sequence, rooted);
+
+    const size_t length = graph_.get_k() + 1;
+
+    // Don't annotate short sequences
+    if (preprocessed_seq.size() < length)
+        return;
+
+    if (column < static_cast<pos_t>(-1) && column >= num_columns_)
+        num_columns_ = column + 1;
+
+    KMer kmer;
+    KMer reverse;
+    for (size_t i = 0; i + length <= preprocessed_seq.size(); ++i) {
+        if (!kmer.pack(&preprocessed_seq[i], length)) {
+            std::cerr << "ERROR: can't pack k-mer "
+                      << preprocessed_seq.substr(i, length) << std::endl;
+            exit(1);
+        }
+        if (graph_.is_canonical()) {
+            reverse = kmer;
+            reverse.reverse_complement(length);
+            if (less_as_string(reverse, kmer, length))
+                kmer = reverse;
+        }
+        buffer_.insert(buffer_.end(), kmer.data(), kmer.data() + num_words_);
+        buffer_.push_back(column);
+
+        if (buffer_.size() >= max_pairs_ * (num_words_ + 1))
+            flush();
+    }
+}
+
+void PreciseAnnotationBuilder::flush() {
+    if (buffer_.empty())
+        return;
+
+    runs_.push_back(write_run(num_words_ + 1));
+    num_runs_++;
+}
+
+size_t PreciseAnnotationBuilder::write_run(size_t record_words) {
+    const uint64_t *records = buffer_.data();
+    std::vector<uint64_t> order(buffer_.size() / record_words);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](uint64_t a, uint64_t b) {
+        return std::lexicographical_compare(records + a * record_words,
+                                            records + (a + 1) * record_words,
+                                            records + b * record_words,
+                                            records + (b + 1) * record_words);
+    });
+
+    size_t run = next_run_++;
+    std::ofstream out(get_run_filename(run), std::ios::binary);
+    const uint64_t *last = NULL;
+    for (auto i : order) {
+        const uint64_t *record = records + i * record_words;
+        if (last && std::equal(record, record + record_words, last))
+            continue;
+
+        out.write(reinterpret_cast<const char*>(record), record_words * sizeof(uint64_t));
+        last = record;
+    }
+    if (!out.good()) {
+        std::cerr << "ERROR: can't write run " << get_run_filename(run) << std::endl;
+        exit(1);
+    }
+    buffer_.clear();
+    return run;
+}
+
+void PreciseAnnotationBuilder::merge_runs(std::vector<size_t> *runs,
+                                          size_t record_words,
+                                          const RecordCallback &callback) {
+    while (runs->size() > max_merge_runs_) {
+        std::vector<size_t> merged;
+        for (size_t i = 0; i < runs->size(); i += max_merge_runs_) {
+            std::vector<size_t> group(runs->begin() + i,
+                                      runs->begin() + std::min(i + max_merge_runs_,
+                                                               runs->size()));
+            if (group.size() == 1) {
+                merged.push_back(group.front());
+                continue;
+            }
+
+            size_t run = next_run_++;
+            std::ofstream out(get_run_filename(run), std::ios::binary);
+            merge_group(group, record_words, [&](const uint64_t *record) {
+                out.write(reinterpret_cast<const char*>(record),
+                          record_words * sizeof(uint64_t));
+            });
+            if (!out.good()) {
+                std::cerr << "ERROR: can't write run " << get_run_filename(run) << std::endl;
+                exit(1);
+            }
+            for (auto r : group) {
+                std::remove(get_run_filename(r).c_str());
+            }
+            merged.push_back(run);
+        }
+        runs->swap(merged);
+    }
+    merge_group(*runs, record_words, callback);
+}
+
+void PreciseAnnotationBuilder::merge_group(const std::vector<size_t> &run_ids,
+                                           size_t record_words,
+                                           const RecordCallback &callback) const {
+    std::vector<std::ifstream> runs(run_ids.size());
+    // the current record of each run
+    std::vector<uint64_t> heads(run_ids.size() * record_words);
+
+    auto next = [&](size_t r) {
+        if (runs[r].read(reinterpret_cast<char*>(&heads[r * record_words]),
+                         record_words * sizeof(uint64_t)))
+            return true;
+
+        if (runs[r].gcount()) {
+            std::cerr << "ERROR: corrupted run " << get_run_filename(run_ids[r]) << std::endl;
+            exit(1);
+        }
+        return false;
+    };
+    // the run with the smallest record is on the top of the heap
+    auto greater = [&](size_t a, size_t b) {
+        return std::lexicographical_compare(&heads[b * record_words],
+                                            &heads[(b + 1) * record_words],
+                                            &heads[a * record_words],
+                                            &heads[(a + 1) * record_words]);
+    };
+
+    std::vector<size_t> heap;
+    for (size_t r = 0; r < runs.size(); ++r) {
+        runs[r].open(get_run_filename(run_ids[r]), std::ios::binary);
+        if (!runs[r].good()) {
+            std::cerr << "ERROR: can't read run " << get_run_filename(run_ids[r]) << std::endl;
+            exit(1);
+        }
+        if (next(r))
+            heap.push_back(r);
+    }
+    std::make_heap(heap.begin(), heap.end(), greater);
+
+    std::vector<uint64_t> last;
+    while (heap.size()) {
+        std::pop_heap(heap.begin(), heap.end(), greater);
+        size_t r = heap.back();
+        const uint64_t *record = &heads[r * record_words];
+        if (last.empty() || !std::equal(record, record + record_words, last.begin())) {
+            last.assign(record, record + record_words);
+            callback(last.data());
+        }
+
+        if (next(r)) {
+            std::push_heap(heap.begin(), heap.end(), greater);
+        } else {
+            heap.pop_back();
+        }
+    }
+}
+
+size_t PreciseAnnotationBuilder::merge(const RowCallback &callback) {
+    flush();
+
+    const size_t length = graph_.get_k() + 1;
+    std::vector<uint64_t> kmer_words;
+    std::vector<pos_t> columns;
+    size_t num_rows = 0;
+    auto flush_row = [&]() {
+        KMer kmer;
+        std::copy(kmer_words.begin(), kmer_words.end(), kmer.data());
+        callback(kmer.to_string(length), columns);
+        num_rows++;
+    };
+
+    merge_runs(&runs_, num_words_ + 1, [&](const uint64_t *pair) {
+        if (kmer_words.empty()
+                || !std::equal(pair, pair + num_words_, kmer_words.begin())) {
+            if (kmer_words.size())
+                flush_row();
+            kmer_words.assign(pair, pair + num_words_);
+            columns.clear();
+        }
+        // the pairs without a column only add the k-mer, and sort last
+        pos_t column = pair[num_words_];
+        if (column < static_cast<pos_t>(-1))
+            columns.push_back(column);
+    });
+    if (kmer_words.size())
+        flush_row();
+
+    return num_rows;
+}
+
+uint64_t PreciseAnnotationBuilder::serialize(const std::string &filename) {
+    // the rows are merged in the order of the k-mers, so their (edge, column)
+    // pairs are sorted in runs again to be written in the order of the edges
+    std::vector<size_t> edge_runs;
+    merge([&](const std::string &kmer, const std::vector<pos_t> &columns) {
+        auto edge_index = graph_.map_kmer(kmer);
+        if (edge_index < graph_.first_edge() || edge_index > graph_.last_edge())
+            return;
+
+        for (auto column : columns) {
+            if (buffer_.size() >= max_pairs_ * 2)
+                edge_runs.push_back(write_run(2));
+
+            buffer_.push_back(edge_index - graph_.first_edge());
+            buffer_.push_back(column);
+        }
+    });
+    if (buffer_.size())
+        edge_runs.push_back(write_run(2));
+
+    std::ofstream out(filename);
+    PreciseRowWriter writer(out, prefix_indices_, num_columns_, graph_.get_num_edges());
+
+    // the edges without k-mers in the runs get empty rows
+    uint64_t row = 0;
+    std::vector<pos_t> columns;
+    merge_runs(&edge_runs, 2, [&](const uint64_t *pair) {
+        for (; row < pair[0]; ++row) {
+            writer.write_row(columns);
+            columns.clear();
+        }
+        columns.push_back(pair[1]);
+    });
+    for (; row < graph_.get_num_edges(); ++row) {
+        writer.write_row(columns);
+        columns.clear();
+    }
+
+    for (auto run : edge_runs) {
+        std::remove(get_run_filename(run).c_str());
+    }
+    return writer.finish();
+}
+
+} // namespace hash_annotate
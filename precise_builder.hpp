@@ -0,0 +1,107 @@
+#ifndef __PRECISE_BUILDER_HPP__
+#define __PRECISE_BUILDER_HPP__
+
+#include <string>
+#include <vector>
+#include <set>
+#include <functional>
+
+#include "dbg_bloom_annotator.hpp"
+
+
+namespace hash_annotate {
+
+/**
+ * Disk-backed construction of the precise annotation. The (packed k-mer,
+ * column) pairs are buffered up to a memory budget, then sorted and written
+ * to a run file. When the sequences are added, the runs are merged into the
+ * rows of the annotation in the order of the packed k-mers, which are
+ * passed to a callback or written as a .precise.dbg file in the order of
+ * the edges of the graph. For the latter, the (edge, column) pairs go
+ * through sorted runs as well, so that no structure of the size of the
+ * annotation or the graph is kept in memory.
+ */
+class PreciseAnnotationBuilder {
+  public:
+    typedef std::function<void(const std::string &kmer,
+                               const std::vector<pos_t> &columns)> RowCallback;
+
+    // The number of runs read at once by default
+    static constexpr size_t kMaxMergeRuns = 64;
+
+    // The runs are written to |run_prefix|.0, |run_prefix|.1, ... and
+    // removed with the builder. The buffer takes at most |memory_budget|
+    // bytes. When there are more than |max_merge_runs| runs, they are
+    // first merged into fewer runs in passes.
+    PreciseAnnotationBuilder(const DeBruijnGraphWrapper &graph,
+                             const std::string &run_prefix,
+                             size_t memory_budget,
+                             size_t max_merge_runs = kMaxMergeRuns);
+
+    ~PreciseAnnotationBuilder();
+
+    // Same as PreciseHashAnnotator::add_sequence
+    void add_sequence(const std::string &sequence,
+                      pos_t column = static_cast<pos_t>(-1),
+                      bool rooted = false);
+
+    void make_column_prefix(pos_t i) { prefix_indices_.insert(i); }
+
+    size_t num_columns() const { return num_columns_; }
+
+    size_t num_prefix_columns() const { return prefix_indices_.size(); }
+
+    // The number of runs written from the added sequences
+    size_t num_runs() const { return num_runs_; }
+
+    // Merge the runs, calling |callback| with each k-mer and its sorted
+    // columns. Returns the number of k-mers.
+    size_t merge(const RowCallback &callback);
+
+    // Merge the runs into a file in the format of PreciseHashAnnotator.
+    // The graph must have all the k-mers by then.
+    uint64_t serialize(const std::string &filename);
+
+  private:
+    typedef std::function<void(const uint64_t *record)> RecordCallback;
+
+    // Sort the buffered pairs and write them to a new run
+    void flush();
+
+    // Sort the buffered records of |record_words| words, write the distinct
+    // ones to a new run and return its number
+    size_t write_run(size_t record_words);
+
+    // Call |callback| with the distinct records of the sorted |runs| in
+    // order. The runs above max_merge_runs_ are merged in passes first,
+    // which replace them in |runs|.
+    void merge_runs(std::vector<size_t> *runs,
+                    size_t record_words,
+                    const RecordCallback &callback);
+
+    // Merge the runs |run_ids| at once
+    void merge_group(const std::vector<size_t> &run_ids,
+                     size_t record_words,
+                     const RecordCallback &callback) const;
+
+    std::string get_run_filename(size_t i) const;
+
+    const DeBruijnGraphWrapper &graph_;
+    std::string run_prefix_;
+    // Each pair takes the words of the k-mer and one more for the column
+    size_t num_words_;
+    size_t max_pairs_;
+    size_t max_merge_runs_;
+    std::vector<uint64_t> buffer_;
+    size_t num_runs_ = 0;
+    // The runs of the pairs, and the number of the next run file
+    std::vector<size_t> runs_;
+    size_t next_run_ = 0;
+
+    pos_t num_columns_ = 0;
+    std::set<pos_t> prefix_indices_;
+};
+
+} // namespace hash_annotate
+
+#endif // __PRECISE_BUILDER_HPP__
@@ -6,6 +6,7 @@
 #include <iostream>
 #include <string>
 #include <unordered_map>
+#include <stdexcept>
 
 
 namespace serialization {
@@ -28,6 +29,47 @@ namespace serialization {
 
     std::unordered_map<std::string, size_t> loadStringMap(std::istream &in);
 
+    /**
+     * Arrays stored as raw bytes in the native byte order and padded to
+     * a multiple of 8 bytes, so that they can be used in place from a
+     * memory-mapped file.
+     */
+    inline size_t rawArraySize(size_t num_bytes) {
+        return (num_bytes + 7) / 8 * 8;
+    }
+
+    template <typename T>
+    uint64_t serializeRawArray(std::ostream &out, const T *data, size_t size) {
+        const char padding[8] = {};
+        size_t num_bytes = size * sizeof(T);
+        out.write(reinterpret_cast<const char*>(data), num_bytes);
+        out.write(padding, rawArraySize(num_bytes) - num_bytes);
+        return rawArraySize(num_bytes);
+    }
+
+    template <typename T>
+    std::vector<T> loadRawArray(std::istream &in, size_t size) {
+        std::vector<T> array(size);
+        size_t num_bytes = size * sizeof(T);
+        in.read(reinterpret_cast<char*>(array.data()), num_bytes);
+        in.ignore(rawArraySize(num_bytes) - num_bytes);
+        if (!in.good())
+            throw std::runtime_error("Can't load array");
+        return array;
+    }
+
+    // Returns a pointer to the array starting at |data|
+    // and moves |data| past its end
+    template <typename T>
+    const T* mapRawArray(const char *&data, const char *end, size_t size) {
+        size_t num_bytes = rawArraySize(size * sizeof(T));
+        if (data + num_bytes > end)
+            throw std::runtime_error("Can't map array");
+        const T *array = reinterpret_cast<const T*>(data);
+        data += num_bytes;
+        return array;
+    }
+
 } // namespace serialization
 
 #endif // __SERIALIZATION_HPP__
@@ -3,6 +3,8 @@
 #include <string>
 #include <set>
 #include <map>
+#include <thread>
+#include <mutex>
 
 #include "gtest/gtest.h"
 #include "dbg_bloom_annotator.hpp"
@@ -10,6 +12,7 @@
 #include "serialization.hpp"
 #include "hashers.hpp"
 #include "dbg_hash.hpp"
+#include "precise_builder.hpp"
 
 const std::string test_data_dir = "../tests/data";
 const std::string test_dump_basename = test_data_dir + "/dump_test";
@@ -33,6 +36,14 @@ std::vector<std::string> generate_kmers(size_t num, size_t k = 82) {
     return kmers;
 }
 
+std::string reverse_complement(const std::string &sequence) {
+    std::string reverse(sequence.rbegin(), sequence.rend());
+    for (char &c : reverse) {
+        c = hash_annotate::complement(c);
+    }
+    return reverse;
+}
+
 TEST(Annotate, RandomTestNoFalseNegative) {
     //create annotation
     hash_annotate::BloomHashAnnotation bloom_anno(7);
@@ -154,6 +165,460 @@ TEST(Annotate, BloomHashSerialize) {
 }
 
 
+TEST(Annotate, BlockedBloomFilter) {
+    hash_annotate::BlockedBloomHashAnnotation bloom_anno(7);
+    hash_annotate::BlockedBloomFilter bloom(num_random_kmers * 10);
+    hash_annotate::BlockedBloomFilter empty(num_random_kmers);
+    auto kmers = generate_kmers(num_random_kmers);
+    size_t fp = 0;
+    for (size_t i = 0; i < kmers.size(); ++i) {
+        auto hash = bloom_anno.compute_hash(kmers[i].data(), kmers[i].data() + kmers[i].length());
+        if (i < kmers.size() / 2) {
+            bloom.insert(hash);
+            ASSERT_TRUE(bloom.find(hash));
+        } else {
+            fp += bloom.find(hash);
+        }
+        ASSERT_FALSE(empty.find(hash));
+    }
+    EXPECT_GT(kmers.size() / 20, fp);
+    EXPECT_EQ(0, empty.occupancy());
+
+    // copies realign the blocks
+    std::vector<hash_annotate::BlockedBloomFilter> copies(9, bloom);
+    for (auto &copy : copies) {
+        EXPECT_EQ(bloom, copy);
+        for (size_t i = 0; i < kmers.size() / 2; ++i) {
+            ASSERT_TRUE(copy.find(bloom_anno.compute_hash(
+                kmers[i].data(), kmers[i].data() + kmers[i].length()
+            )));
+        }
+    }
+    EXPECT_NE(empty, bloom);
+
+    std::ofstream outstream(test_dump_basename + "_bloomser");
+    bloom.serialize(outstream);
+    outstream.close();
+
+    std::ifstream instream(test_dump_basename + "_bloomser");
+    hash_annotate::BlockedBloomFilter bloom_alt(1);
+    bloom_alt.load(instream);
+    EXPECT_EQ(bloom, bloom_alt);
+}
+
+TEST(Annotate, RibbonFilter) {
+    hash_annotate::BloomHashAnnotation hasher(1);
+    auto kmers = generate_kmers(num_random_kmers);
+    std::vector<uint64_t> keys;
+    for (size_t i = 0; i < kmers.size() / 2; ++i) {
+        keys.push_back(hash_annotate::RibbonFilter::get_key(hasher.compute_hash(kmers[i])));
+    }
+    // repeated keys are inserted once
+    keys.push_back(keys.front());
+
+    hash_annotate::RibbonFilter empty;
+    empty.build({}, 6);
+    EXPECT_EQ(0u, empty.size());
+
+    hash_annotate::RibbonFilter ribbon;
+    ribbon.build(keys, 6);
+    EXPECT_GT(keys.size() * 8, ribbon.size());
+    size_t fp = 0;
+    for (size_t i = 0; i < kmers.size(); ++i) {
+        auto hash = hasher.compute_hash(kmers[i]);
+        if (i < kmers.size() / 2) {
+            ASSERT_TRUE(ribbon.find(hash)) << i;
+        } else {
+            fp += ribbon.find(hash);
+        }
+        ASSERT_FALSE(empty.find(hash));
+    }
+    // the expected rate is 1/64
+    EXPECT_GT(kmers.size() / 2 / 32, fp);
+    EXPECT_NE(empty, ribbon);
+
+    std::ofstream outstream(test_dump_basename + "_ribbonser");
+    ribbon.serialize(outstream);
+    outstream.close();
+
+    std::ifstream instream(test_dump_basename + "_ribbonser");
+    hash_annotate::RibbonFilter ribbon_alt;
+    ribbon_alt.load(instream);
+    EXPECT_EQ(ribbon, ribbon_alt);
+}
+
+TEST(Annotate, RibbonFilterSmall) {
+    hash_annotate::BloomHashAnnotation hasher(1);
+    auto kmers = generate_kmers(200);
+    // the segments of fewer than 64 keys grow by whole blocks
+    for (size_t num_keys : { 1, 2, 40, 63, 64, 65, 130 }) {
+        std::vector<uint64_t> keys;
+        for (size_t i = 0; i < num_keys; ++i) {
+            keys.push_back(hash_annotate::RibbonFilter::get_key(hasher.compute_hash(kmers[i])));
+        }
+        hash_annotate::RibbonFilter ribbon;
+        ribbon.build(keys, 8);
+        for (size_t i = 0; i < num_keys; ++i) {
+            ASSERT_TRUE(ribbon.find(hasher.compute_hash(kmers[i]))) << num_keys << " " << i;
+        }
+    }
+}
+
+TEST(Annotate, BitSlicedAnnotation) {
+    hash_annotate::BloomHashAnnotation hasher(5);
+    hash_annotate::BitSlicedAnnotation annotation(5);
+    annotation.resize(1);
+    annotation.resize_column(0, num_random_kmers * 100);
+    auto kmers = generate_kmers(num_random_kmers);
+
+    // the rows get wider when adding the columns
+    size_t num_columns = 150;
+    for (size_t i = 0; i < kmers.size(); ++i) {
+        if (i % num_columns >= annotation.size())
+            annotation.resize(i % num_columns + 1);
+        annotation.insert(hasher.compute_hash(kmers[i]), i % num_columns);
+    }
+    ASSERT_EQ(num_columns, annotation.size());
+    ASSERT_EQ(3u, annotation.num_words());
+
+    // the filter can't be resized after the insertions
+    annotation.resize_column(1, num_random_kmers * 1000);
+    EXPECT_EQ(num_random_kmers * 100, annotation.column_size(1));
+
+    size_t num_fp = 0;
+    for (size_t i = 0; i < kmers.size(); ++i) {
+        auto annot = annotation.find(hasher.compute_hash(kmers[i]));
+        ASSERT_TRUE(hash_annotate::test_bit(annot, i % num_columns));
+        num_fp += hash_annotate::popcount(annot) - 1;
+    }
+    EXPECT_GT(kmers.size(), num_fp);
+
+    std::ofstream out(test_dump_basename + "_bitsliced");
+    annotation.serialize(out);
+    out.close();
+
+    hash_annotate::BitSlicedAnnotation loaded(5);
+    std::ifstream in(test_dump_basename + "_bitsliced");
+    loaded.load(in);
+    EXPECT_EQ(annotation.size(), loaded.size());
+    EXPECT_EQ(annotation.column_size(0), loaded.column_size(0));
+    for (auto &kmer : kmers) {
+        auto hash = hasher.compute_hash(kmer);
+        ASSERT_EQ(annotation.find(hash), loaded.find(hash));
+    }
+}
+
+TEST(Annotate, MaskedFind) {
+    hash_annotate::BloomHashAnnotation hasher(5);
+    auto kmers = generate_kmers(num_random_kmers);
+    size_t num_columns = 100;
+
+    hash_annotate::FilterAnnotation<hash_annotate::BloomFilter> standard(5);
+    hash_annotate::BitSlicedAnnotation bit_sliced(5);
+    for (hash_annotate::MultiHashAnnotation *annotation
+            : std::vector<hash_annotate::MultiHashAnnotation*>{ &standard, &bit_sliced }) {
+        annotation->resize(num_columns);
+        for (size_t j = 0; j < num_columns; ++j) {
+            annotation->resize_column(j, 200);
+        }
+        for (size_t i = 0; i < kmers.size(); ++i) {
+            annotation->insert(hasher.compute_hash(kmers[i]), (i * 7) % num_columns);
+            annotation->insert(hasher.compute_hash(kmers[i]), i % num_columns);
+        }
+
+        std::vector<uint64_t> mask(annotation->num_words(), 0);
+        for (size_t j = 0; j < num_columns; j += 3) {
+            hash_annotate::set_bit(mask, j);
+        }
+        std::vector<uint64_t> annot(annotation->num_words(), ~0llu);
+        for (auto &kmer : kmers) {
+            auto hash = hasher.compute_hash(kmer);
+            auto expected = hash_annotate::merge_and(annotation->find(hash), mask);
+            annotation->find(hash, mask.data(), annot.data());
+            ASSERT_EQ(expected, annot);
+
+            // in place
+            annot = annotation->find(hash);
+            annotation->find(hash, annot.data(), annot.data());
+            ASSERT_EQ(annotation->find(hash), annot);
+        }
+    }
+}
+
+TEST(Annotate, BloomAnnotatorLayouts) {
+    size_t k = 20;
+    auto sequences = generate_kmers(10, 500);
+    for (auto &sequence : sequences) {
+        for (char &c : sequence) {
+            c = "ACGT"[c % 4];
+        }
+    }
+    DBGHash graph(k);
+    hash_annotate::PreciseHashAnnotator precise(graph);
+    for (size_t i = 0; i < sequences.size(); ++i) {
+        graph.add_sequence(sequences[i]);
+        precise.add_sequence(sequences[i], i);
+    }
+
+    for (auto layout : { hash_annotate::BloomAnnotator::STANDARD,
+                         hash_annotate::BloomAnnotator::BLOCKED,
+                         hash_annotate::BloomAnnotator::BIT_SLICED }) {
+        hash_annotate::BloomAnnotator bloom(graph, 0.05, false, layout);
+        bloom.reserve(500);
+        for (size_t i = 0; i < sequences.size(); ++i) {
+            bloom.add_sequence(sequences[i], i);
+        }
+        std::ofstream out(test_dump_basename + "_bloom_layout");
+        bloom.serialize(out);
+        out.close();
+
+        hash_annotate::BloomAnnotator loaded(graph, 0.5);
+        ASSERT_TRUE(loaded.load(test_dump_basename + "_bloom_layout"));
+        EXPECT_EQ(layout, loaded.layout());
+        EXPECT_EQ(sequences.size(), loaded.num_columns());
+
+        for (auto &sequence : sequences) {
+            for (size_t i = 0; i + k < sequence.size(); ++i) {
+                auto kmer = graph.encode_sequence(sequence.substr(i, k + 1));
+                auto precise_annot = precise.annotation_from_kmer(kmer);
+                auto bloom_annot = bloom.annotation_from_kmer(kmer);
+                ASSERT_TRUE(hash_annotate::equal(
+                    hash_annotate::merge_or(bloom_annot, precise_annot), bloom_annot
+                )) << layout << " " << i;
+                auto loaded_annot = loaded.annotation_from_kmer(kmer);
+                ASSERT_TRUE(hash_annotate::equal(
+                    hash_annotate::merge_or(loaded_annot, precise_annot), loaded_annot
+                )) << layout << " " << i;
+            }
+        }
+    }
+}
+
+
+TEST(Annotate, FrozenBloomAnnotator) {
+    size_t k = 20;
+    auto sequences = generate_kmers(10, 500);
+    for (auto &sequence : sequences) {
+        for (char &c : sequence) {
+            c = "ACGT"[c % 4];
+        }
+    }
+    DBGHash graph(k);
+    hash_annotate::PreciseHashAnnotator precise(graph);
+    for (size_t i = 0; i < sequences.size(); ++i) {
+        graph.add_sequence(sequences[i], i % 2);
+        precise.add_sequence(sequences[i], i, i % 2);
+    }
+
+    for (size_t num_threads : { 1, 3 }) {
+        hash_annotate::BloomAnnotator bloom(graph, 0.05);
+        for (size_t i = 0; i < sequences.size(); ++i) {
+            bloom.add_sequence(sequences[i], i);
+        }
+        size_t bloom_size = 0;
+        for (size_t i = 0; i < bloom.num_columns(); ++i) {
+            bloom_size += bloom.get_size(i);
+        }
+
+        bloom.freeze(precise, 0, num_threads);
+        EXPECT_EQ(hash_annotate::BloomAnnotator::FROZEN, bloom.layout());
+        EXPECT_EQ(sequences.size(), bloom.num_columns());
+        size_t frozen_size = 0;
+        for (size_t i = 0; i < bloom.num_columns(); ++i) {
+            frozen_size += bloom.get_size(i);
+        }
+        EXPECT_GT(bloom_size, frozen_size);
+
+        std::ofstream out(test_dump_basename + "_bloom_frozen");
+        bloom.serialize(out);
+        out.close();
+        hash_annotate::BloomAnnotator loaded(graph, 0.5);
+        ASSERT_TRUE(loaded.load(test_dump_basename + "_bloom_frozen"));
+        EXPECT_EQ(hash_annotate::BloomAnnotator::FROZEN, loaded.layout());
+
+        size_t num_edges = 0;
+        size_t num_fp = 0;
+        for (size_t i = graph.first_edge(); i <= graph.last_edge(); ++i) {
+            if (graph.is_dummy_edge(graph.get_node_kmer(i) + graph.get_edge_label(i)))
+                continue;
+
+            auto frozen_annot = bloom.get_annotation(i);
+            auto precise_annot = precise.annotate_edge(i);
+            precise_annot.resize(frozen_annot.size());
+            ASSERT_TRUE(hash_annotate::equal(
+                hash_annotate::merge_or(frozen_annot, precise_annot), frozen_annot
+            )) << i;
+            ASSERT_EQ(frozen_annot, loaded.get_annotation(i)) << i;
+            num_edges++;
+            num_fp += hash_annotate::popcount(frozen_annot)
+                        - hash_annotate::popcount(precise_annot);
+        }
+        // at most 1/32 per column
+        EXPECT_GT(num_edges * bloom.num_columns() / 20, num_fp);
+    }
+}
+
+TEST(Annotate, ParallelBloomConstruction) {
+    size_t k = 20;
+    auto sequences = generate_kmers(200, 150);
+    std::vector<std::vector<size_t>> columns(sequences.size());
+    std::vector<size_t> num_elements(sequences.size());
+    for (size_t i = 0; i < sequences.size(); ++i) {
+        for (char &c : sequences[i]) {
+            c = "ACGT"[c % 4];
+        }
+        // short sequences and sequences without labels are skipped
+        sequences[i].resize(i % 13 ? 50 + i % 100 : 10);
+        for (size_t j = 0; j < i % 3; ++j) {
+            columns[i].push_back((i * 7 + j) % 70);
+        }
+        num_elements[i] = i % 5 ? 0 : 300;
+    }
+    DBGHash graph(k);
+
+    for (auto layout : { hash_annotate::BloomAnnotator::STANDARD,
+                         hash_annotate::BloomAnnotator::BLOCKED,
+                         hash_annotate::BloomAnnotator::BIT_SLICED }) {
+        hash_annotate::BloomAnnotator serial(graph, 0.05, false, layout);
+        serial.reserve(300);
+        for (size_t i = 0; i < sequences.size(); ++i) {
+            for (size_t column : columns[i]) {
+                serial.add_sequence(sequences[i], column, num_elements[i]);
+            }
+        }
+        std::stringstream serial_stream;
+        serial.serialize(serial_stream);
+
+        for (size_t num_threads : { 1, 2, 5 }) {
+            hash_annotate::BloomAnnotator parallel(graph, 0.05, false, layout);
+            parallel.reserve(300);
+            parallel.add_sequences(sequences, columns, num_threads, num_elements);
+            ASSERT_EQ(serial.num_columns(), parallel.num_columns());
+
+            std::stringstream parallel_stream;
+            parallel.serialize(parallel_stream);
+            EXPECT_EQ(serial_stream.str(), parallel_stream.str())
+                << layout << " " << num_threads;
+        }
+    }
+}
+
+TEST(Annotate, HyperLogLog) {
+    std::mt19937_64 rng(42);
+    for (size_t num_elements : { 0, 10, 1000, 100000 }) {
+        std::vector<uint64_t> hashes(num_elements);
+        for (auto &hash : hashes) {
+            hash = rng();
+        }
+        hash_annotate::HyperLogLog counter, first_half, second_half;
+        for (size_t i = 0; i < hashes.size(); ++i) {
+            // duplicates do not change the estimate
+            counter.insert(hashes[i]);
+            counter.insert(hashes[i / 2]);
+            (i < hashes.size() / 2 ? first_half : second_half).insert(hashes[i]);
+        }
+        EXPECT_NEAR(num_elements, counter.estimate(), num_elements * 0.05 + 1);
+
+        first_half.merge(second_half);
+        EXPECT_EQ(counter.estimate(), first_half.estimate());
+    }
+}
+
+TEST(Annotate, BloomReserveColumn) {
+    size_t k = 20;
+    auto sequences = generate_kmers(20, 500);
+    std::set<std::string> kmers;
+    for (auto &sequence : sequences) {
+        for (char &c : sequence) {
+            c = "ACGT"[c % 4];
+        }
+        for (size_t i = 0; i + k < sequence.size(); ++i) {
+            kmers.insert(sequence.substr(i, k + 1));
+        }
+    }
+    DBGHash graph(k);
+
+    for (auto layout : { hash_annotate::BloomAnnotator::STANDARD,
+                         hash_annotate::BloomAnnotator::BIT_SLICED }) {
+        hash_annotate::BloomAnnotator bloom(graph, 0.05, false, layout);
+        hash_annotate::HyperLogLog counter;
+        for (const auto &sequence : sequences) {
+            // each sequence twice
+            bloom.count_kmers(sequence, &counter);
+            bloom.count_kmers(sequence, &counter);
+        }
+        EXPECT_NEAR(kmers.size(), counter.estimate(), kmers.size() * 0.05);
+
+        bloom.reserve_column(0, kmers.size());
+        size_t size = bloom.get_size(0);
+        EXPECT_NEAR(kmers.size() * bloom.size_factor(), size, 2);
+
+        // the filter is not resized by the first sequence
+        for (const auto &sequence : sequences) {
+            bloom.add_sequence(sequence, 0);
+        }
+        EXPECT_EQ(size, bloom.get_size(0));
+        for (const auto &kmer : kmers) {
+            ASSERT_TRUE(bloom.annotation_from_kmer(kmer)[0] & 1);
+        }
+    }
+}
+
+TEST(Annotate, CanonicalAnnotators) {
+    size_t k = 20;
+    auto sequences = generate_kmers(10, 300);
+    for (auto &sequence : sequences) {
+        for (char &c : sequence) {
+            c = "ACGT"[c % 4];
+        }
+    }
+    DBGHash graph(k, true);
+    hash_annotate::PreciseHashAnnotator precise(graph);
+    for (size_t i = 0; i < sequences.size(); ++i) {
+        graph.add_sequence(sequences[i]);
+        precise.add_sequence(sequences[i], i);
+    }
+
+    for (auto layout : { hash_annotate::BloomAnnotator::STANDARD,
+                         hash_annotate::BloomAnnotator::BIT_SLICED }) {
+        hash_annotate::BloomAnnotator bloom(graph, 0.05, false, layout);
+        bloom.reserve(300);
+        for (size_t i = 0; i < sequences.size(); ++i) {
+            bloom.add_sequence(sequences[i], i);
+        }
+        std::ofstream out(test_dump_basename + "_bloom_canonical");
+        bloom.serialize(out);
+        out.close();
+
+        // the number of hash functions is not serialized
+        hash_annotate::BloomAnnotator loaded(graph, 0.05);
+        ASSERT_TRUE(loaded.load(test_dump_basename + "_bloom_canonical"));
+
+        for (size_t j = 0; j < sequences.size(); ++j) {
+            std::string reverse = reverse_complement(sequences[j]);
+            for (size_t i = 0; i + k < reverse.size(); ++i) {
+                auto kmer = graph.encode_sequence(reverse.substr(i, k + 1));
+                auto precise_annot = precise.annotation_from_kmer(kmer);
+                ASSERT_TRUE(precise_annot[j / 64] & (1llu << (j % 64)));
+                ASSERT_TRUE(hash_annotate::equal(
+                    precise_annot,
+                    precise.annotation_from_kmer(reverse_complement(kmer))
+                ));
+                auto edge = graph.map_kmer(kmer);
+                ASSERT_NE(DBGHash::npos, edge);
+                ASSERT_EQ(1u, precise.annotate_edge_indices(edge).count(j));
+
+                auto bloom_annot = bloom.annotation_from_kmer(kmer);
+                ASSERT_TRUE(hash_annotate::equal(
+                    hash_annotate::merge_or(bloom_annot, precise_annot), bloom_annot
+                )) << layout << " " << i;
+                auto loaded_annot = loaded.annotation_from_kmer(kmer);
+                ASSERT_TRUE(hash_annotate::equal(loaded_annot, bloom_annot));
+            }
+        }
+    }
+}
+
 TEST(Annotate, RandomHashAnnotator) {
     hash_annotate::BloomHashAnnotation bloomhash(7);
     hash_annotate::ExactHashAnnotation exacthash;
@@ -205,6 +670,186 @@ TEST(Annotate, RandomHashAnnotator) {
     }
 }
 
+TEST(Annotate, ExactHashColorClasses) {
+    hash_annotate::ExactHashAnnotation forward;
+    hash_annotate::ExactHashAnnotation backward;
+    auto kmers = generate_kmers(1000);
+    size_t num_columns = 6;
+    // the k-mers get one of four label sets
+    auto in_column = [&](size_t i, size_t j) { return ((i % 4) * 3 + j) % 5 < 2; };
+    for (size_t j = 0; j < num_columns; ++j) {
+        for (size_t i = 0; i < kmers.size(); ++i) {
+            if (in_column(i, j))
+                forward.insert(kmers[i], j);
+            if (in_column(i, num_columns - 1 - j))
+                backward.insert(kmers[i], num_columns - 1 - j);
+        }
+    }
+    EXPECT_EQ(forward, backward);
+    EXPECT_GE(5u + 2 * num_columns, forward.num_classes());
+
+    for (size_t i = 0; i < kmers.size(); ++i) {
+        auto annot = forward.find(kmers[i]);
+        std::vector<hash_annotate::pos_t> indices;
+        for (size_t j = 0; j < num_columns; ++j) {
+            EXPECT_EQ(in_column(i, j), hash_annotate::test_bit(annot, j));
+            EXPECT_EQ(in_column(i, j), hash_annotate::test_bit(forward.find(kmers[i], j), j));
+            if (in_column(i, j))
+                indices.push_back(j);
+        }
+        EXPECT_EQ(indices, forward.find_indices(kmers[i]));
+    }
+    EXPECT_TRUE(forward.find_indices("").empty());
+
+    // inserting a column twice keeps the class
+    auto num_classes = forward.num_classes();
+    forward.insert(kmers[0], 0);
+    forward.insert(kmers[0], 0);
+    forward.insert(kmers[1], -1);
+    EXPECT_EQ(num_classes, forward.num_classes());
+
+    std::stringstream out;
+    forward.serialize(out);
+    hash_annotate::ExactHashAnnotation loaded;
+    loaded.load(out);
+    EXPECT_EQ(forward, loaded);
+    EXPECT_GE(forward.num_classes(), loaded.num_classes());
+}
+
+TEST(Annotate, PreciseAnnotationBuilder) {
+    size_t k = 12;
+    auto sequences = generate_kmers(30, 200);
+    for (auto &sequence : sequences) {
+        for (char &c : sequence) {
+            c = "ACGT"[c % 4];
+        }
+    }
+    for (bool canonical : { false, true }) {
+        DBGHash graph(k, canonical);
+        hash_annotate::PreciseHashAnnotator precise(graph);
+        // a few pairs per run, so that many runs are merged
+        hash_annotate::PreciseAnnotationBuilder builder(
+            graph, test_dump_basename + "_preciseruns", 1000
+        );
+        // the same, with the runs merged three at a time in passes
+        hash_annotate::PreciseAnnotationBuilder builder_passes(
+            graph, test_dump_basename + "_precisepasses", 1000, 3
+        );
+        for (size_t i = 0; i < sequences.size(); ++i) {
+            graph.add_sequence(sequences[i]);
+            if (i % 5) {
+                precise.add_sequence(sequences[i], i % 7);
+                builder.add_sequence(sequences[i], i % 7);
+                builder_passes.add_sequence(sequences[i], i % 7);
+                // sequences added twice or without a column
+                precise.add_sequence(sequences[i / 2], i % 3);
+                builder.add_sequence(sequences[i / 2], i % 3);
+                builder_passes.add_sequence(sequences[i / 2], i % 3);
+            } else {
+                precise.add_sequence(sequences[i]);
+                builder.add_sequence(sequences[i]);
+                builder_passes.add_sequence(sequences[i]);
+            }
+        }
+        precise.make_column_prefix(2);
+        builder.make_column_prefix(2);
+        builder_passes.make_column_prefix(2);
+        EXPECT_LT(10u, builder.num_runs());
+        EXPECT_EQ(builder.num_runs(), builder_passes.num_runs());
+        EXPECT_EQ(precise.num_columns(), builder.num_columns());
+
+        size_t num_rows = 0;
+        builder.merge([&](const std::string &kmer,
+                          const std::vector<hash_annotate::pos_t> &columns) {
+            num_rows++;
+            auto row = precise.annotation_from_kmer(kmer);
+            std::vector<hash_annotate::pos_t> expected;
+            for (size_t j = 0; j < precise.num_columns(); ++j) {
+                if (hash_annotate::test_bit(row, j))
+                    expected.push_back(j);
+            }
+            EXPECT_EQ(expected, columns) << kmer;
+        });
+        EXPECT_EQ(precise.size(), num_rows);
+
+        builder.serialize(test_dump_basename + "_precisebuilt");
+        // the rows are stored in blocks, in the order of the edges
+        std::ifstream in(test_dump_basename + "_precisebuilt");
+        std::set<hash_annotate::pos_t> prefix_indices;
+        size_t num_columns;
+        std::vector<std::vector<hash_annotate::pos_t>> rows;
+        ASSERT_TRUE(hash_annotate::PreciseHashAnnotator::load_rows(
+            in, &prefix_indices, &num_columns, &rows
+        ));
+        EXPECT_EQ(precise.get_prefix(), prefix_indices);
+        EXPECT_EQ(precise.num_columns(), num_columns);
+        ASSERT_EQ(graph.get_num_edges(), rows.size());
+        for (size_t i = 0; i < rows.size(); ++i) {
+            auto indices = precise.annotate_edge_indices(i);
+            EXPECT_EQ(std::vector<hash_annotate::pos_t>(indices.begin(), indices.end()),
+                      rows[i]) << i;
+        }
+
+        hash_annotate::PreciseHashAnnotator loaded(graph);
+        loaded.load(test_dump_basename + "_precisebuilt");
+        EXPECT_EQ(precise, loaded);
+
+        // merged twice, to check that the runs left by the passes are kept
+        for (size_t t = 0; t < 2; ++t) {
+            EXPECT_EQ(precise.size(), builder_passes.merge(
+                [](const std::string&, const std::vector<hash_annotate::pos_t>&) {}
+            ));
+        }
+        builder_passes.serialize(test_dump_basename + "_precisepassesbuilt");
+        std::ifstream built(test_dump_basename + "_precisebuilt");
+        std::ifstream passes(test_dump_basename + "_precisepassesbuilt");
+        EXPECT_EQ(std::string(std::istreambuf_iterator<char>(built), {}),
+                  std::string(std::istreambuf_iterator<char>(passes), {}));
+    }
+}
+
+TEST(Annotate, PreciseSerializeBlocks) {
+    size_t k = 12;
+    // enough edges for more than one block
+    auto sequences = generate_kmers(400, 200);
+    for (auto &sequence : sequences) {
+        for (char &c : sequence) {
+            c = "ACGT"[c % 4];
+        }
+    }
+    for (bool canonical : { false, true }) {
+        DBGHash graph(k, canonical);
+        hash_annotate::PreciseHashAnnotator precise(graph);
+        for (size_t i = 0; i < sequences.size(); ++i) {
+            graph.add_sequence(sequences[i]);
+            if (i % 5) {
+                precise.add_sequence(sequences[i], i % 7);
+                precise.add_sequence(sequences[i], 100 + i % 3);
+            } else {
+                precise.add_sequence(sequences[i]);
+            }
+        }
+        precise.make_column_prefix(3);
+        ASSERT_LT(hash_annotate::PreciseHashAnnotator::kBlockRows, graph.get_num_edges());
+
+        std::stringstream out;
+        precise.serialize(out);
+        for (size_t num_threads : { 1, 3 }) {
+            hash_annotate::PreciseHashAnnotator loaded(graph);
+            std::stringstream in(out.str());
+            loaded.load(in, num_threads);
+            EXPECT_EQ(precise, loaded);
+            EXPECT_EQ(precise.num_columns(), loaded.num_columns());
+            EXPECT_EQ(precise.get_prefix(), loaded.get_prefix());
+        }
+
+        // a truncated annotation is rejected
+        hash_annotate::PreciseHashAnnotator loaded(graph);
+        std::stringstream in(out.str().substr(0, out.str().size() / 2));
+        EXPECT_THROW(loaded.load(in), std::runtime_error);
+    }
+}
+
 TEST(Annotate, HashIterator) {
     std::string test_string;
     for (size_t i = 0; i < 8; ++i) {
@@ -232,6 +877,69 @@ TEST(Annotate, HashIterator) {
     ASSERT_TRUE(hash_it.is_end());
 }
 
+TEST(Annotate, DoubleHashIterator) {
+    std::string test_string = generate_kmers(1, 200)[0];
+    size_t num_hash_functions = 7;
+
+    for (size_t kmer_size : { 1, 20, 64, 65, 100 }) {
+        hash_annotate::DoubleHashIterator hash_it(test_string, kmer_size, num_hash_functions);
+        ASSERT_EQ(num_hash_functions, hash_it->size());
+
+        for (size_t i = 0; i + kmer_size <= test_string.length(); ++i) {
+            ASSERT_FALSE(hash_it.is_end());
+            // rolling gives the same values as hashing the k-mer
+            hash_annotate::DoubleMultiHash hasher(test_string.substr(i, kmer_size),
+                                                  num_hash_functions);
+            ASSERT_EQ(hasher.get_hash(), *hash_it) << kmer_size << " " << i;
+            ASSERT_EQ(num_hash_functions,
+                      std::set<uint64_t>(hash_it->begin(), hash_it->end()).size());
+
+            if (i) {
+                hasher.reverse_update(test_string[i - 1]);
+                hash_annotate::DoubleMultiHash prev(test_string.substr(i - 1, kmer_size),
+                                                    num_hash_functions);
+                ASSERT_EQ(prev.get_hash(), hasher.get_hash()) << kmer_size << " " << i;
+            }
+            ++hash_it;
+        }
+        ASSERT_TRUE(hash_it.is_end());
+    }
+}
+
+TEST(Annotate, CanonicalHashIterator) {
+    std::string test_string = generate_kmers(1, 200)[0];
+    for (char &c : test_string) {
+        c = "ACGT"[c % 4];
+    }
+    size_t num_hash_functions = 7;
+
+    for (size_t kmer_size : { 1, 20, 64, 65, 100 }) {
+        hash_annotate::CanonicalHashIterator hash_it(test_string, kmer_size, num_hash_functions);
+        ASSERT_EQ(num_hash_functions, hash_it->size());
+
+        for (size_t i = 0; i + kmer_size <= test_string.length(); ++i) {
+            ASSERT_FALSE(hash_it.is_end());
+            std::string kmer = test_string.substr(i, kmer_size);
+            hash_annotate::CanonicalMultiHash hasher(kmer, num_hash_functions);
+            ASSERT_EQ(hasher.get_hash(), *hash_it) << kmer_size << " " << i;
+
+            // both strands get the same values
+            hash_annotate::CanonicalMultiHash reverse(reverse_complement(kmer),
+                                                      num_hash_functions);
+            ASSERT_EQ(hasher.get_hash(), reverse.get_hash()) << kmer_size << " " << i;
+
+            if (i) {
+                hasher.reverse_update(test_string[i - 1]);
+                hash_annotate::CanonicalMultiHash prev(test_string.substr(i - 1, kmer_size),
+                                                       num_hash_functions);
+                ASSERT_EQ(prev.get_hash(), hasher.get_hash()) << kmer_size << " " << i;
+            }
+            ++hash_it;
+        }
+        ASSERT_TRUE(hash_it.is_end());
+    }
+}
+
 TEST(Annotate, HashIteratorEmpty) {
     size_t num_hash_functions = 1;
     hash_annotate::CyclicHashIterator hash_it("", 1, num_hash_functions);
@@ -281,6 +989,272 @@ TEST(Annotate, BloomFilter) {
     }
 }
 
+TEST(Annotate, BloomAnnotateSequence) {
+    size_t k = 20;
+    auto sequences = generate_kmers(10, 500);
+    for (auto &sequence : sequences) {
+        for (char &c : sequence) {
+            c = "ACGT"[c % 4];
+        }
+    }
+    DBGHash graph(k);
+    for (size_t i = 0; i < sequences.size(); ++i) {
+        graph.add_sequence(sequences[i]);
+    }
+    hash_annotate::BloomAnnotator bloom(graph, 0.01);
+    for (size_t i = 0; i < sequences.size(); ++i) {
+        bloom.add_sequence(sequences[i], i);
+    }
+
+    // the last k-mers are missing in the graph
+    std::string read = sequences[3].substr(100, 100) + std::string(k, 'N');
+    size_t num_kmers = read.size() - k;
+    std::vector<uint64_t> annotations(num_kmers * bloom.num_words());
+    EXPECT_EQ(100u - k, bloom.annotate_sequence(read, annotations.data()));
+    for (size_t i = 0; i < num_kmers; ++i) {
+        auto expected = i < 100 - k
+            ? bloom.annotation_from_kmer(graph.encode_sequence(read.substr(i, k + 1)))
+            : std::vector<uint64_t>(bloom.num_words(), 0);
+        ASSERT_EQ(expected, std::vector<uint64_t>(
+            annotations.begin() + i * bloom.num_words(),
+            annotations.begin() + (i + 1) * bloom.num_words()
+        )) << i;
+    }
+
+    std::vector<uint64_t> counts(bloom.num_columns(), 0);
+    EXPECT_EQ(100u - k, bloom.count_labels(read, counts.data()));
+    EXPECT_EQ(100u - k, counts[3]);
+    for (size_t i = 0; i < counts.size(); ++i) {
+        EXPECT_GE(100u - k, counts[i]);
+    }
+
+    EXPECT_EQ(0u, bloom.count_labels(read.substr(0, k), counts.data()));
+}
+
+TEST(Annotate, WaveletTrieAnnotateSequence) {
+    size_t k = 20;
+    auto sequences = generate_kmers(10, 500);
+    for (auto &sequence : sequences) {
+        for (char &c : sequence) {
+            c = "ACGT"[c % 4];
+        }
+    }
+    DBGHash graph(k);
+    hash_annotate::PreciseHashAnnotator precise(graph);
+    for (size_t i = 0; i < sequences.size(); ++i) {
+        graph.add_sequence(sequences[i]);
+        precise.add_sequence(sequences[i], i);
+    }
+    annotate::WaveletTrieAnnotator wtr(precise, graph);
+
+    std::string read = sequences[3].substr(100, 100) + std::string(k, 'N');
+    size_t num_kmers = read.size() - k;
+    std::vector<uint64_t> annotations(num_kmers * wtr.num_words());
+    EXPECT_EQ(100u - k, wtr.annotate_sequence(read, annotations.data()));
+    for (size_t i = 0; i < num_kmers; ++i) {
+        ASSERT_EQ(wtr.annotation_from_kmer(graph.encode_sequence(read.substr(i, k + 1))),
+                  std::vector<uint64_t>(
+                      annotations.begin() + i * wtr.num_words(),
+                      annotations.begin() + (i + 1) * wtr.num_words()
+                  )) << i;
+    }
+
+    std::vector<uint64_t> counts(wtr.num_columns(), 0);
+    EXPECT_EQ(100u - k, wtr.count_labels(read, counts.data()));
+    for (size_t i = 0; i < counts.size(); ++i) {
+        EXPECT_EQ(i == 3 ? 100u - k : 0u, counts[i]) << i;
+    }
+}
+
+TEST(Annotate, ConcurrentQueries) {
+    size_t k = 20;
+    auto sequences = generate_kmers(10, 500);
+    for (auto &sequence : sequences) {
+        for (char &c : sequence) {
+            c = "ACGT"[c % 4];
+        }
+    }
+    DBGHash graph(k);
+    hash_annotate::PreciseHashAnnotator precise(graph);
+    for (size_t i = 0; i < sequences.size(); ++i) {
+        graph.add_sequence(sequences[i]);
+        precise.add_sequence(sequences[i], i);
+    }
+    hash_annotate::BloomAnnotator bloom(graph, 0.1);
+    for (size_t i = 0; i < sequences.size(); ++i) {
+        bloom.add_sequence(sequences[i], i);
+    }
+
+    std::vector<std::vector<uint64_t>> expected;
+    for (size_t i = 0; i < graph.get_num_edges(); ++i) {
+        expected.push_back(bloom.get_annotation_corrected(i, true));
+    }
+
+    // the rank support of the wavelet trie is built by the queries
+    annotate::WaveletTrieAnnotator wtr(precise, graph);
+
+    std::vector<std::thread> threads;
+    std::vector<size_t> num_errors(4, 0);
+    for (size_t t = 0; t < num_errors.size(); ++t) {
+        threads.emplace_back([&, t]() {
+            for (size_t i = 0; i < graph.get_num_edges(); ++i) {
+                num_errors[t] += bloom.get_annotation_corrected(i, true) != expected[i];
+                num_errors[t] += wtr.annotate_edge(i) != precise.annotate_edge(i);
+                num_errors[t] += bloom.annotation_from_kmer(graph.get_node_kmer(i)
+                                                            + graph.get_edge_label(i))
+                                    != bloom.get_annotation(i);
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    for (size_t t = 0; t < num_errors.size(); ++t) {
+        EXPECT_EQ(0u, num_errors[t]) << t;
+    }
+}
+
+TEST(Annotate, BloomDecodeUnitigs) {
+    size_t k = 15;
+    auto sequences = generate_kmers(40, 300);
+    for (size_t i = 0; i < sequences.size(); ++i) {
+        for (char &c : sequences[i]) {
+            c = "ACGT"[c % 4];
+        }
+        // branch off the previous sequence
+        if (i % 4)
+            sequences[i].replace(0, 100, sequences[i - 1], 50, 100);
+    }
+    DBGHash graph(k);
+    for (size_t i = 0; i < sequences.size(); ++i) {
+        graph.add_sequence(sequences[i], i % 2);
+    }
+    hash_annotate::BloomAnnotator bloom(graph, 0.3);
+    for (size_t i = 0; i < sequences.size(); ++i) {
+        bloom.add_sequence(sequences[i], i % 7);
+    }
+
+    std::vector<std::vector<uint64_t>> expected;
+    for (size_t i = graph.first_edge(); i <= graph.last_edge(); ++i) {
+        expected.push_back(bloom.get_annotation_corrected(i, true, -1));
+    }
+
+    for (size_t num_threads : { 1, 3 }) {
+        std::vector<std::vector<uint64_t>> decoded(expected.size());
+        std::mutex mu;
+        bloom.get_annotations_corrected(
+            [&](DBGHash::edge_index i, const uint64_t *row) {
+                std::lock_guard<std::mutex> lock(mu);
+                ASSERT_TRUE(decoded.at(i).empty()) << i;
+                decoded[i].assign(row, row + bloom.num_words());
+            },
+            num_threads
+        );
+        for (size_t i = 0; i < expected.size(); ++i) {
+            EXPECT_EQ(expected[i], decoded[i]) << i << " " << num_threads;
+        }
+    }
+
+    // the edges of canonical graphs may be corrected in either direction,
+    // but all edges are decoded once and the same way by any thread
+    DBGHash canonical_graph(k, true);
+    for (size_t i = 0; i < sequences.size(); ++i) {
+        canonical_graph.add_sequence(sequences[i], i % 2);
+    }
+    hash_annotate::BloomAnnotator canonical(canonical_graph, 0.3);
+    for (size_t i = 0; i < sequences.size(); ++i) {
+        canonical.add_sequence(sequences[i], i % 7);
+    }
+    std::stringstream serial_rows;
+    canonical.export_rows(serial_rows, 1);
+    std::stringstream parallel_rows;
+    canonical.export_rows(parallel_rows, 3);
+    EXPECT_EQ(serial_rows.str(), parallel_rows.str());
+
+    size_t num_decoded = 0;
+    canonical.get_annotations_corrected(
+        [&](DBGHash::edge_index i, const uint64_t *row) {
+            ASSERT_LE(i, canonical_graph.last_edge());
+            num_decoded++;
+            auto raw = canonical.get_annotation(i);
+            for (size_t j = 0; j < raw.size(); ++j) {
+                EXPECT_EQ(0u, row[j] & ~raw[j]) << i;
+            }
+        }
+    );
+    EXPECT_EQ(canonical_graph.get_num_edges(), num_decoded);
+}
+
+TEST(Annotate, BloomEvaluateFP) {
+    size_t k = 15;
+    auto sequences = generate_kmers(40, 300);
+    for (size_t i = 0; i < sequences.size(); ++i) {
+        for (char &c : sequences[i]) {
+            c = "ACGT"[c % 4];
+        }
+        if (i % 4)
+            sequences[i].replace(0, 100, sequences[i - 1], 50, 100);
+    }
+    DBGHash graph(k);
+    for (size_t i = 0; i < sequences.size(); ++i) {
+        graph.add_sequence(sequences[i]);
+    }
+    hash_annotate::BloomAnnotator bloom(graph, 0.3);
+    hash_annotate::PreciseHashAnnotator precise(graph);
+    for (size_t i = 0; i < sequences.size(); ++i) {
+        bloom.add_sequence(sequences[i], i % 7);
+        precise.add_sequence(sequences[i], i % 7);
+    }
+
+    auto total = [](const std::vector<uint64_t> &counts) {
+        return std::accumulate(counts.begin(), counts.end(), uint64_t(0));
+    };
+
+    auto stats = bloom.evaluate_fp(precise);
+    EXPECT_LT(0u, stats.num_edges);
+    EXPECT_LT(0u, stats.fp_pre_bits);
+    EXPECT_EQ(bloom.num_columns(), stats.column_fp.size());
+    EXPECT_EQ(stats.fp_pre_bits, total(stats.column_fp_pre));
+    EXPECT_EQ(stats.fp_bits, total(stats.column_fp));
+    EXPECT_EQ(stats.fn_bits, total(stats.column_fn));
+    EXPECT_EQ(stats.num_edges, total(stats.path_lengths));
+    EXPECT_LE(stats.fp_bits, stats.fp_pre_bits);
+    EXPECT_LE(stats.fp_edges, stats.num_edges);
+
+    size_t num_positives = 0;
+    for (size_t i = graph.first_edge(); i <= graph.last_edge(); ++i) {
+        if (!graph.is_dummy_edge(graph.get_node_kmer(i) + graph.get_edge_label(i))) {
+            auto row = precise.annotate_edge(i);
+            for (auto word : row) {
+                num_positives += __builtin_popcountll(word);
+            }
+        }
+    }
+    EXPECT_EQ(num_positives, total(stats.column_positives));
+
+    for (size_t num_threads : { 2, 3 }) {
+        auto parallel = bloom.evaluate_fp(precise, 0, false, num_threads);
+        EXPECT_EQ(stats.num_edges, parallel.num_edges);
+        EXPECT_EQ(stats.fp_edges, parallel.fp_edges);
+        EXPECT_EQ(stats.fp_pre_edges, parallel.fp_pre_edges);
+        EXPECT_EQ(stats.fn_edges, parallel.fn_edges);
+        EXPECT_EQ(stats.fp_bits, parallel.fp_bits);
+        EXPECT_EQ(stats.num_traversed, parallel.num_traversed);
+        EXPECT_EQ(stats.column_positives, parallel.column_positives);
+        EXPECT_EQ(stats.column_fp, parallel.column_fp);
+        EXPECT_EQ(stats.column_fp_pre, parallel.column_fp_pre);
+        EXPECT_EQ(stats.column_fn, parallel.column_fn);
+        EXPECT_EQ(stats.path_lengths, parallel.path_lengths);
+        // the diagnostics are kept in the order of the edges
+        EXPECT_EQ(stats.messages, parallel.messages);
+        EXPECT_EQ(stats.errors, parallel.errors);
+    }
+
+    auto sampled = bloom.evaluate_fp(precise, 100, false, 3);
+    EXPECT_GE(100u + 1, sampled.num_edges);
+    EXPECT_LT(0u, sampled.num_edges);
+}
+
 TEST(Annotate, WaveletTrie) {
     for (size_t k = 10; k <= 90; k += 10) {
         auto kmers = generate_kmers(num_random_kmers, k + 1);
@@ -538,6 +1512,89 @@ TEST(Annotate, ExportColsWithWithoutRearrange) {
     }
 }
 
+TEST(Annotate, WaveletTrieColumnOrder) {
+    size_t k = 10;
+    auto sequences = generate_kmers(40, 100);
+    for (auto &sequence : sequences) {
+        for (char &c : sequence) {
+            c = "ACGT"[c % 4];
+        }
+    }
+    DBGHash graph(k);
+    hash_annotate::PreciseHashAnnotator precise(graph);
+    // the columns i and i + 5 are set together
+    size_t num_columns = 10;
+    for (size_t i = 0; i < sequences.size(); ++i) {
+        graph.add_sequence(sequences[i]);
+        precise.add_sequence(sequences[i], i % 5);
+        precise.add_sequence(sequences[i], i % 5 + 5);
+        if (i % 3 == 0)
+            precise.add_sequence(sequences[i], (i + 1) % num_columns);
+    }
+    ASSERT_EQ(num_columns, precise.num_columns());
+
+    auto permut_map = annotate::WaveletTrieAnnotator::compute_column_order(precise);
+    ASSERT_EQ(num_columns, permut_map.size());
+    std::vector<size_t> positions(num_columns);
+    for (const auto &pair : permut_map) {
+        ASSERT_GT(num_columns, pair.first);
+        positions[pair.first] = pair.second;
+    }
+    std::vector<size_t> sorted = positions;
+    std::sort(sorted.begin(), sorted.end());
+    for (size_t i = 0; i < num_columns; ++i) {
+        EXPECT_EQ(i, sorted[i]);
+    }
+    // one column of each pair covers all its rows
+    for (size_t i = 0; i < 5; ++i) {
+        EXPECT_GT(5u, std::min(positions[i], positions[i + 5])) << i;
+        EXPECT_LE(5u, std::max(positions[i], positions[i + 5])) << i;
+    }
+
+    std::stringstream precise_out;
+    precise.serialize(precise_out);
+    for (size_t p : { 1, 3 }) {
+        annotate::WaveletTrieAnnotator wtr(precise, graph, p,
+                                           std::unordered_map<size_t, size_t>(permut_map));
+        annotate::WaveletTrieAnnotator wtr_file(graph, p);
+        std::stringstream in(precise_out.str());
+        wtr_file.load_from_precise_file(in, p, true);
+
+        std::stringstream out;
+        wtr.serialize(out);
+        annotate::WaveletTrieAnnotator loaded(graph, p);
+        ASSERT_TRUE(loaded.load(out));
+
+        // the rows have the original columns
+        for (size_t i = 0; i < graph.get_num_edges(); ++i) {
+            auto row = precise.annotate_edge(i);
+            ASSERT_TRUE(hash_annotate::equal(row, wtr.annotate_edge(i))) << i;
+            ASSERT_TRUE(hash_annotate::equal(row, wtr_file.annotate_edge(i))) << i;
+            ASSERT_TRUE(hash_annotate::equal(row, loaded.annotate_edge(i))) << i;
+        }
+        // and the edges with each label
+        for (size_t j = 0; j < num_columns; ++j) {
+            std::vector<hash_annotate::DeBruijnGraphWrapper::edge_index> edges;
+            for (size_t i = 0; i < graph.get_num_edges(); ++i) {
+                auto row = precise.annotate_edge(i);
+                if (annotate::bit_test(row.data(), row.size(), j))
+                    edges.push_back(i);
+            }
+            ASSERT_EQ(edges, loaded.edges_with_label(j)) << j;
+            ASSERT_EQ(edges.size(), loaded.count_edges_with_label(j)) << j;
+        }
+        // and so do the rows exported in a batch
+        size_t begin = graph.get_num_edges() / 4;
+        std::vector<uint64_t> rows((graph.get_num_edges() - begin) * loaded.num_words());
+        loaded.export_rows(begin, graph.get_num_edges(), rows.data());
+        for (size_t i = begin; i < graph.get_num_edges(); ++i) {
+            auto row = loaded.annotate_edge(i);
+            ASSERT_TRUE(std::equal(row.begin(), row.end(),
+                                   &rows[(i - begin) * loaded.num_words()])) << i;
+        }
+    }
+}
+
 //TODO: WRITE A UNIT TEST TO MAKE SURE BLOOM FILTERS ARE SUPERSET OF EXACT FILTER
 /*
 TEST(Annotate, HashIteratorInsert) {
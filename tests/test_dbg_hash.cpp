@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <sstream>
+#include <set>
 
 #include "gtest/gtest.h"
 
@@ -135,3 +137,361 @@ TEST(DBGHash, SimplePathBackwardTraversal) {
         }
     }
 }
+
+TEST(DBGHash, MapKmer) {
+    for (size_t k : { 4, 20, 21, 50 }) {
+        DBGHash graph(k);
+        std::string bases("ACGT");
+        std::string sequence;
+        for (size_t i = 0; i < k * 3 / 2 + 1; ++i) {
+            sequence.push_back(bases[(i * 199 % 163) % bases.size()]);
+        }
+        graph.add_sequence(sequence);
+
+        for (size_t i = graph.first_edge(); i <= graph.last_edge(); ++i) {
+            ASSERT_EQ(i, graph.map_kmer(graph.get_node_kmer(i)
+                                            + graph.get_edge_label(i)));
+        }
+        EXPECT_EQ(DBGHash::edge_index(-1), graph.map_kmer(std::string(k + 1, 'N')));
+        EXPECT_EQ(DBGHash::edge_index(-1), graph.map_kmer(std::string(k + 1, 'X')));
+        EXPECT_THROW(graph.map_kmer(std::string(k, 'A')), std::runtime_error);
+    }
+}
+
+TEST(DBGHash, MapKmers) {
+    for (size_t k : { 4, 20, 21, 50 }) {
+        DBGHash graph(k);
+        std::string bases("ACGT");
+        std::string sequence;
+        for (size_t i = 0; i < k * 5; ++i) {
+            sequence.push_back(bases[(i * 199 % 163) % bases.size()]);
+        }
+        graph.add_sequence(sequence.substr(0, k * 3));
+
+        std::string query = sequence + "XXAC" + sequence.substr(k);
+        std::vector<DBGHash::edge_index> indices(query.size() - k);
+        graph.map_kmers(query, indices.data());
+        for (size_t i = 0; i < indices.size(); ++i) {
+            ASSERT_EQ(graph.map_kmer(graph.encode_sequence(query.substr(i, k + 1))),
+                      indices[i]) << k << " " << i;
+        }
+        EXPECT_NE(DBGHash::npos, indices.front());
+        EXPECT_EQ(DBGHash::npos, indices[sequence.size() - k]);
+
+        graph.map_kmers(std::string(k, 'A'), NULL);
+    }
+}
+
+TEST(DBGHash, SerializeLoad) {
+    DBGHash graph(25);
+    graph.add_sequence("ACGTTGCANNNACGTTTGCAAAGCTAGCTAGGATCGTAGCTAGC");
+    graph.add_sequence("TTTGCAAAGCTAGCTAGGATCGTAGCTAGCACGTTGCA");
+
+    std::stringstream stream;
+    graph.serialize(stream);
+
+    DBGHash loaded(3);
+    ASSERT_TRUE(loaded.load(stream));
+    ASSERT_EQ(graph.get_k(), loaded.get_k());
+    ASSERT_EQ(graph.get_num_edges(), loaded.get_num_edges());
+    for (size_t i = graph.first_edge(); i <= graph.last_edge(); ++i) {
+        EXPECT_EQ(graph.get_node_kmer(i), loaded.get_node_kmer(i));
+        EXPECT_EQ(graph.get_edge_label(i), loaded.get_edge_label(i));
+    }
+}
+
+void test_neighbours(const DBGHash &graph) {
+    std::vector<DBGHash::edge_index> edges;
+    for (size_t i = graph.first_edge(); i <= graph.last_edge(); ++i) {
+        std::string source = graph.get_node_kmer(i);
+        std::string target = (source + graph.get_edge_label(i)).substr(1);
+
+        std::set<DBGHash::edge_index> outgoing, incoming;
+        size_t outdegree = 0;
+        for (size_t j = graph.first_edge(); j <= graph.last_edge(); ++j) {
+            std::string kmer = graph.get_node_kmer(j) + graph.get_edge_label(j);
+            if (kmer.substr(0, graph.get_k()) == target)
+                outgoing.insert(j);
+            if (kmer.substr(1) == source)
+                incoming.insert(j);
+            if (kmer.substr(0, graph.get_k()) == source)
+                outdegree++;
+        }
+
+        graph.get_outgoing_edges(i, edges);
+        EXPECT_EQ(outgoing, std::set<DBGHash::edge_index>(edges.begin(), edges.end()));
+        EXPECT_EQ(outgoing.size(), edges.size());
+        if (edges.size()) {
+            EXPECT_EQ(edges.front(), graph.next_edge(i, graph.get_edge_label(i)));
+        }
+
+        // stepping from the targets of the sibling edges
+        for (char label : std::string("ACGTN$")) {
+            std::string sibling_target = (source + label).substr(1);
+            std::set<DBGHash::edge_index> sibling_outgoing;
+            for (size_t j = graph.first_edge(); j <= graph.last_edge(); ++j) {
+                if (graph.get_node_kmer(j) == sibling_target)
+                    sibling_outgoing.insert(j);
+            }
+            if (sibling_outgoing.size()) {
+                EXPECT_EQ(1u, sibling_outgoing.count(graph.next_edge(i, label)))
+                    << source << " " << label;
+            }
+        }
+
+        graph.get_incoming_edges(i, edges);
+        EXPECT_EQ(incoming, std::set<DBGHash::edge_index>(edges.begin(), edges.end()));
+        EXPECT_EQ(incoming.size(), edges.size());
+        if (edges.size()) {
+            EXPECT_EQ(edges.front(), graph.prev_edge(i));
+        }
+
+        EXPECT_EQ(incoming.size(), graph.get_indegree(i));
+        EXPECT_EQ(outdegree, graph.get_outdegree(i));
+    }
+}
+
+TEST(DBGHash, Neighbours) {
+    for (size_t k : { 1, 3, 4, 24 }) {
+        DBGHash graph(k);
+        graph.add_sequence("AAAACGTAAAAGGTAAAATGC");
+        graph.add_sequence("TGCAAAACGTTTTTTTTTTTTTTTTTTTTTTTTTTTTACGTTCTCTTTT");
+        graph.add_sequence("CCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCC", true);
+        test_neighbours(graph);
+
+        std::stringstream stream;
+        graph.serialize(stream);
+        DBGHash loaded(k);
+        ASSERT_TRUE(loaded.load(stream));
+        test_neighbours(loaded);
+    }
+}
+
+TEST(DBGHash, ParallelConstruction) {
+    std::string bases("ACGTN");
+    for (size_t k : { 3, 12, 31 }) {
+        std::vector<std::string> sequences;
+        for (size_t i = 0; i < 300; ++i) {
+            std::string sequence;
+            for (size_t j = 0; j < (i * 37) % 101; ++j) {
+                sequence.push_back(bases[(i * j * 7 + j * j) % (j % 17 ? 4 : 5)]);
+            }
+            sequences.push_back(sequence);
+        }
+
+        for (size_t num_threads : { 1, 2, 5 }) {
+            DBGHash graph(k);
+            graph.add_sequence(sequences[0]);
+            for (const auto &sequence : sequences) {
+                graph.add_sequence(sequence);
+            }
+
+            DBGHash parallel(k);
+            parallel.add_sequence(sequences[0]);
+            parallel.add_sequences(
+                std::vector<std::string>(sequences.begin(), sequences.begin() + 150),
+                num_threads
+            );
+            parallel.add_sequences(
+                std::vector<std::string>(sequences.begin() + 150, sequences.end()),
+                num_threads
+            );
+
+            ASSERT_EQ(graph.get_num_edges(), parallel.get_num_edges());
+            for (size_t i = graph.first_edge(); i <= graph.last_edge(); ++i) {
+                ASSERT_EQ(graph.get_node_kmer(i), parallel.get_node_kmer(i));
+                ASSERT_EQ(graph.get_edge_label(i), parallel.get_edge_label(i));
+                ASSERT_EQ(graph.get_outdegree(i), parallel.get_outdegree(i));
+                ASSERT_EQ(graph.get_indegree(i), parallel.get_indegree(i));
+                ASSERT_EQ(i, parallel.map_kmer(parallel.get_node_kmer(i)
+                                                + parallel.get_edge_label(i)));
+            }
+            test_neighbours(parallel);
+        }
+    }
+}
+
+TEST(DBGHash, MapFile) {
+    const std::string filename = "../tests/data/dump_test_graph";
+
+    DBGHash graph(21);
+    graph.add_sequence("ACGTTGCANNNACGTTTGCAAAGCTAGCTAGGATCGTAGCTAGC");
+    graph.add_sequence("TTTGCAAAGCTAGCTAGGATCGTAGCTAGCACGTTGCA");
+    graph.serialize(filename);
+
+    DBGHash mapped(3);
+    ASSERT_TRUE(mapped.load(filename));
+    ASSERT_EQ(graph.get_k(), mapped.get_k());
+    ASSERT_EQ(graph.get_num_edges(), mapped.get_num_edges());
+    for (size_t i = graph.first_edge(); i <= graph.last_edge(); ++i) {
+        std::string kmer = graph.get_node_kmer(i) + graph.get_edge_label(i);
+        EXPECT_EQ(kmer, mapped.get_node_kmer(i) + mapped.get_edge_label(i));
+        EXPECT_EQ(i, mapped.map_kmer(kmer));
+        EXPECT_EQ(graph.get_outdegree(i), mapped.get_outdegree(i));
+        EXPECT_EQ(graph.get_indegree(i), mapped.get_indegree(i));
+    }
+    test_neighbours(mapped);
+
+    // overwrite the file the graph is mapped from
+    mapped.serialize(filename);
+
+    // modifying the mapped graph makes a copy
+    size_t num_edges = graph.get_num_edges();
+    graph.add_sequence("GGGGGGGGGGGGGGGGGGGGGGGGGGGGGGGGGGGGGGGGGGGG");
+    mapped.add_sequence("GGGGGGGGGGGGGGGGGGGGGGGGGGGGGGGGGGGGGGGGGGGG");
+    ASSERT_EQ(graph.get_num_edges(), mapped.get_num_edges());
+    test_neighbours(mapped);
+
+    DBGHash reloaded(3);
+    ASSERT_TRUE(reloaded.load(filename));
+    EXPECT_EQ(num_edges, reloaded.get_num_edges());
+    EXPECT_LT(num_edges, graph.get_num_edges());
+
+    EXPECT_FALSE(reloaded.load(filename + ".missing"));
+}
+
+TEST(DBGHash, Freeze) {
+    const std::string filename = "../tests/data/dump_test_graph";
+
+    DBGHash graph(12);
+    graph.add_sequence("AAAACGTAAAAGGTAAAATGCAAAACGTTTTTTTTTTTTTTTTTTTTTTTTT");
+    graph.add_sequence("TGCAAAACGTTTTTTTTTTTTTTTTTTTTTTTTTTTTACGTTCTCTTTT");
+
+    DBGHash frozen = graph;
+    frozen.freeze();
+    ASSERT_TRUE(frozen.is_frozen());
+    test_neighbours(frozen);
+    EXPECT_EQ(DBGHash::edge_index(-1), frozen.map_kmer(std::string(13, 'C')));
+
+    frozen.serialize(filename);
+    DBGHash mapped(3);
+    ASSERT_TRUE(mapped.load(filename));
+    ASSERT_TRUE(mapped.is_frozen());
+    for (size_t i = graph.first_edge(); i <= graph.last_edge(); ++i) {
+        ASSERT_EQ(i, mapped.map_kmer(graph.get_node_kmer(i) + graph.get_edge_label(i)));
+    }
+    test_neighbours(mapped);
+
+    // freeze a mapped graph
+    graph.serialize(filename);
+    DBGHash mapped_frozen(3);
+    ASSERT_TRUE(mapped_frozen.load(filename));
+    ASSERT_FALSE(mapped_frozen.is_frozen());
+    mapped_frozen.freeze();
+    ASSERT_TRUE(mapped_frozen.is_frozen());
+    test_neighbours(mapped_frozen);
+
+    mapped.add_sequence("CCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCC");
+    EXPECT_FALSE(mapped.is_frozen());
+    test_neighbours(mapped);
+}
+
+TEST(DBGHash, Canonical) {
+    const std::string filename = "../tests/data/dump_test_graph";
+
+    auto reverse_complement = [](const std::string &sequence) {
+        std::string reverse(sequence.rbegin(), sequence.rend());
+        for (char &c : reverse) {
+            c = KMer::decode(KMer::complement(KMer::encode(c)));
+        }
+        return reverse;
+    };
+
+    std::string bases("ACGT");
+    for (size_t k : { 3, 12, 21, 31 }) {
+        std::vector<std::string> sequences;
+        for (size_t i = 0; i < 20; ++i) {
+            std::string sequence;
+            for (size_t j = 0; j < k + 5 + (i * 37) % 71; ++j) {
+                sequence.push_back(bases[(i * j * 7 + j * j) % 4]);
+            }
+            sequences.push_back(sequence);
+        }
+
+        // the graph of both strands
+        DBGHash graph(k);
+        DBGHash canonical(k, true);
+        ASSERT_TRUE(canonical.is_canonical());
+        for (const auto &sequence : sequences) {
+            graph.add_sequence(sequence, true);
+            graph.add_sequence(reverse_complement(sequence), true);
+            canonical.add_sequence(sequence, true);
+        }
+        DBGHash parallel(k, true);
+        parallel.add_sequences(sequences, 3, true);
+        ASSERT_EQ(canonical.get_num_edges(), parallel.get_num_edges());
+        EXPECT_GT(graph.get_num_edges(), canonical.get_num_edges());
+
+        std::stringstream stream;
+        canonical.serialize(stream);
+        DBGHash loaded(3);
+        ASSERT_TRUE(loaded.load(stream));
+        ASSERT_TRUE(loaded.is_canonical());
+
+        canonical.serialize(filename);
+        DBGHash mapped(3);
+        ASSERT_TRUE(mapped.load(filename));
+        ASSERT_TRUE(mapped.is_canonical());
+
+        std::vector<DBGHash::edge_index> edges;
+        for (const DBGHash *tested : { &canonical, &parallel, &loaded, &mapped }) {
+            auto get_kmer = [&](DBGHash::edge_index i) {
+                return tested->get_node_kmer(i) + tested->get_edge_label(i);
+            };
+            // the edge of the k-mer in its orientation
+            auto oriented = [&](const std::string &kmer) {
+                auto i = tested->map_kmer(kmer);
+                return get_kmer(i) == kmer ? i : i | DBGHash::kReverse;
+            };
+
+            for (size_t i = graph.first_edge(); i <= graph.last_edge(); ++i) {
+                std::string kmer = graph.get_node_kmer(i) + graph.get_edge_label(i);
+                ASSERT_NE(DBGHash::npos, tested->map_kmer(kmer)) << kmer;
+                ASSERT_EQ(tested->map_kmer(kmer),
+                          tested->map_kmer(reverse_complement(kmer)));
+
+                auto j = oriented(kmer);
+                ASSERT_EQ(kmer, get_kmer(j));
+                EXPECT_EQ(graph.get_outdegree(i), tested->get_outdegree(j)) << kmer;
+                EXPECT_EQ(graph.get_indegree(i), tested->get_indegree(j)) << kmer;
+
+                std::set<std::string> expected, outgoing;
+                graph.get_outgoing_edges(i, edges);
+                for (auto e : edges) {
+                    expected.insert(graph.get_node_kmer(e) + graph.get_edge_label(e));
+                }
+                tested->get_outgoing_edges(j, edges);
+                for (auto e : edges) {
+                    outgoing.insert(get_kmer(e));
+                }
+                EXPECT_EQ(expected, outgoing) << kmer;
+
+                std::set<std::string> incoming;
+                expected.clear();
+                graph.get_incoming_edges(i, edges);
+                for (auto e : edges) {
+                    expected.insert(graph.get_node_kmer(e) + graph.get_edge_label(e));
+                }
+                tested->get_incoming_edges(j, edges);
+                for (auto e : edges) {
+                    incoming.insert(get_kmer(e));
+                }
+                EXPECT_EQ(expected, incoming) << kmer;
+
+                auto next = tested->next_edge(j, kmer.back());
+                if (graph.get_outdegree(i)) {
+                    ASSERT_NE(DBGHash::npos, next);
+                    EXPECT_EQ(get_kmer(next).substr(0, k), kmer.substr(1));
+                }
+            }
+        }
+
+        // mapping a sequence gives the same edges as mapping its reverse complement
+        std::vector<DBGHash::edge_index> forward(sequences[0].size() - k);
+        std::vector<DBGHash::edge_index> reverse(forward.size());
+        canonical.map_kmers(sequences[0], forward.data());
+        canonical.map_kmers(reverse_complement(sequences[0]), reverse.data());
+        std::reverse(reverse.begin(), reverse.end());
+        EXPECT_EQ(forward, reverse);
+    }
+}
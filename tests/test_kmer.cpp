@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <sstream>
+#include <set>
+
+#include "gtest/gtest.h"
+
+#include "kmer.hpp"
+#include "kmer_mphf.hpp"
+
+
+TEST(KMer, PackUnpack) {
+    std::string alphabet("$ACGTN");
+    for (size_t length = 1; length <= KMer::kMaxLength; ++length) {
+        std::string sequence;
+        for (size_t i = 0; i < length; ++i) {
+            sequence.push_back(alphabet[(i * 199 % 163) % alphabet.size()]);
+        }
+        KMer kmer;
+        ASSERT_TRUE(kmer.pack(sequence.data(), length));
+        EXPECT_EQ(sequence, kmer.to_string(length));
+    }
+}
+
+TEST(KMer, PackInvalid) {
+    KMer kmer;
+    EXPECT_FALSE(kmer.pack("ACGXT", 5));
+    EXPECT_FALSE(kmer.pack("acgt", 4));
+}
+
+TEST(KMer, ShiftForwardBackward) {
+    std::string alphabet("ACGT");
+    for (size_t length = 2; length <= KMer::kMaxLength; length += 5) {
+        std::string sequence;
+        for (size_t i = 0; i < length + 1; ++i) {
+            sequence.push_back(alphabet[(i * 199 % 163) % alphabet.size()]);
+        }
+        KMer first, second;
+        first.pack(sequence.data(), length);
+        second.pack(sequence.data() + 1, length);
+
+        KMer shifted = first;
+        shifted.shift_forward(length, KMer::encode(sequence.back()));
+        EXPECT_EQ(second.to_string(length), shifted.to_string(length));
+        EXPECT_EQ(second.hash(KMer::num_words(length)),
+                  shifted.hash(KMer::num_words(length)));
+
+        shifted.shift_backward(length, KMer::encode(sequence.front()));
+        EXPECT_EQ(first.to_string(length), shifted.to_string(length));
+        EXPECT_EQ(first.hash(KMer::num_words(length)),
+                  shifted.hash(KMer::num_words(length)));
+    }
+}
+
+TEST(KMer, ReverseComplement) {
+    std::string alphabet("$ACGTN");
+    for (size_t length : { 1, 2, 20, 21, 22, 63, 100 }) {
+        std::string sequence;
+        for (size_t i = 0; i < length; ++i) {
+            sequence.push_back(alphabet[(i * 199 % 163) % alphabet.size()]);
+        }
+        std::string reverse(sequence.rbegin(), sequence.rend());
+        for (char &c : reverse) {
+            c = KMer::decode(KMer::complement(KMer::encode(c)));
+        }
+
+        KMer kmer;
+        ASSERT_TRUE(kmer.pack(sequence.data(), length));
+        kmer.reverse_complement(length);
+        EXPECT_EQ(reverse, kmer.to_string(length));
+
+        KMer packed;
+        packed.pack(reverse.data(), length);
+        EXPECT_FALSE(kmer < packed);
+        EXPECT_FALSE(packed < kmer);
+    }
+}
+
+TEST(KMerHashTable, InsertFind) {
+    for (size_t length : { 5, 21, 22, 63, 100 }) {
+        KMerHashTable table(length);
+        std::string alphabet("ACGTN$");
+        std::string sequence;
+        for (size_t i = 0; i < 2000 + length; ++i) {
+            sequence.push_back(alphabet[(i * i * 31 + i / 7) % alphabet.size()]);
+        }
+        std::vector<uint64_t> indices;
+        for (size_t i = 0; i + length <= sequence.size(); ++i) {
+            KMer kmer;
+            kmer.pack(sequence.data() + i, length);
+            auto inserted = table.emplace(kmer);
+            ASSERT_EQ(inserted.first, table.find(kmer));
+            if (inserted.second) {
+                ASSERT_EQ(table.size(), inserted.first + 1);
+            }
+            ASSERT_FALSE(table.emplace(kmer).second);
+            indices.push_back(inserted.first);
+        }
+        for (size_t i = 0; i + length <= sequence.size(); ++i) {
+            KMer kmer;
+            kmer.pack(sequence.data() + i, length);
+            ASSERT_EQ(indices[i], table.find(kmer));
+            ASSERT_EQ(sequence.substr(i, length),
+                      table[indices[i]].to_string(length));
+        }
+        KMer absent;
+        std::string missing(length, 'A');
+        missing.back() = 'X';
+        ASSERT_FALSE(absent.pack(missing.data(), length));
+        missing.back() = '$';
+        missing.front() = 'G';
+        absent.pack(missing.data(), length);
+        if (sequence.find(missing) == std::string::npos) {
+            EXPECT_EQ(KMerHashTable::npos, table.find(absent));
+        }
+    }
+}
+
+TEST(KMerHashTable, SerializeLoad) {
+    KMerHashTable table(30);
+    std::string sequence = "$$$ACGTTGCANNNACGTTTGCAAAGCTAGCTAGGATCGTAGCTAGC$";
+    for (size_t i = 0; i + 30 <= sequence.size(); ++i) {
+        KMer kmer;
+        kmer.pack(sequence.data() + i, 30);
+        table.emplace(kmer);
+    }
+
+    std::stringstream stream;
+    table.serialize(stream);
+
+    KMerHashTable loaded(30);
+    loaded.load(stream);
+    ASSERT_EQ(table.size(), loaded.size());
+    for (size_t i = 0; i < table.size(); ++i) {
+        EXPECT_EQ(table[i].to_string(30), loaded[i].to_string(30));
+        EXPECT_EQ(i, loaded.find(table[i]));
+    }
+}
+
+KMerHashTable random_table(size_t length, size_t size) {
+    KMerHashTable table(length);
+    std::string alphabet("ACGTN$");
+    std::string sequence;
+    for (size_t i = 0; i < size + length; ++i) {
+        sequence.push_back(alphabet[(i * i * 31 + i / 7) % alphabet.size()]);
+    }
+    for (size_t i = 0; i + length <= sequence.size(); ++i) {
+        KMer kmer;
+        kmer.pack(sequence.data() + i, length);
+        table.emplace(kmer);
+    }
+    return table;
+}
+
+TEST(KMerMPHF, Bijection) {
+    for (size_t length : { 3, 21, 40 }) {
+        for (size_t size : { 0, 1, 2, 100, 5000 }) {
+            KMerHashTable table = random_table(length, size);
+            std::vector<KMer::word_type> kmers;
+            for (size_t i = 0; i < table.size(); ++i) {
+                KMer kmer = table[i];
+                kmers.insert(kmers.end(), kmer.data(),
+                             kmer.data() + KMer::num_words(length));
+            }
+            KMerMPHF mphf(kmers.data(), table.size(), KMer::num_words(length));
+            ASSERT_EQ(table.size(), mphf.size());
+
+            std::set<uint64_t> values;
+            for (size_t i = 0; i < table.size(); ++i) {
+                uint64_t value = mphf(table[i]);
+                ASSERT_LT(value, table.size());
+                values.insert(value);
+            }
+            EXPECT_EQ(table.size(), values.size());
+
+            std::stringstream stream;
+            mphf.serialize(stream);
+            KMerMPHF loaded;
+            loaded.load(stream);
+            for (size_t i = 0; i < table.size(); ++i) {
+                ASSERT_EQ(mphf(table[i]), loaded(table[i]));
+            }
+
+            // used in place, the serialized data is the same
+            std::string data = stream.str();
+            KMerMPHF mapped;
+            ASSERT_EQ(data.data() + data.size(),
+                      mapped.load(data.data(), data.data() + data.size()));
+            for (size_t i = 0; i < table.size(); ++i) {
+                ASSERT_EQ(mphf(table[i]), mapped(table[i]));
+            }
+            std::stringstream mapped_stream;
+            mapped.serialize(mapped_stream);
+            EXPECT_EQ(data, mapped_stream.str());
+        }
+    }
+}
+
+TEST(KMerHashTable, Freeze) {
+    for (size_t length : { 5, 22, 63 }) {
+        KMerHashTable table = random_table(length, 3000);
+        KMerHashTable frozen = table;
+        frozen.freeze();
+        ASSERT_TRUE(frozen.is_frozen());
+        ASSERT_EQ(table.size(), frozen.size());
+        for (size_t i = 0; i < table.size(); ++i) {
+            ASSERT_EQ(i, frozen.find(table[i]));
+        }
+
+        std::string absent(length, 'A');
+        absent.back() = 'T';
+        KMer kmer;
+        kmer.pack(absent.data(), length);
+        EXPECT_EQ(table.find(kmer), frozen.find(kmer));
+
+        std::stringstream stream;
+        frozen.serialize(stream);
+        KMerHashTable loaded(length);
+        loaded.load(stream);
+        ASSERT_TRUE(loaded.is_frozen());
+        for (size_t i = 0; i < table.size(); ++i) {
+            ASSERT_EQ(i, loaded.find(table[i]));
+        }
+
+        // inserting rebuilds the hash table
+        auto inserted = loaded.emplace(kmer);
+        EXPECT_FALSE(loaded.is_frozen());
+        EXPECT_EQ(inserted.first, loaded.find(kmer));
+        for (size_t i = 0; i < table.size(); ++i) {
+            ASSERT_EQ(i, loaded.find(table[i]));
+        }
+    }
+}
@@ -1,8 +1,10 @@
 #include <stdio.h>
+#include <thread>
 
 #include "gtest/gtest.h"
 
 #include "utils.hpp"
+#include "thread_pool.hpp"
 
 
 TEST(get_filetype, VCF) {
@@ -73,3 +75,29 @@ TEST(seq_equal, basics) {
     EXPECT_TRUE(utils::seq_equal(std::string("ABAAACD"), std::string("BAAAACD"), 100));
 }
 
+
+TEST(BoundedQueue, ProducerConsumer) {
+    utils::BoundedQueue<std::vector<size_t>> queue(2);
+
+    std::thread producer([&]() {
+        for (size_t i = 0; i < 1000; ++i) {
+            queue.push(std::vector<size_t>(i % 5, i));
+        }
+        queue.close();
+    });
+
+    std::vector<size_t> batch;
+    size_t count = 0;
+    while (queue.pop(&batch)) {
+        ASSERT_EQ(count % 5, batch.size());
+        for (size_t value : batch) {
+            ASSERT_EQ(count, value);
+        }
+        count++;
+    }
+    producer.join();
+
+    EXPECT_EQ(1000u, count);
+    EXPECT_FALSE(queue.pop(&batch));
+    EXPECT_THROW(queue.push(std::vector<size_t>()), std::runtime_error);
+}
@@ -176,6 +176,56 @@ void check_wtr(annotate::WaveletTrie &wt,
     for (size_t i = 0; i < nums.size(); ++i) {
         ASSERT_EQ(nums.at(i), wt.at(i)) << message << ":" << std::to_string(i) << std::endl;
     }
+    // decoded to fixed-width rows, whole or cut
+    for (size_t num_words : { 1, 2 }) {
+        std::vector<uint64_t> row(num_words);
+        for (size_t i = 0; i < nums.size(); ++i) {
+            wt.at(i, row.data(), num_words);
+            annotate::cpp_int decoded = 0;
+            mpz_import(decoded.backend().data(), num_words, -1, sizeof(uint64_t), 0, 0, row.data());
+            annotate::cpp_int expected = nums.at(i);
+            annotate::clear_after(expected, num_words * 64);
+            ASSERT_EQ(expected, decoded) << message << ":" << std::to_string(i) << std::endl;
+        }
+    }
+    // decoded in batches
+    std::vector<uint64_t> row(2);
+    for (size_t begin : { size_t(0), nums.size() / 3 }) {
+        std::vector<uint64_t> rows((nums.size() - begin) * 2, -1);
+        wt.at_range(begin, nums.size(), rows.data(), 2);
+        for (size_t i = begin; i < nums.size(); ++i) {
+            wt.at(i, row.data(), 2);
+            ASSERT_TRUE(std::equal(row.begin(), row.end(), &rows[(i - begin) * 2]))
+                << message << ":" << std::to_string(i) << std::endl;
+        }
+    }
+    // and by columns
+    annotate::pos_t num_columns = 0;
+    for (const auto &num : nums) {
+        if (num != 0)
+            num_columns = std::max(num_columns, annotate::msb(num) + 1);
+    }
+    for (annotate::pos_t j = 0; j <= num_columns; ++j) {
+        std::vector<size_t> column;
+        for (size_t i = 0; i < nums.size(); ++i) {
+            if (annotate::bit_test(nums.at(i), j))
+                column.push_back(i);
+        }
+        ASSERT_EQ(column, wt.rows_with_bit(j)) << message << ":" << std::to_string(j) << std::endl;
+        ASSERT_EQ(column.size(), wt.count_rows_with_bit(j, 0, nums.size()))
+            << message << ":" << std::to_string(j) << std::endl;
+    }
+    std::vector<size_t> indices;
+    for (size_t i = 0; i < nums.size(); i += 1 + i % 3) {
+        indices.insert(indices.end(), 1 + i % 2, i);
+    }
+    std::vector<uint64_t> rows(indices.size() * 2, -1);
+    wt.at_sorted(indices, rows.data(), 2);
+    for (size_t k = 0; k < indices.size(); ++k) {
+        wt.at(indices[k], row.data(), 2);
+        ASSERT_TRUE(std::equal(row.begin(), row.end(), &rows[k * 2]))
+            << message << ":" << std::to_string(indices[k]) << std::endl;
+    }
 }
 
 // Note: the vector needs to be a copy, since WaveletTrie modifies it
@@ -488,6 +538,93 @@ void dump_wtrs(std::vector<annotate::WaveletTrie> &wtrs) {
     }
 }
 
+TEST(WaveletTrie, WordPrimitives) {
+    std::srand(42);
+    for (size_t t = 0; t < 100; ++t) {
+        const size_t num_words = 3;
+        std::vector<uint64_t> row(num_words, 0);
+        annotate::cpp_int num = 0;
+        for (size_t k = std::rand() % 20; k > 0; --k) {
+            size_t col = std::rand() % (num_words * 64);
+            annotate::bit_set(row.data(), num_words, col);
+            annotate::bit_set(num, col);
+        }
+        for (size_t col = 0; col < num_words * 64; ++col) {
+            ASSERT_EQ(annotate::bit_test(num, col),
+                      annotate::bit_test(row.data(), num_words, col));
+            ASSERT_EQ(annotate::next_bit(num, col),
+                      annotate::next_bit(row.data(), num_words, col));
+        }
+        ASSERT_FALSE(annotate::bit_test(row.data(), num_words, num_words * 64));
+        if (num != 0) {
+            ASSERT_EQ(annotate::msb(num), annotate::msb(row.data(), num_words));
+        }
+
+        // or a shifted number
+        size_t shift = std::rand() % 100;
+        auto shifted = row;
+        annotate::bit_or_shifted(shifted.data(), num_words, num, shift);
+        for (size_t col = 0; col < num_words * 64; ++col) {
+            ASSERT_EQ(annotate::bit_test(row.data(), num_words, col)
+                        || (col >= shift && annotate::bit_test(num, col - shift)),
+                      annotate::bit_test(shifted.data(), num_words, col));
+        }
+
+        size_t col = std::rand() % (num_words * 64);
+        annotate::clear_after(num, col);
+        annotate::clear_after(row.data(), num_words, col);
+        annotate::bit_unset(num, col / 2);
+        annotate::bit_unset(row.data(), num_words, col / 2);
+        for (size_t j = 0; j < num_words * 64; ++j) {
+            ASSERT_EQ(annotate::bit_test(num, j),
+                      annotate::bit_test(row.data(), num_words, j));
+        }
+    }
+}
+
+TEST(WaveletTrie, BatchDecoding) {
+    std::srand(42);
+    std::vector<annotate::cpp_int> nums(5000);
+    for (auto &num : nums) {
+        for (size_t k = std::rand() % 4; k > 0; --k) {
+            annotate::bit_set(num, std::rand() % 8);
+        }
+    }
+    // the trie modifies the rows
+    auto rows_copy = nums;
+    annotate::WaveletTrie wt(rows_copy.begin(), rows_copy.end());
+    check_wtr(wt, nums);
+
+    // columns, from the rows with a bit and from the row ranges
+    for (size_t j = 0; j < 10; ++j) {
+        std::vector<size_t> expected;
+        for (size_t i = 0; i < nums.size(); ++i) {
+            if (annotate::bit_test(nums[i], j))
+                expected.push_back(i);
+        }
+        ASSERT_EQ(expected, wt.rows_with_bit(j)) << j;
+        ASSERT_EQ(expected.size(), wt.count_rows_with_bit(j)) << j;
+        for (size_t begin : { 0, 17, 2500 }) {
+            for (size_t end : { 0, 100, 2501, 5000 }) {
+                size_t count = std::count_if(expected.begin(), expected.end(),
+                                             [&](size_t i) { return begin <= i && i < end; });
+                ASSERT_EQ(count, wt.count_rows_with_bit(j, begin, end)) << j;
+            }
+        }
+    }
+
+    // far apart rows are found with rank queries
+    std::vector<size_t> indices;
+    for (size_t i = 0; i < nums.size(); i += std::rand() % 1000) {
+        indices.push_back(i);
+    }
+    std::vector<uint64_t> rows(indices.size());
+    wt.at_sorted(indices, rows.data(), 1);
+    for (size_t k = 0; k < indices.size(); ++k) {
+        ASSERT_EQ(nums[indices[k]], annotate::cpp_int(rows[k]));
+    }
+}
+
 TEST(WaveletTrie, TestSingle) {
     std::vector<annotate::WaveletTrie> wtrs;
     for (size_t i = 0; i < bits.size(); ++i) {
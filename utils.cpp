@@ -1,6 +1,11 @@
 #include "utils.hpp"
 
 #include <algorithm>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 
 namespace utils {
@@ -33,4 +38,32 @@ std::string get_filetype(const std::string &fname) {
     }
 }
 
+MemoryMap::MemoryMap(const std::string &filename) : data_(NULL), size_(0) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("Can't open file " + filename);
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) < 0) {
+        close(fd);
+        throw std::runtime_error("Can't stat file " + filename);
+    }
+    size_ = file_stat.st_size;
+
+    if (size_) {
+        void *data = mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("Can't map file " + filename);
+        }
+        data_ = static_cast<const char*>(data);
+    }
+    close(fd);
+}
+
+MemoryMap::~MemoryMap() {
+    if (data_)
+        munmap(const_cast<char*>(data_), size_);
+}
+
 } // namespace utils
@@ -2,6 +2,7 @@
 #define __UTILS_HPP__
 
 #include <string>
+#include <cstddef>
 
 
 namespace utils {
@@ -38,6 +39,26 @@ namespace utils {
 
     std::string get_filetype(const std::string &fname);
 
+    /**
+     *  Read-only memory mapping of a whole file.
+     *  Throws std::runtime_error if the file can't be mapped.
+     */
+    class MemoryMap {
+      public:
+        explicit MemoryMap(const std::string &filename);
+        ~MemoryMap();
+
+        MemoryMap(const MemoryMap &) = delete;
+        MemoryMap& operator=(const MemoryMap &) = delete;
+
+        const char* data() const { return data_; }
+        size_t size() const { return size_; }
+
+      private:
+        const char *data_;
+        size_t size_;
+    };
+
 } // namespace utils
 
 #endif // __UTILS_HPP__
@@ -1,5 +1,7 @@
 #include "cpp_utils.hpp"
 
+#include <algorithm>
+
 namespace annotate {
 
 bool is_nonzero(const cpp_int &a) {
@@ -141,14 +143,7 @@ void clear_after(std::vector<pos_t> &a, size_t col) {
 
 pos_t msb(const cpp_int &a) {
     assert(a != 0);
-    const mpz_t& a_mpz = a.backend().data();
-    size_t i = mpz_scan1(a_mpz, 0);
-    do {
-        size_t j = mpz_scan1(a_mpz, i + 1);
-        if (j == static_cast<mp_bitcnt_t>(-1))
-            break;
-        i = j;
-    } while (true);
+    size_t i = mpz_sizeinbase(a.backend().data(), 2) - 1;
     if (i > static_cast<pos_t>(-1))
         return static_cast<pos_t>(-1);
     return static_cast<pos_t>(i);
@@ -183,6 +178,63 @@ size_t popcount(const cpp_int &a) {
     return mpz_popcount(a.backend().data());
 }
 
+static_assert(sizeof(mp_limb_t) == sizeof(uint64_t), "GMP limbs must be 64-bit");
+
+bool bit_test(const uint64_t *a, size_t num_words, size_t col) {
+    return col < num_words * 64 && ((a[col >> 6] >> (col & 63)) & 1);
+}
+
+void bit_set(uint64_t *a, size_t num_words, size_t col) {
+    if (col < num_words * 64)
+        a[col >> 6] |= uint64_t(1) << (col & 63);
+}
+
+void bit_unset(uint64_t *a, size_t num_words, size_t col) {
+    if (col < num_words * 64)
+        a[col >> 6] &= ~(uint64_t(1) << (col & 63));
+}
+
+pos_t next_bit(const uint64_t *a, size_t num_words, size_t col) {
+    if (col >= num_words * 64)
+        return static_cast<pos_t>(-1);
+    size_t i = col >> 6;
+    uint64_t word = a[i] & (~uint64_t(0) << (col & 63));
+    while (!word) {
+        if (++i == num_words)
+            return static_cast<pos_t>(-1);
+        word = a[i];
+    }
+    return (i << 6) + __builtin_ctzll(word);
+}
+
+void clear_after(uint64_t *a, size_t num_words, size_t col) {
+    if (col >= num_words * 64)
+        return;
+    a[col >> 6] &= (uint64_t(1) << (col & 63)) - 1;
+    std::fill(a + (col >> 6) + 1, a + num_words, 0);
+}
+
+pos_t msb(const uint64_t *a, size_t num_words) {
+    for (size_t i = num_words; i-- > 0; ) {
+        if (a[i])
+            return (i << 6) + 63 - __builtin_clzll(a[i]);
+    }
+    assert(false);
+    return static_cast<pos_t>(-1);
+}
+
+void bit_or_shifted(uint64_t *a, size_t num_words, const cpp_int &b, size_t shift) {
+    const mpz_t &b_mpz = b.backend().data();
+    const mp_limb_t *limbs = mpz_limbs_read(b_mpz);
+    size_t first = shift >> 6;
+    size_t offset = shift & 63;
+    for (size_t i = 0; i < mpz_size(b_mpz) && first + i < num_words; ++i) {
+        a[first + i] |= limbs[i] << offset;
+        if (offset && first + i + 1 < num_words)
+            a[first + i + 1] |= limbs[i] >> (64 - offset);
+    }
+}
+
 size_t serialize(std::ostream &out, const cpp_int &l_int) {
     size_t a;
     void *l_int_raw = mpz_export(NULL, &a, 1, 1, 0, 0, l_int.backend().data());
@@ -51,6 +51,18 @@ pos_t lsb(const std::vector<pos_t> &a);
 
 size_t popcount(const cpp_int &a);
 
+// The same operations on fixed-width rows of |num_words| 64-bit words,
+// which ignore the bits past the end of the row
+bool bit_test(const uint64_t *a, size_t num_words, size_t col);
+void bit_set(uint64_t *a, size_t num_words, size_t col);
+void bit_unset(uint64_t *a, size_t num_words, size_t col);
+pos_t next_bit(const uint64_t *a, size_t num_words, size_t col);
+void clear_after(uint64_t *a, size_t num_words, size_t col);
+pos_t msb(const uint64_t *a, size_t num_words);
+
+// a |= b << shift
+void bit_or_shifted(uint64_t *a, size_t num_words, const cpp_int &b, size_t shift);
+
 size_t serialize(std::ostream &out, const cpp_int &l_int);
 
 cpp_int load(std::istream &in);
@@ -63,6 +63,66 @@ namespace utils {
         bool stop_;
     };
 
+    /**
+     * A blocking queue of limited capacity for passing data from
+     * producer threads to consumer threads.
+     */
+    template <typename T>
+    class BoundedQueue {
+      public:
+        explicit BoundedQueue(size_t capacity)
+              : capacity_(capacity), closed_(false) {
+            assert(capacity_);
+        }
+
+        // Blocks while the queue is full
+        void push(T&& value) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            not_full_.wait(lock, [this]() {
+                return queue_.size() < capacity_ || closed_;
+            });
+            if (closed_)
+                throw std::runtime_error("push to a closed queue");
+
+            queue_.push(std::move(value));
+            not_empty_.notify_one();
+        }
+
+        // Blocks until there is an element to pop. Returns false if
+        // the queue is empty and has been closed.
+        bool pop(T *value) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            not_empty_.wait(lock, [this]() {
+                return !queue_.empty() || closed_;
+            });
+            if (queue_.empty())
+                return false;
+
+            *value = std::move(queue_.front());
+            queue_.pop();
+            not_full_.notify_one();
+            return true;
+        }
+
+        // Signal that nothing else is going to be pushed
+        void close() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            closed_ = true;
+            not_empty_.notify_all();
+            not_full_.notify_all();
+        }
+
+      private:
+        const size_t capacity_;
+        std::queue<T> queue_;
+
+        std::mutex mutex_;
+        std::condition_variable not_empty_;
+        std::condition_variable not_full_;
+
+        bool closed_;
+    };
+
 } // namespace utils
 
 #endif // __THREAD_POOL_HPP__
@@ -3,10 +3,11 @@
 #include <thread>
 #include <mutex>
 #include <future>
+#include <numeric>
 
 namespace annotate {
 
-std::mutex construct_mtx, merge_mtx;
+std::mutex construct_mtx, merge_mtx, support_mtx;
 
 WaveletTrie::WaveletTrie() : root(nullptr), p_(1) {}
 WaveletTrie::WaveletTrie(size_t p) : root(nullptr), p_(p) {}
@@ -548,6 +549,224 @@ cpp_int WaveletTrie::at(size_t i, pos_t j) const {
     return annot;
 }
 
+void WaveletTrie::at(size_t i, uint64_t *row, size_t num_words) const {
+    std::fill(row, row + num_words, 0);
+    Node *node = root;
+    if (!node)
+        return;
+    assert(i < size());
+    size_t length = 0;
+    while (!node->is_leaf()) {
+        bit_or_shifted(row, num_words, node->alpha_, length);
+        length += msb(node->alpha_) + 1;
+        if (node->beta_[i]) {
+            assert(node->child_[1]);
+            i = node->rank1(i);
+            node = node->child_[1];
+        } else {
+            bit_unset(row, num_words, length - 1);
+            assert(node->child_[0]);
+            i = node->rank0(i);
+            node = node->child_[0];
+        }
+    }
+    bit_or_shifted(row, num_words, node->alpha_, length);
+    // the end marker of the leaf
+    bit_unset(row, num_words, length + msb(node->alpha_));
+}
+
+void WaveletTrie::at_range(size_t begin, size_t end, uint64_t *rows, size_t num_words) const {
+    assert(begin <= end && end <= size());
+    std::vector<size_t> indices(end - begin);
+    std::iota(indices.begin(), indices.end(), begin);
+    at_sorted(indices, rows, num_words);
+}
+
+void WaveletTrie::at_sorted(const std::vector<size_t> &indices,
+                            uint64_t *rows, size_t num_words) const {
+    assert(std::is_sorted(indices.begin(), indices.end()));
+    std::fill(rows, rows + indices.size() * num_words, 0);
+    if (!root || indices.empty())
+        return;
+
+    assert(indices.back() < size());
+    std::vector<size_t> positions(indices);
+    std::vector<size_t> slots(indices.size());
+    std::iota(slots.begin(), slots.end(), 0);
+    std::vector<size_t> buffer(2 * indices.size());
+    root->decode_rows(positions.data(), slots.data(), indices.size(), 0,
+                      rows, num_words, buffer.data());
+}
+
+void WaveletTrie::Node::decode_rows(size_t *positions, size_t *slots, size_t count,
+                                    size_t length, uint64_t *rows, size_t num_words,
+                                    size_t *buffer) {
+    for (size_t k = 0; k < count; ++k) {
+        bit_or_shifted(rows + slots[k] * num_words, num_words, alpha_, length);
+    }
+    if (is_leaf()) {
+        // the end marker of the leaf
+        size_t end = length + msb(alpha_);
+        for (size_t k = 0; k < count; ++k) {
+            bit_unset(rows + slots[k] * num_words, num_words, end);
+        }
+        return;
+    }
+    length += msb(alpha_) + 1;
+
+    // the bits of beta_ are read 64 at a time
+    uint64_t word = 0;
+    size_t word_begin = 0;
+    size_t word_end = 0;
+    auto get_bit = [&](size_t i) {
+        if (i < word_begin || i >= word_end) {
+            word_begin = i;
+            word_end = std::min(i + 64, size());
+            word = beta_.get_int(i, word_end - i);
+        }
+        return (word >> (i - word_begin)) & 1;
+    };
+
+    // split the rows between the children, the zeros stay in place
+    size_t *ones_positions = buffer;
+    size_t *ones_slots = buffer + count;
+    size_t num_zeros = 0;
+    size_t num_ones = 0;
+    // the number of ones before |position|
+    size_t ones = rank1(positions[0]);
+    size_t last_position = positions[0];
+    bool last_bit = get_bit(last_position);
+    for (size_t k = 0; k < count; ++k) {
+        size_t position = positions[k];
+        if (position != last_position) {
+            ones += last_bit;
+            if (position - last_position > 256) {
+                ones = rank1(position);
+            } else {
+                for (size_t i = last_position + 1; i < position; i += 64) {
+                    ones += __builtin_popcountll(
+                        beta_.get_int(i, std::min(position - i, size_t(64)))
+                    );
+                }
+            }
+            last_position = position;
+            last_bit = get_bit(position);
+        }
+        if (last_bit) {
+            ones_positions[num_ones] = ones;
+            ones_slots[num_ones++] = slots[k];
+        } else {
+            bit_unset(rows + slots[k] * num_words, num_words, length - 1);
+            positions[num_zeros] = position - ones;
+            slots[num_zeros++] = slots[k];
+        }
+    }
+    std::copy(ones_positions, ones_positions + num_ones, positions + num_zeros);
+    std::copy(ones_slots, ones_slots + num_ones, slots + num_zeros);
+
+    if (num_zeros) {
+        assert(child_[0]);
+        child_[0]->decode_rows(positions, slots, num_zeros, length,
+                               rows, num_words, buffer);
+    }
+    if (num_ones) {
+        assert(child_[1]);
+        child_[1]->decode_rows(positions + num_zeros, slots + num_zeros, num_ones, length,
+                               rows, num_words, buffer);
+    }
+}
+
+std::vector<size_t> WaveletTrie::rows_with_bit(pos_t j) const {
+    std::vector<size_t> rows;
+    if (root)
+        root->rows_with_bit(j, 0, &rows);
+    return rows;
+}
+
+size_t WaveletTrie::count_rows_with_bit(pos_t j, size_t begin, size_t end) const {
+    end = std::min(end, size());
+    if (!root || begin >= end)
+        return 0;
+    return root->count_rows_with_bit(j, begin, end, 0);
+}
+
+void WaveletTrie::Node::rows_with_bit(pos_t j, size_t length,
+                                      std::vector<size_t> *positions) {
+    positions->clear();
+    size_t branch = length + msb(alpha_);
+    if (j < branch) {
+        // the bit is in the common prefix of the rows
+        if (bit_test(alpha_, j - length)) {
+            positions->resize(size());
+            std::iota(positions->begin(), positions->end(), 0);
+        }
+        return;
+    }
+    if (is_leaf())
+        return;
+
+    if (j == branch) {
+        // the branching bit, read 64 bits at a time
+        positions->reserve(popcount);
+        for (size_t i = 0; i < size(); i += 64) {
+            for (uint64_t word = beta_.get_int(i, std::min(size() - i, size_t(64)));
+                    word; word &= word - 1) {
+                positions->push_back(i + __builtin_ctzll(word));
+            }
+        }
+        return;
+    }
+
+    // the rrr_vector select supports only keep a pointer to the vector
+    std::vector<size_t> children[2];
+    if (child_[0]) {
+        child_[0]->rows_with_bit(j, branch + 1, &children[0]);
+        select0_t select0(&beta_);
+        for (auto &i : children[0]) {
+            i = select0(i + 1);
+        }
+    }
+    if (child_[1]) {
+        child_[1]->rows_with_bit(j, branch + 1, &children[1]);
+        select1_t select1(&beta_);
+        for (auto &i : children[1]) {
+            i = select1(i + 1);
+        }
+    }
+    positions->resize(children[0].size() + children[1].size());
+    std::merge(children[0].begin(), children[0].end(),
+               children[1].begin(), children[1].end(),
+               positions->begin());
+}
+
+size_t WaveletTrie::Node::count_rows_with_bit(pos_t j, size_t begin, size_t end,
+                                              size_t length) {
+    assert(begin < end && end <= size());
+    size_t branch = length + msb(alpha_);
+    if (j < branch)
+        return bit_test(alpha_, j - length) ? end - begin : 0;
+
+    if (is_leaf())
+        return 0;
+
+    size_t ones_begin = rank1(begin);
+    size_t ones_end = rank1(end);
+    if (j == branch)
+        return ones_end - ones_begin;
+
+    size_t count = 0;
+    if (begin - ones_begin < end - ones_end) {
+        assert(child_[0]);
+        count += child_[0]->count_rows_with_bit(j, begin - ones_begin, end - ones_end,
+                                                branch + 1);
+    }
+    if (ones_begin < ones_end) {
+        assert(child_[1]);
+        count += child_[1]->count_rows_with_bit(j, ones_begin, ones_end, branch + 1);
+    }
+    return count;
+}
+
 void WaveletTrie::set_bit(size_t i, pos_t j) {
     assert(i < size());
     WaveletTrie wtr_int(traverse_down(root, i, j), p_);
@@ -1369,23 +1588,28 @@ void WaveletTrie::Node::set_beta_(const Vector &bv) {
 }
 */
 
-size_t WaveletTrie::Node::rank0(const size_t i) {
-    if (i == size())
-        return i - popcount;
+void WaveletTrie::Node::init_rank_support() {
+    // queries may reach the same node from several threads
+    std::lock_guard<std::mutex> lock(support_mtx);
     if (!support) {
         sdsl::util::init_support(rank1_, &beta_);
-        support = true;
+        __atomic_store_n(&support, true, __ATOMIC_RELEASE);
     }
+}
+
+size_t WaveletTrie::Node::rank0(const size_t i) {
+    if (i == size())
+        return i - popcount;
+    if (!__atomic_load_n(&support, __ATOMIC_ACQUIRE))
+        init_rank_support();
     return i - rank1_(i);
 }
 
 size_t WaveletTrie::Node::rank1(const size_t i) {
     if (i == size())
         return popcount;
-    if (!support) {
-        sdsl::util::init_support(rank1_, &beta_);
-        support = true;
-    }
+    if (!__atomic_load_n(&support, __ATOMIC_ACQUIRE))
+        init_rank_support();
     return rank1_(i);
 }
 
@@ -22,6 +22,8 @@ typedef cpp_int alpha_t;
 typedef rrr_t beta_t;
 //typedef bv_t beta_t;
 typedef beta_t::rank_1_type rank1_t;
+typedef beta_t::select_1_type select1_t;
+typedef beta_t::select_0_type select0_t;
 
 class Prefix {
   public:
@@ -62,8 +64,31 @@ class WaveletTrie {
     //destructor
     ~WaveletTrie() noexcept;
 
+    // Safe to call concurrently with other const queries
     cpp_int at(size_t i, pos_t j = static_cast<pos_t>(-1)) const;
 
+    // Write the row |i| to |num_words| words at |row|, dropping the
+    // columns past them. Doesn't allocate memory.
+    void at(size_t i, uint64_t *row, size_t num_words) const;
+
+    // Write the rows from |begin| to |end| - 1, |num_words| words each,
+    // to |rows|. The trie is traversed once for all of them and the
+    // close rows are followed with sequential access instead of ranks.
+    void at_range(size_t begin, size_t end, uint64_t *rows, size_t num_words) const;
+
+    // Same for the rows at the sorted |indices|
+    void at_sorted(const std::vector<size_t> &indices, uint64_t *rows, size_t num_words) const;
+
+    // The sorted indices of the rows with the bit |j| set. Only the
+    // subtrees which don't fix the bit are visited, and their positions
+    // are mapped back to the parents with select.
+    std::vector<size_t> rows_with_bit(pos_t j) const;
+
+    // The number of rows from |begin| to |end| - 1 with the bit |j| set,
+    // counted with rank queries only
+    size_t count_rows_with_bit(pos_t j, size_t begin = 0,
+                               size_t end = static_cast<size_t>(-1)) const;
+
     void set_bit(size_t i, pos_t j);
     template <class Container>
     void set_bits(Container &is, pos_t j);
@@ -161,6 +186,18 @@ class WaveletTrie::Node {
 
     void print(std::ostream &out = std::cout) const;
 
+    // Decode the rows at the sorted |positions| in the node to the rows
+    // |slots| of |rows|. Both arrays are reordered, and |buffer| takes
+    // 2 * |count| values.
+    void decode_rows(size_t *positions, size_t *slots, size_t count, size_t length,
+                     uint64_t *rows, size_t num_words, size_t *buffer);
+
+    // The sorted positions in the node of the rows with the bit |j| set,
+    // where the node starts at the bit |length|
+    void rows_with_bit(pos_t j, size_t length, std::vector<size_t> *positions);
+
+    size_t count_rows_with_bit(pos_t j, size_t begin, size_t end, size_t length);
+
   protected:
     alpha_t alpha_ = 1;
     beta_t beta_;
@@ -170,6 +207,10 @@ class WaveletTrie::Node {
     bool support = false;
 
   private:
+    // Build the rank support for beta_ if it is missing. Thread-safe,
+    // so that concurrent const queries can initialize it lazily.
+    void init_rank_support();
+
     static void merge_(Node *curnode, Node *othnode, size_t i, utils::ThreadPool &thread_queue);
 
     template <class IndexContainer>
@@ -34,6 +34,12 @@ int main(int argc, char** argv) {
     if (maxcount) {
         max_count = atol(maxcount);
     }
+    // decode the rows to NUM_WORDS words in batches instead of cpp_ints
+    const char *numwords = std::getenv("NUM_WORDS");
+    size_t num_words = 0;
+    if (numwords) {
+        num_words = atol(numwords);
+    }
 
     //environment variable arguments
 
@@ -66,8 +72,16 @@ int main(int argc, char** argv) {
         std::cout << "Input:" << std::endl;
         std::cout << "Num edges:\t" << wtr->size() << std::endl;
         extract_timer.reset();
-        for (size_t i = 0; i < max_count; ++i) {
-            wtr->at(i);
+        if (num_words) {
+            const size_t batch_size = 1 << 12;
+            std::vector<uint64_t> rows(batch_size * num_words);
+            for (size_t i = 0; i < max_count; i += batch_size) {
+                wtr->at_range(i, std::min(i + batch_size, max_count), rows.data(), num_words);
+            }
+        } else {
+            for (size_t i = 0; i < max_count; ++i) {
+                wtr->at(i);
+            }
         }
         double query_time = extract_timer.elapsed();
         std::cout << "Decomptime:\t" << query_time << std::endl;
@@ -1,8 +1,14 @@
 #include "wavelet_trie_annotator.hpp"
 
+#include <numeric>
+#include <queue>
+
 
 namespace annotate {
 
+constexpr size_t WaveletTrieAnnotator::kNumSampledRows;
+constexpr size_t WaveletTrieAnnotator::kInlineWords;
+
 WaveletTrieAnnotator::WaveletTrieAnnotator(const hash_annotate::DeBruijnGraphWrapper &graph, size_t p)
   : graph_(graph),
     wt_(p),
@@ -15,6 +21,9 @@ WaveletTrieAnnotator::WaveletTrieAnnotator(const hash_annotate::PreciseHashAnnot
     : graph_(graph),
       wt_(p),
       num_columns_(precise.num_columns()) {
+    if (permut_map.size())
+        set_permutation(std::unordered_map<size_t, size_t>(permut_map));
+
     if (p == 1) {
         wt_ = annotate::WaveletTrie(extract_index_set(precise, std::move(permut_map)), p);
         //wt_ = annotate::WaveletTrie(extract_raw_annots(precise), p);
@@ -72,51 +81,78 @@ WaveletTrieAnnotator::WaveletTrieAnnotator(const hash_annotate::PreciseHashAnnot
     }
 }
 
-void WaveletTrieAnnotator::load_from_precise_file(std::istream &in, size_t p) {
+void WaveletTrieAnnotator::load_from_precise_file(std::istream &in, size_t p,
+                                                  bool reorder_columns) {
     //std::vector<std::set<pos_t>> rows(graph_.get_num_edges());
-    std::vector<std::vector<pos_t>> rows(graph_.get_num_edges());
-    size_t prefix_size = serialization::loadNumber(in);
+    std::vector<std::vector<pos_t>> rows;
     std::set<pos_t> prefix_indices;
-    while (prefix_size--) {
-        prefix_indices.insert(serialization::loadNumber(in));
-    }
+    size_t precise_size;
 
-    num_columns_ = serialization::loadNumber(in);
+    if (hash_annotate::PreciseHashAnnotator::load_rows(in, &prefix_indices,
+                                                       &num_columns_, &rows, p)) {
+        // the rows are already in the order of the edges
+        if (rows.size() != graph_.get_num_edges()) {
+            std::cerr << "ERROR: the precise annotation does not match the graph"
+                      << std::endl;
+            exit(1);
+        }
+        if (prefix_indices.size() && !reorder_columns) {
+            auto permut_map = hash_annotate::PreciseHashAnnotator::compute_permutation_map(
+                    num_columns_,
+                    prefix_indices);
+            for (auto &row : rows) {
+                for (auto &i : row) {
+                    i = permut_map[i];
+                }
+            }
+        }
+        precise_size = rows.size();
+    } else {
+        rows.resize(graph_.get_num_edges());
+        size_t prefix_size = serialization::loadNumber(in);
+        while (prefix_size--) {
+            prefix_indices.insert(serialization::loadNumber(in));
+        }
 
-    auto permut_map = hash_annotate::PreciseHashAnnotator::compute_permutation_map(
-            num_columns_,
-            prefix_indices);
+        num_columns_ = serialization::loadNumber(in);
 
-    size_t precise_size = serialization::loadNumber(in);
+        auto permut_map = reorder_columns
+            ? std::unordered_map<size_t, size_t>()
+            : hash_annotate::PreciseHashAnnotator::compute_permutation_map(
+                  num_columns_,
+                  prefix_indices);
 
-    //utils::ThreadPool thread_queue(p);
-    size_t step = (precise_size + p - 1) / p;
-    std::vector<std::future<annotate::WaveletTrie>> wtrs;
-    std::vector<std::future<std::set<pos_t>>> rows_fut(rows.size());
-
-    while (precise_size--) {
-        //load row
-        size_t num_size = serialization::loadNumber(in);
-        std::vector<pos_t> indices(num_size);
-        for (auto &i : indices) {
-            i = prefix_indices.size()
-                ? permut_map[serialization::loadNumber(in)]
-                : serialization::loadNumber(in);
+        precise_size = serialization::loadNumber(in);
+        size_t num_rows = precise_size;
+
+        while (num_rows--) {
+            //load row
+            size_t num_size = serialization::loadNumber(in);
+            std::vector<pos_t> indices(num_size);
+            for (auto &i : indices) {
+                i = permut_map.size()
+                    ? permut_map[serialization::loadNumber(in)]
+                    : serialization::loadNumber(in);
+            }
+            auto kmer = serialization::loadString(in);
+            auto edge_index = graph_.map_kmer(kmer);
+            if (edge_index >= graph_.first_edge()
+                    && edge_index <= graph_.last_edge()) {
+                rows[edge_index] = std::move(indices);
+            }
         }
-        auto kmer = serialization::loadString(in);
-        auto edge_index = graph_.map_kmer(kmer);
-        if (edge_index >= graph_.first_edge()
-                && edge_index <= graph_.last_edge()) {
-            rows[edge_index] = std::move(indices);
-            //rows[edge_index].insert(indices.begin(), indices.end());
-            /*
-            rows_fut[edge_index] = thread_queue.enqueue([](auto indices){
-                return std::set<pos_t>(indices.begin(), indices.end());
-            }, std::move(indices));
-            */
+    }
+
+    if (reorder_columns) {
+        set_permutation(compute_column_order(rows, num_columns_));
+        for (auto &row : rows) {
+            for (auto &i : row) {
+                i = permut_map_[i];
+            }
         }
     }
-    //thread_queue.join();
+
+    size_t step = (precise_size + p - 1) / p;
     auto it = rows.begin();
     for (; it + step <= rows.end(); it += step) {
         /*
@@ -166,6 +202,18 @@ void WaveletTrieAnnotator::add_sequence(const std::string &sequence,
     if (column < static_cast<hash_annotate::pos_t>(-1) && column >= num_columns_)
         num_columns_ = column + 1;
 
+    if (permut_map_.size() && column < static_cast<hash_annotate::pos_t>(-1)) {
+        // the new columns keep their indices
+        auto it = permut_map_.find(column);
+        if (it == permut_map_.end()) {
+            auto permut_map = std::move(permut_map_);
+            permut_map.emplace(column, column);
+            set_permutation(std::move(permut_map));
+        } else {
+            column = it->second;
+        }
+    }
+
     size_t wt_old_size = wt_.size();
     std::vector<std::vector<pos_t>> edges_new(graph_.get_num_edges() - wt_old_size);
     //std::set<size_t> edge_old;
@@ -197,21 +245,55 @@ void WaveletTrieAnnotator::add_column(const std::string &sequence, bool rooted)
 }
 
 
-std::vector<uint64_t> WaveletTrieAnnotator::annotate_edge(hash_annotate::DeBruijnGraphWrapper::edge_index i, bool permute) const {
-    auto vect = wt_.at(i);
-    size_t a = mpz_size(vect.backend().data());
-    std::vector<uint64_t> ret_vect(std::max(
-                ((a << 3) + 63) >> 6,
-                (num_columns_ + 63) >> 6));
-    mpz_export(ret_vect.data(), &a, -1, sizeof(uint64_t), 0, 0, vect.backend().data());
-#ifndef NDEBUG
-    if (((num_columns_ + 63) >> 6) < ret_vect.size()) {
-        for (auto it = ret_vect.begin() + a; it != ret_vect.end(); ++it) {
-            assert(!*it);
+void WaveletTrieAnnotator::export_row(hash_annotate::DeBruijnGraphWrapper::edge_index i,
+                                      uint64_t *row) const {
+    if (original_columns_.empty()) {
+        wt_.at(i, row, num_words());
+        return;
+    }
+
+    // the rows of a few hundred columns are decoded on the stack
+    uint64_t inline_row[kInlineWords];
+    std::vector<uint64_t> heap_row;
+    uint64_t *trie_row = inline_row;
+    if (num_words() > kInlineWords) {
+        heap_row.resize(num_words());
+        trie_row = heap_row.data();
+    }
+    wt_.at(i, trie_row, num_words());
+    restore_columns(trie_row, row);
+}
+
+void WaveletTrieAnnotator::export_rows(hash_annotate::DeBruijnGraphWrapper::edge_index begin,
+                                       hash_annotate::DeBruijnGraphWrapper::edge_index end,
+                                       uint64_t *rows) const {
+    wt_.at_range(begin, end, rows, num_words());
+    if (original_columns_.empty())
+        return;
+
+    std::vector<uint64_t> trie_row(num_words());
+    for (size_t i = 0; i < end - begin; ++i) {
+        uint64_t *row = rows + i * num_words();
+        std::copy(row, row + num_words(), trie_row.begin());
+        restore_columns(trie_row.data(), row);
+    }
+}
+
+void WaveletTrieAnnotator::restore_columns(const uint64_t *trie_row, uint64_t *row) const {
+    // move the columns back from their positions in the trie
+    std::fill(row, row + num_words(), 0);
+    for (size_t w = 0; w < num_words(); ++w) {
+        for (uint64_t word = trie_row[w]; word; word &= word - 1) {
+            size_t j = w * 64 + __builtin_ctzll(word);
+            bit_set(row, num_words(), j < original_columns_.size() ? original_columns_[j] : j);
         }
     }
-#endif
-    ret_vect.resize((num_columns_ + 63) >> 6);
+}
+
+
+std::vector<uint64_t> WaveletTrieAnnotator::annotate_edge(hash_annotate::DeBruijnGraphWrapper::edge_index i, bool permute) const {
+    std::vector<uint64_t> ret_vect(num_words());
+    export_row(i, ret_vect.data());
     std::ignore = permute;
     /*
     if (permute && permut_map_.size()) {
@@ -241,6 +323,65 @@ std::vector<uint64_t> WaveletTrieAnnotator::annotation_from_kmer(const std::stri
     return std::vector<uint64_t>((num_columns_ + 63) >> 6);
 }
 
+size_t WaveletTrieAnnotator::annotate_sequence(const std::string &sequence,
+                                               uint64_t *annotations) const {
+    if (sequence.size() < graph_.get_k() + 1)
+        return 0;
+
+    size_t num_kmers = sequence.size() - graph_.get_k();
+    std::vector<hash_annotate::DeBruijnGraphWrapper::edge_index> edges(num_kmers);
+    graph_.map_kmers(sequence, edges.data());
+
+    size_t num_found = 0;
+    for (size_t i = 0; i < num_kmers; ++i) {
+        if (edges[i] == hash_annotate::DeBruijnGraphWrapper::npos) {
+            std::fill(annotations + i * num_words(),
+                      annotations + (i + 1) * num_words(), 0);
+        } else {
+            export_row(edges[i], annotations + i * num_words());
+            num_found++;
+        }
+    }
+    return num_found;
+}
+
+pos_t WaveletTrieAnnotator::trie_column(pos_t column) const {
+    auto it = permut_map_.find(column);
+    return it != permut_map_.end() ? it->second : column;
+}
+
+std::vector<hash_annotate::DeBruijnGraphWrapper::edge_index>
+WaveletTrieAnnotator::edges_with_label(pos_t column) const {
+    if (column >= num_columns_)
+        return {};
+
+    auto rows = wt_.rows_with_bit(trie_column(column));
+    return std::vector<hash_annotate::DeBruijnGraphWrapper::edge_index>(rows.begin(),
+                                                                        rows.end());
+}
+
+size_t WaveletTrieAnnotator::count_edges_with_label(pos_t column,
+                                                    hash_annotate::DeBruijnGraphWrapper::edge_index begin,
+                                                    hash_annotate::DeBruijnGraphWrapper::edge_index end) const {
+    if (column >= num_columns_)
+        return 0;
+
+    return wt_.count_rows_with_bit(trie_column(column), begin, end);
+}
+
+size_t WaveletTrieAnnotator::count_labels(const std::string &sequence, uint64_t *counts) const {
+    if (sequence.size() < graph_.get_k() + 1)
+        return 0;
+
+    size_t num_kmers = sequence.size() - graph_.get_k();
+    std::vector<uint64_t> annotations(num_kmers * num_words());
+    size_t num_found = annotate_sequence(sequence, annotations.data());
+    for (size_t i = 0; i < num_kmers; ++i) {
+        hash_annotate::count_bits(&annotations[i * num_words()], num_words(), counts);
+    }
+    return num_found;
+}
+
 uint64_t WaveletTrieAnnotator::serialize(std::ostream &out) const {
     //return serialization::serializeNumber(out, num_columns_)
     //     + wt_.serialize(out);
@@ -270,13 +411,14 @@ bool WaveletTrieAnnotator::load(std::istream &in) {
         wt_.load(in);
         num_columns_ = serialization::loadNumber(in);
 
-        permut_map_.clear();
+        std::unordered_map<size_t, size_t> permut_map;
         size_t permut_size = serialization::loadNumber(in);
         while (permut_size--) {
             size_t first = serialization::loadNumber(in);
             size_t second = serialization::loadNumber(in);
-            permut_map_.emplace(first, second);
+            permut_map.emplace(first, second);
         }
+        set_permutation(std::move(permut_map));
 
         return true;
     } catch (...) {
@@ -311,6 +453,95 @@ std::vector<cpp_int> WaveletTrieAnnotator::extract_raw_annots(const hash_annotat
     return annots;
 }
 
+void WaveletTrieAnnotator::set_permutation(std::unordered_map<size_t, size_t>&& permut_map) {
+    permut_map_ = std::move(permut_map);
+    original_columns_.clear();
+    for (const auto &pair : permut_map_) {
+        if (pair.second >= original_columns_.size()) {
+            size_t old_size = original_columns_.size();
+            original_columns_.resize(pair.second + 1);
+            std::iota(original_columns_.begin() + old_size, original_columns_.end(), old_size);
+        }
+        original_columns_[pair.second] = pair.first;
+    }
+}
+
+// Sample evenly spaced rows, then pick the columns one by one, each time
+// the column set in the most rows without any of the columns picked so far
+template <class GetRow>
+static std::unordered_map<size_t, size_t>
+order_columns(size_t num_rows, size_t num_columns, size_t num_sampled_rows, GetRow get_row) {
+    const size_t step = std::max(num_rows / std::max(num_sampled_rows, size_t(1)),
+                                 size_t(1));
+    std::vector<std::vector<pos_t>> rows;
+    std::vector<std::vector<uint32_t>> column_rows(num_columns);
+    for (size_t r = 0; r < num_rows; r += step) {
+        const auto &row = get_row(r);
+        rows.emplace_back(row.begin(), row.end());
+        for (auto j : rows.back()) {
+            column_rows.at(j).push_back(rows.size() - 1);
+        }
+    }
+
+    // the number of rows without any of the picked columns, by column
+    std::vector<size_t> uncovered(num_columns);
+    for (size_t j = 0; j < num_columns; ++j) {
+        uncovered[j] = column_rows[j].size();
+    }
+    // the counts only decrease, so the outdated ones are updated when
+    // they get on the top. Ties go to the more frequent and then the
+    // first column.
+    auto less = [&](const std::pair<size_t, size_t> &a, const std::pair<size_t, size_t> &b) {
+        if (a.first != b.first)
+            return a.first < b.first;
+        if (column_rows[a.second].size() != column_rows[b.second].size())
+            return column_rows[a.second].size() < column_rows[b.second].size();
+        return a.second > b.second;
+    };
+    std::priority_queue<std::pair<size_t, size_t>,
+                        std::vector<std::pair<size_t, size_t>>,
+                        decltype(less)> queue(less);
+    for (size_t j = 0; j < num_columns; ++j) {
+        queue.emplace(uncovered[j], j);
+    }
+
+    std::vector<bool> covered(rows.size(), false);
+    std::unordered_map<size_t, size_t> permut_map;
+    while (queue.size()) {
+        auto top = queue.top();
+        queue.pop();
+        if (top.first != uncovered[top.second]) {
+            queue.emplace(uncovered[top.second], top.second);
+            continue;
+        }
+        permut_map.emplace(top.second, permut_map.size());
+        for (auto r : column_rows[top.second]) {
+            if (covered[r])
+                continue;
+            covered[r] = true;
+            for (auto j : rows[r]) {
+                uncovered[j]--;
+            }
+        }
+    }
+    return permut_map;
+}
+
+std::unordered_map<size_t, size_t>
+WaveletTrieAnnotator::compute_column_order(const std::vector<std::vector<pos_t>> &rows,
+                                           size_t num_columns,
+                                           size_t num_sampled_rows) {
+    return order_columns(rows.size(), num_columns, num_sampled_rows,
+                         [&](size_t r) -> const std::vector<pos_t>& { return rows[r]; });
+}
+
+std::unordered_map<size_t, size_t>
+WaveletTrieAnnotator::compute_column_order(const hash_annotate::PreciseHashAnnotator &precise,
+                                           size_t num_sampled_rows) {
+    return order_columns(precise.size(), precise.num_columns(), num_sampled_rows,
+                         [&](size_t r) { return precise.annotate_edge_indices(r); });
+}
+
 std::vector<std::vector<pos_t>>
 WaveletTrieAnnotator
 ::extract_index_set(const hash_annotate::PreciseHashAnnotator &precise,
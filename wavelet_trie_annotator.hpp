@@ -13,12 +13,34 @@ class WaveletTrieAnnotator : public hash_annotate::PreciseAnnotator {
   public:
     WaveletTrieAnnotator(const hash_annotate::DeBruijnGraphWrapper &graph, size_t p = 1);
     
+    // The columns are moved to their positions in |permut_map|, which is
+    // kept with the trie. Without it, the prefix columns of |precise| are
+    // moved to the front.
     WaveletTrieAnnotator(const hash_annotate::PreciseHashAnnotator &precise,
                          const hash_annotate::DeBruijnGraphWrapper &graph,
                          size_t p = 1,
                          std::unordered_map<size_t, size_t>&& permut_map = {});
 
-    void load_from_precise_file(std::istream &in, size_t p = 1);
+    // Build the trie from a serialized PreciseHashAnnotator. If
+    // |reorder_columns| is set, the columns are ordered by
+    // compute_column_order() instead of putting the prefix columns first.
+    void load_from_precise_file(std::istream &in, size_t p = 1,
+                                bool reorder_columns = false);
+
+    static constexpr size_t kNumSampledRows = 1 << 20;
+
+    // An order of the columns for a smaller trie, mapping each column to
+    // its new position. The rows branch off the leftmost path of the trie
+    // at their first set column, so the columns are picked greedily by
+    // the number of rows in a sample not covered by the columns before.
+    static std::unordered_map<size_t, size_t>
+    compute_column_order(const std::vector<std::vector<pos_t>> &rows,
+                         size_t num_columns,
+                         size_t num_sampled_rows = kNumSampledRows);
+
+    static std::unordered_map<size_t, size_t>
+    compute_column_order(const hash_annotate::PreciseHashAnnotator &precise,
+                         size_t num_sampled_rows = kNumSampledRows);
 
     ~WaveletTrieAnnotator() {}
 
@@ -32,6 +54,33 @@ class WaveletTrieAnnotator : public hash_annotate::PreciseAnnotator {
 
     std::vector<uint64_t> annotation_from_kmer(const std::string &kmer, bool permute = false) const;
 
+    // Annotate all k-mers of the sequence, writing num_words() words per
+    // k-mer to |annotations|. The k-mers missing in the graph get empty
+    // annotations. Returns the number of k-mers found in the graph.
+    size_t annotate_sequence(const std::string &sequence, uint64_t *annotations) const;
+
+    // Write the rows of the edges from |begin| to |end| - 1 to |rows|,
+    // num_words() words each. Cheaper than exporting the rows one by one.
+    void export_rows(hash_annotate::DeBruijnGraphWrapper::edge_index begin,
+                     hash_annotate::DeBruijnGraphWrapper::edge_index end,
+                     uint64_t *rows) const;
+
+    // The sorted edges annotated with |column|, found without decoding
+    // the rows
+    std::vector<hash_annotate::DeBruijnGraphWrapper::edge_index>
+    edges_with_label(pos_t column) const;
+
+    // The number of edges from |begin| to |end| - 1 annotated with |column|
+    size_t count_edges_with_label(pos_t column,
+                                  hash_annotate::DeBruijnGraphWrapper::edge_index begin = 0,
+                                  hash_annotate::DeBruijnGraphWrapper::edge_index end
+                                      = hash_annotate::DeBruijnGraphWrapper::npos) const;
+
+    // Count the k-mers of the sequence annotated with each column, adding
+    // them to the num_columns() values at |counts|. Returns the number of
+    // k-mers found in the graph.
+    size_t count_labels(const std::string &sequence, uint64_t *counts) const;
+
     uint64_t serialize(std::ostream &out) const;
     uint64_t serialize(const std::string &filename) const;
 
@@ -42,6 +91,8 @@ class WaveletTrieAnnotator : public hash_annotate::PreciseAnnotator {
 
     size_t num_columns() const { return num_columns_; }
 
+    size_t num_words() const { return (num_columns_ + 63) >> 6; }
+
     bool operator==(const WaveletTrieAnnotator &that) const {
         return num_columns_ == that.num_columns_
             && wt_ == that.wt_;
@@ -59,7 +110,24 @@ class WaveletTrieAnnotator : public hash_annotate::PreciseAnnotator {
     const hash_annotate::DeBruijnGraphWrapper &graph_;
     WaveletTrie wt_;
     size_t num_columns_;
+    // The positions of the columns in the trie, if they are reordered.
+    // The rows are exported with the original columns.
     std::unordered_map<size_t, size_t> permut_map_;
+    std::vector<pos_t> original_columns_;
+
+    void set_permutation(std::unordered_map<size_t, size_t>&& permut_map);
+
+    static constexpr size_t kInlineWords = 8;
+
+    // Write the row |i| to num_words() words at |row|
+    void export_row(hash_annotate::DeBruijnGraphWrapper::edge_index i, uint64_t *row) const;
+
+    // Write the row with the columns in the trie order |trie_row| to |row|
+    // with the original columns
+    void restore_columns(const uint64_t *trie_row, uint64_t *row) const;
+
+    // The position of |column| in the trie
+    pos_t trie_column(pos_t column) const;
 
     std::vector<cpp_int> extract_raw_annots(const hash_annotate::PreciseHashAnnotator &precise);
 